@@ -0,0 +1,1161 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cwctype>
+#include <map>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "chart.hpp"
+#include "coroutine.hpp"
+#include "fontmetrics.hpp"
+#include "grid.hpp"
+#include "layout.hpp"
+#include "listfilter.hpp"
+#include "winutil.hpp"
+
+// Benchmarks for the library hot paths. Build the "benchmark" target and run
+// it under Windows or Wine (the "run-benchmark" target does that). Every
+// result is printed as one line: "<benchmark name> <value> <unit>".
+// Benchmark groups can be selected by passing their names as arguments.
+
+// Count heap allocations made by the code under test.
+static std::atomic<size_t> g_allocationCount(0);
+
+void *operator new(size_t size) {
+  ++g_allocationCount;
+  if (void *res = std::malloc(size == 0 ? 1 : size)) {
+    return res;
+  }
+  throw std::bad_alloc();
+}
+
+// Used for the temporary buffers of std::stable_sort().
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  ++g_allocationCount;
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+// Memory resources allocate with explicit alignment. The code under test
+// doesn't need more than malloc() provides.
+void *operator new(size_t size, std::align_val_t align) {
+  ++g_allocationCount;
+  if (static_cast<size_t>(align) <= alignof(std::max_align_t)) {
+    if (void *res = std::malloc(size == 0 ? 1 : size)) {
+      return res;
+    }
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+template <typename Func>
+static double MeasureSeconds(Func func) {
+  auto start = std::chrono::steady_clock::now();
+  func();
+  auto finish = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(finish - start).count();
+}
+
+static double NowSeconds() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static void Report(const char *name, double value, const char *unit) {
+  std::printf("%s %.6f %s\n", name, value, unit);
+}
+
+static void BenchmarkListBoxFill() {
+  const int kLineCount = 100000;
+  std::vector<std::wstring> lines;
+  lines.reserve(kLineCount);
+  for (int i = 0; i < kLineCount; ++i) {
+    lines.push_back(L"Line " + std::to_wstring(i));
+  }
+
+  Window window(nullptr, {400, 400});
+  window.Show();
+  ListBox listBox(&window, {0, 0}, {380, 360});
+
+  double single = MeasureSeconds([&]() {
+    for (const std::wstring &line : lines) {
+      listBox.AddLine(line);
+    }
+  });
+  Report("listbox_add_line_100k", single, "s");
+
+  listBox.Clear();
+  double batched = MeasureSeconds([&]() { listBox.AddLines(lines); });
+  Report("listbox_add_lines_100k", batched, "s");
+}
+
+static void BenchmarkWidgetLifetime() {
+  const int kWidgetCount = 5000;
+  Window window(nullptr, {400, 400});
+  window.Show();
+  Panel *panel = nullptr;
+  double create = MeasureSeconds([&]() {
+    panel = new Panel(&window, {0, 0}, {400, 400});
+    for (int i = 0; i < kWidgetCount; ++i) {
+      new Label(panel, {0, i % 20 * 20}, L"Label");
+    }
+  });
+  Report("widget_create", create / kWidgetCount * 1e9, "ns/widget");
+  double teardown = MeasureSeconds([&]() { delete panel; });
+  Report("widget_teardown", teardown / kWidgetCount * 1e9, "ns/widget");
+}
+
+static void BenchmarkTitle() {
+  const int kRounds = 100000;
+  Window window(nullptr, {400, 400});
+  Edit edit(&window, {0, 0}, 200);
+  std::wstring title(64, L'x');
+  std::wstring buffer;
+  double set = MeasureSeconds([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      title[i % title.size()] = static_cast<wchar_t>(L'a' + i % 26);
+      edit.SetTitle(title);
+    }
+  });
+  Report("set_title", set / kRounds * 1e9, "ns/call");
+  size_t allocations = g_allocationCount;
+  size_t length = 0;
+  double get = MeasureSeconds([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      edit.GetTitle(buffer);
+      length += buffer.size();
+    }
+  });
+  allocations = g_allocationCount - allocations;
+  Report("get_title", get / kRounds * 1e9, "ns/call");
+  Report("get_title_allocs", static_cast<double>(allocations) / kRounds,
+         "allocs/call");
+}
+
+static void BenchmarkTranscoding(const char *name, const std::wstring &text) {
+  const int kRounds = 20;
+  std::string utf8 = WideStringToUtf8(text);
+  std::wstring wide;
+  std::string narrow;
+  double toWide = MeasureSeconds([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      Utf8ToWideString(utf8, wide);
+    }
+  });
+  double toUtf8 = MeasureSeconds([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      WideStringToUtf8(text, narrow);
+    }
+  });
+  double megabytes = kRounds * utf8.size() / 1e6;
+  Report((std::string("utf8_to_wide_") + name).c_str(), megabytes / toWide,
+         "MB/s");
+  Report((std::string("wide_to_utf8_") + name).c_str(), megabytes / toUtf8,
+         "MB/s");
+}
+
+static void BenchmarkTranscoding() {
+  const int kLineCount = 100000;
+  std::wstring ascii;
+  std::wstring cjk;
+  for (int i = 0; i < kLineCount; ++i) {
+    ascii += L"12:34:56.789 [info] order " + std::to_wstring(i) +
+             L" filled at 101.25\n";
+    for (int j = 0; j < 16; ++j) {
+      cjk += static_cast<wchar_t>(0x4e00 + (i * 16 + j) % 0x5000);
+    }
+    cjk += L" " + std::to_wstring(i) + L"\n";
+  }
+  BenchmarkTranscoding("ascii", ascii);
+  BenchmarkTranscoding("cjk", cjk);
+}
+
+static void BenchmarkEventActivate(int subscriberCount) {
+  const int kRounds = 100000 / subscriberCount + 100;
+  EventHandler<void(int, const std::wstring &)> handler;
+  int64_t sum = 0;
+  for (int i = 0; i < subscriberCount; ++i) {
+    handler.AddEvent([&sum](int value, const std::wstring &str) {
+      sum += value + static_cast<int64_t>(str.size());
+    });
+  }
+  std::wstring arg = L"argument";
+  size_t allocations = g_allocationCount;
+  double time = MeasureSeconds([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      handler.Activate(i, arg);
+    }
+  });
+  allocations = g_allocationCount - allocations;
+  std::string suffix = std::to_string(subscriberCount);
+  Report(("event_activate_allocs_" + suffix).c_str(),
+         static_cast<double>(allocations) / kRounds, "allocs/call");
+  Report(("event_activate_time_" + suffix).c_str(), time / kRounds * 1e9,
+         "ns/call");
+}
+
+static void BenchmarkMessageDispatch() {
+  const int kPanelCount = 500;
+  const int kRounds = 100000;
+  Window window(nullptr, {400, 400});
+  std::vector<Panel *> panels;
+  for (int i = 0; i < kPanelCount; ++i) {
+    panels.push_back(new Panel(&window, {0, 0}, {10, 10}));
+  }
+  Panel *panel = panels[kPanelCount / 2];
+  std::vector<Button *> buttons;
+  for (int i = 0; i < kPanelCount; ++i) {
+    buttons.push_back(new Button(panel, {0, 0}, L"Button"));
+  }
+  Button *button = buttons.back();
+  int clicks = 0;
+  button->OnClick.AddEvent([&]() { ++clicks; });
+
+  double unhandled = MeasureSeconds([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      SendMessageW(panel->Handle(), WM_USER, 0, 0);
+    }
+  });
+  Report("dispatch_unhandled_message", unhandled / kRounds * 1e9, "ns/msg");
+
+  WPARAM command = reinterpret_cast<intptr_t>(button->WidgetId());
+  double routed = MeasureSeconds([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      SendMessageW(panel->Handle(), WM_COMMAND, command,
+                   (LPARAM)button->Handle());
+    }
+  });
+  Report("dispatch_command_to_child", routed / kRounds * 1e9, "ns/msg");
+
+  // The cost of the lookups previously done per message: a map from HWND to
+  // window, searched twice, and a map from child id to widget.
+  std::map<HWND, Widget *> windows;
+  std::map<HMENU, Widget *> children;
+  for (int i = 0; i < kPanelCount; ++i) {
+    windows[panels[i]->Handle()] = panels[i];
+    children[buttons[i]->WidgetId()] = buttons[i];
+  }
+  size_t found = 0;
+  double lookup = MeasureSeconds([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      HWND hWnd = panels[i % kPanelCount]->Handle();
+      if (windows.count(hWnd) && windows.at(hWnd) != nullptr) {
+        ++found;
+      }
+      HMENU id = buttons[i % kPanelCount]->WidgetId();
+      if (children.count(id) && children.at(id) != nullptr) {
+        ++found;
+      }
+    }
+  });
+  Report("dispatch_map_lookup_reference", lookup / kRounds * 1e9, "ns/msg");
+}
+
+static void BenchmarkTextMeasure() {
+  const int kLabelCount = 2000;
+  const int kRounds = 100000;
+  Window window(nullptr, {400, 400});
+  std::vector<std::wstring> captions;
+  for (int i = 0; i < kLabelCount; ++i) {
+    captions.push_back(L"Caption number " + std::to_wstring(i));
+  }
+
+  std::vector<Label *> labels;
+  labels.reserve(kLabelCount);
+  double create = MeasureSeconds([&]() {
+    for (const std::wstring &caption : captions) {
+      labels.push_back(new Label(&window, {0, 0}, caption));
+    }
+  });
+  Report("label_create", create / kLabelCount * 1e6, "us/label");
+  for (Label *label : labels) {
+    delete label;
+  }
+
+  FontMetrics &metrics =
+      GetFontMetrics(static_cast<HFONT>(GetStockObject(DEFAULT_GUI_FONT)));
+  int64_t width = 0;
+  double measure = MeasureSeconds([&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      width += metrics.Measure(captions[i % kLabelCount]).cx;
+    }
+  });
+  Report("font_metrics_measure", measure / kRounds * 1e9, "ns/string");
+}
+
+static double CreateTabs(bool deferred) {
+  const int kTabCount = 40;
+  const int kControlCount = 50;
+  Window window(nullptr, {400, 400});
+  return MeasureSeconds([&]() {
+    std::unique_ptr<DeferredCreationScope> scope;
+    if (deferred) {
+      scope.reset(new DeferredCreationScope());
+    }
+    for (int i = 0; i < kTabCount; ++i) {
+      Panel *tab = new Panel(&window, {0, 0}, {400, 400});
+      if (i != 0) {
+        tab->Hide();
+      }
+      for (int j = 0; j < kControlCount; ++j) {
+        new Label(tab, {0, j * 20}, L"Setting " + std::to_wstring(j));
+      }
+    }
+    window.Show();
+  });
+}
+
+static void BenchmarkDeferredCreation() {
+  Report("create_tabs_immediate", CreateTabs(false), "s");
+  Report("create_tabs_deferred", CreateTabs(true), "s");
+}
+
+// Build a hidden tree of 100 panels with 100 labels each, then walk and
+// delete it.
+static void BenchmarkWidgetTree(const char *name, WidgetArena *arena) {
+  const int kPanelCount = 100;
+  const int kLabelCount = 100;
+  const int kWidgetCount = kPanelCount * (kLabelCount + 1);
+  std::string prefix = std::string("widget_tree_") + name;
+  Window window(nullptr, {400, 400});
+  std::unique_ptr<WidgetArenaScope> arenaScope;
+  if (arena != nullptr) {
+    arenaScope.reset(new WidgetArenaScope(*arena));
+  }
+  Panel *root = nullptr;
+  size_t allocations = g_allocationCount;
+  double build = MeasureSeconds([&]() {
+    DeferredCreationScope scope;
+    root = new Panel(&window, {0, 0}, {400, 400});
+    root->Hide();
+    for (int i = 0; i < kPanelCount; ++i) {
+      Panel *panel = new Panel(root, {0, 0}, {400, 400});
+      for (int j = 0; j < kLabelCount; ++j) {
+        new Label(panel, {0, j * 20}, L"Label");
+      }
+    }
+  });
+  allocations = g_allocationCount - allocations;
+  Report((prefix + "_build").c_str(), build / kWidgetCount * 1e9,
+         "ns/widget");
+  Report((prefix + "_build_allocs").c_str(),
+         static_cast<double>(allocations) / kWidgetCount, "allocs/widget");
+
+  const int kWalkRounds = 100;
+  size_t visited = 0;
+  double walk = MeasureSeconds([&]() {
+    for (int round = 0; round < kWalkRounds; ++round) {
+      for (Widget *panel = root->FirstChild(); panel != nullptr;
+           panel = panel->NextSibling()) {
+        for (Widget *label = panel->FirstChild(); label != nullptr;
+             label = label->NextSibling()) {
+          ++visited;
+        }
+      }
+    }
+  });
+  if (visited != static_cast<size_t>(kPanelCount) * kLabelCount * kWalkRounds) {
+    std::fprintf(stderr, "widget tree walk missed some widgets\n");
+  }
+  Report((prefix + "_walk").c_str(),
+         walk / (static_cast<double>(kWidgetCount) * kWalkRounds) * 1e9,
+         "ns/widget");
+
+  double teardown = MeasureSeconds([&]() { delete root; });
+  Report((prefix + "_teardown").c_str(), teardown / kWidgetCount * 1e9,
+         "ns/widget");
+}
+
+static void BenchmarkWidgetArena() {
+  BenchmarkWidgetTree("heap", nullptr);
+  WidgetArena arena;
+  BenchmarkWidgetTree("arena", &arena);
+}
+
+// Close a window with 100 panels of 100 labels each.
+static void BenchmarkTeardown() {
+  const int kPanelCount = 100;
+  const int kLabelCount = 100;
+  const int kWidgetCount = kPanelCount * (kLabelCount + 1);
+  Window *window = new Window(nullptr, {400, 400});
+  window->Show();
+  for (int i = 0; i < kPanelCount; ++i) {
+    Panel *panel = new Panel(window, {0, 0}, {400, 400});
+    for (int j = 0; j < kLabelCount; ++j) {
+      new Label(panel, {0, j * 20}, L"Label");
+    }
+  }
+#ifdef WINUTIL_HEADLESS
+  ApiCallCounts start = GetApiCallCounts();
+#endif
+  double teardown = MeasureSeconds([&]() { delete window; });
+  Report("window_teardown_10k", teardown, "s");
+  Report("window_teardown_10k_per_widget", teardown / kWidgetCount * 1e9,
+         "ns/widget");
+#ifdef WINUTIL_HEADLESS
+  ApiCallCounts calls = GetApiCallCounts() - start;
+  Report("window_teardown_10k_destroy_window",
+         static_cast<double>(calls.destroyWindow), "calls");
+#endif
+}
+
+struct Order {
+  double price;
+  int quantity;
+  int id;
+  bool buy;
+};
+
+// Run the main loop until the grid shows the result of the operation being
+// run, and report its time and the longest delay of a 1 ms timer meanwhile,
+// which is how long input would wait.
+static void WaitForGrid(const char *name, VirtualGrid &grid, double start) {
+  double last = NowSeconds();
+  double maxStall = 0;
+  int updates = 0;
+  EventId progress = grid.OnProgress.AddEvent([&](double value) {
+    ++updates;
+    if (value == 1.0) {
+      PostQuitMessage(0);
+    }
+  });
+  TimerId timer = GetTimerService().SetInterval(1, [&]() {
+    double time = NowSeconds();
+    maxStall = std::max(maxStall, time - last);
+    last = time;
+  });
+  StartMainLoop();
+  double finish = NowSeconds();
+  GetTimerService().Cancel(timer);
+  grid.OnProgress.RemoveEvent(progress);
+  std::string prefix = std::string("grid_") + name;
+  Report(prefix.c_str(), finish - start, "s");
+  Report((prefix + "_max_ui_stall").c_str(), maxStall * 1e3, "ms");
+  Report((prefix + "_progress_updates").c_str(), updates, "events");
+}
+
+static void BenchmarkGrid() {
+  const int kRowCount = 2000000;
+  std::vector<Order> orders(kRowCount);
+  uint32_t seed = 12345;
+  for (int i = 0; i < kRowCount; ++i) {
+    seed = seed * 1664525 + 1013904223;
+    orders[i] = {100 + (seed >> 8) % 100000 / 1000.0,
+                 static_cast<int>(seed % 1000) + 1, i, (seed & 1) != 0};
+  }
+  auto byPrice = [&](int lhs, int rhs) {
+    return orders[lhs].price < orders[rhs].price;
+  };
+  auto byQuantity = [&](int lhs, int rhs) {
+    return orders[lhs].quantity > orders[rhs].quantity;
+  };
+
+  Window window(nullptr, {800, 600});
+  window.Show();
+  size_t cells = 0;
+  VirtualGrid grid(&window, {0, 0}, {800, 600},
+                   [&](int row, int column, std::wstring &text) {
+                     ++cells;
+                     const Order &order = orders[row];
+                     switch (column) {
+                       case 0: {
+                         text = std::to_wstring(order.id);
+                         break;
+                       }
+                       case 1: {
+                         text = order.buy ? L"Buy" : L"Sell";
+                         break;
+                       }
+                       case 2: {
+                         text = std::to_wstring(order.price);
+                         break;
+                       }
+                       case 3: {
+                         text = std::to_wstring(order.quantity);
+                         break;
+                       }
+                     }
+                   });
+  grid.AddColumn(L"Id", 100);
+  grid.AddColumn(L"Side", 60);
+  grid.AddColumn(L"Price", 100);
+  grid.AddColumn(L"Quantity", 100);
+  grid.SetRowCount(kRowCount);
+  UpdateWindow(grid.Handle());
+
+  std::vector<int> rows(kRowCount);
+  std::iota(rows.begin(), rows.end(), 0);
+  double serial = MeasureSeconds(
+      [&]() { std::stable_sort(rows.begin(), rows.end(), byPrice); });
+  Report("grid_sort_2m_serial", serial, "s");
+
+  double start = NowSeconds();
+  grid.Sort(byPrice);
+  WaitForGrid("sort_2m_price", grid, start);
+  start = NowSeconds();
+  grid.Sort(byQuantity);
+  WaitForGrid("sort_2m_quantity", grid, start);
+  start = NowSeconds();
+  grid.Filter([&](int row) { return orders[row].buy; });
+  WaitForGrid("filter_sort_2m", grid, start);
+  Report("grid_filter_rows", grid.GetCount(), "rows");
+
+  cells = 0;
+  grid.RefreshRows();
+  UpdateWindow(grid.Handle());
+  Report("grid_paint_cells", static_cast<double>(cells), "cells");
+}
+
+static std::vector<std::wstring> MakeInstrumentNames(int count) {
+  static const wchar_t *const kExchanges[] = {L"NYSE", L"NASDAQ", L"LSE",
+                                              L"XETRA", L"CME"};
+  static const wchar_t *const kKinds[] = {L"Stock", L"Future", L"Option",
+                                          L"Bond"};
+  std::vector<std::wstring> names;
+  names.reserve(count);
+  uint32_t seed = 54321;
+  for (int i = 0; i < count; ++i) {
+    seed = seed * 1664525 + 1013904223;
+    std::wstring name = kExchanges[(seed >> 8) % 5];
+    name += L':';
+    for (int j = 0; j < 4; ++j) {
+      seed = seed * 1664525 + 1013904223;
+      name += static_cast<wchar_t>(L'A' + (seed >> 16) % 26);
+    }
+    name += L' ';
+    name += kKinds[(seed >> 4) % 4];
+    name += L' ';
+    name += std::to_wstring(2026 + (seed >> 24) % 5);
+    names.push_back(std::move(name));
+  }
+  return names;
+}
+
+// Type a query into the filter and erase it back, one character at a time.
+// Reports the mean and the longest time from a keystroke to the updated list.
+template <typename Func>
+static void TypeQuery(const char *name, const std::wstring &query,
+                      Func setQuery) {
+  std::vector<std::wstring> keystrokes;
+  for (size_t i = 1; i <= query.size(); ++i) {
+    keystrokes.push_back(query.substr(0, i));
+  }
+  for (size_t i = query.size(); i-- > 0;) {
+    keystrokes.push_back(query.substr(0, i));
+  }
+#ifdef WINUTIL_HEADLESS
+  ApiCallCounts start = GetApiCallCounts();
+#endif
+  double total = 0;
+  double longest = 0;
+  for (const std::wstring &keystroke : keystrokes) {
+    double time = MeasureSeconds([&]() { setQuery(keystroke); });
+    total += time;
+    longest = std::max(longest, time);
+  }
+  std::string prefix = std::string("typeahead_") + name;
+  Report((prefix + "_mean").c_str(), total / keystrokes.size() * 1e3,
+         "ms/key");
+  Report((prefix + "_max").c_str(), longest * 1e3, "ms/key");
+#ifdef WINUTIL_HEADLESS
+  ApiCallCounts calls = GetApiCallCounts() - start;
+  Report((prefix + "_send_message").c_str(),
+         static_cast<double>(calls.sendMessage) / keystrokes.size(),
+         "calls/key");
+#endif
+}
+
+static void BenchmarkTypeAhead() {
+  const int kItemCount = 300000;
+  std::vector<std::wstring> names = MakeInstrumentNames(kItemCount);
+  // A ticker with the start of its kind, and a kind with a year, which
+  // match many items while most of the keystrokes change only a few of them.
+  const std::wstring &probe = names[kItemCount / 2];
+  std::wstring ticker = probe.substr(probe.find(L':') + 1, 8);
+  std::transform(ticker.begin(), ticker.end(), ticker.begin(),
+                 [](wchar_t c) { return std::towlower(c); });
+  const std::pair<const char *, std::wstring> kQueries[] = {
+      {"ticker", ticker}, {"kind", L"option 2027"}};
+
+  Window window(nullptr, {400, 600});
+  window.Show();
+  ListBox listBox(&window, {0, 0}, {380, 560});
+  double build = MeasureSeconds(
+      [&]() { ListBoxFilter filter(listBox, names); });
+  Report("typeahead_index_300k", build, "s");
+
+  // Filling the list box with the matches found by a scan on each keystroke.
+  listBox.Clear();
+  listBox.AddLines(names);
+  for (const auto &query : kQueries) {
+    std::string name = std::string("refill_") + query.first;
+    TypeQuery(name.c_str(), query.second,
+              [&](const std::wstring &keystroke) {
+                std::vector<std::wstring> matches;
+                for (const std::wstring &item : names) {
+                  auto it = std::search(item.begin(), item.end(),
+                                        keystroke.begin(), keystroke.end(),
+                                        [](wchar_t a, wchar_t b) {
+                                          return std::towlower(a) == b;
+                                        });
+                  if (it != item.end() || keystroke.empty()) {
+                    matches.push_back(item);
+                  }
+                }
+                listBox.Clear();
+                listBox.AddLines(matches);
+              });
+  }
+
+  ListBoxFilter filter(listBox, names);
+  for (const auto &query : kQueries) {
+    std::string name = std::string("indexed_") + query.first;
+    TypeQuery(name.c_str(), query.second,
+              [&](const std::wstring &keystroke) {
+                filter.SetQuery(keystroke);
+              });
+    filter.SetQuery(query.second);
+    Report(("typeahead_matches_" + std::string(query.first)).c_str(),
+           filter.GetCount(), "items");
+    filter.SetQuery(L"");
+  }
+}
+
+static std::wstring LogLine(int producer, int line) {
+  return L"[producer " + std::to_wstring(producer) + L"] message " +
+         std::to_wstring(line) + L"\r\n";
+}
+
+static void BenchmarkMemo() {
+  const int kLineCount = 20000;
+  Window window(nullptr, {600, 400});
+  window.Show();
+
+  // Adding each line by setting the whole text, as it was done before
+  // Append.
+  Memo *memo = new Memo(&window, {0, 0}, {600, 400});
+  std::wstring log;
+  double setTitle = MeasureSeconds([&]() {
+    for (int i = 0; i < kLineCount; ++i) {
+      log += LogLine(0, i);
+      memo->SetTitle(log);
+    }
+  });
+  Report("memo_set_title_20k", setTitle, "s");
+  delete memo;
+
+  // The worst case of Append: an update per line.
+  memo = new Memo(&window, {0, 0}, {600, 400});
+  double append = MeasureSeconds([&]() {
+    for (int i = 0; i < kLineCount; ++i) {
+      memo->Append(LogLine(0, i));
+      memo->Flush();
+    }
+  });
+  Report("memo_append_flush_20k", append, "s");
+  delete memo;
+
+  // Producer threads flooding a memo in tail mode, while the main loop runs.
+  const int kProducerCount = 4;
+  const int kProducerLines = 100000;
+  const size_t kTailLines = 5000;
+  memo = new Memo(&window, {0, 0}, {600, 400});
+  memo->SetTailLimits(kTailLines, 0);
+#ifdef WINUTIL_HEADLESS
+  ApiCallCounts start = GetApiCallCounts();
+#endif
+  double begin = NowSeconds();
+  double last = begin;
+  double maxStall = 0;
+  TimerId timer = GetTimerService().SetInterval(1, [&]() {
+    double time = NowSeconds();
+    maxStall = std::max(maxStall, time - last);
+    last = time;
+  });
+  std::thread producers([&]() {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kProducerCount; ++i) {
+      threads.emplace_back([&, i]() {
+        for (int j = 0; j < kProducerLines; ++j) {
+          memo->Append(LogLine(i, j));
+        }
+      });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    GetDispatcher().Post([&]() {
+      memo->Flush();
+      PostQuitMessage(0);
+    });
+  });
+  StartMainLoop();
+  double finish = NowSeconds();
+  producers.join();
+  GetTimerService().Cancel(timer);
+  Report("memo_tail_400k", finish - begin, "s");
+  Report("memo_tail_400k_max_ui_stall", maxStall * 1e3, "ms");
+#ifdef WINUTIL_HEADLESS
+  ApiCallCounts calls = GetApiCallCounts() - start;
+  Report("memo_tail_400k_redraws", static_cast<double>(calls.invalidate),
+         "calls");
+#endif
+  Report("memo_tail_400k_lines",
+         SendMessageW(memo->Handle(), EM_GETLINECOUNT, 0, 0), "lines");
+  delete memo;
+}
+
+// Drag-resize simulated by resizing a window with a layout 500 times per
+// second, then leaving it alone. Reports how many times the layout was
+// arranged and how long after the last resize it was arranged last.
+static void BenchmarkCoalescing(const char *name, CoalescePolicy policy) {
+  const int kLabelCount = 200;
+  const DWORD kDragTime = 500;
+  Window window(nullptr, {800, 600});
+  window.Show();
+  BoxLayout layout(Orientation::Vertical);
+  for (int i = 0; i < kLabelCount; ++i) {
+    layout.Add(new Label(&window, {0, 0}, L"Label"));
+  }
+  layout.Attach(window, policy);
+  int resizes = 0;
+  int arranges = 0;
+  double lastResize = 0;
+  double lastArrange = 0;
+  window.OnResize.AddEvent([&]() {
+    ++resizes;
+    lastResize = NowSeconds();
+  });
+  window.OnResize.AddEvent(
+      [&]() {
+        ++arranges;
+        lastArrange = NowSeconds();
+      },
+      policy);
+  resizes = 0;
+  arranges = 0;
+
+  int step = 0;
+  uint64_t start = TimerService::Now();
+  TimerId drag = GetTimerService().SetInterval(2, [&]() {
+    if (TimerService::Now() - start < kDragTime) {
+      ++step;
+      window.SetSize({800 + step % 100, 600 + step % 50});
+    }
+  });
+  GetTimerService().SetTimeout(kDragTime + 300, []() { PostQuitMessage(0); });
+  StartMainLoop();
+  GetTimerService().Cancel(drag);
+  std::string prefix = std::string("coalesce_") + name;
+  Report((prefix + "_resizes").c_str(), resizes, "events");
+  Report((prefix + "_arranges").c_str(), arranges, "calls");
+  Report((prefix + "_settle").c_str(), (lastArrange - lastResize) * 1e3, "ms");
+}
+
+// Same, but the window is shrunk from a modal loop, like the one Win32 runs
+// while a window is dragged. It doesn't run the main loop, and shrinking
+// a window paints nothing. After the drag, the mouse is held still for
+// 100 ms before it's released.
+static void BenchmarkModalCoalescing(const char *name, CoalescePolicy policy) {
+  const int kLabelCount = 200;
+  const DWORD kDragTime = 500;
+  const DWORD kHoldTime = 100;
+  Window window(nullptr, {800, 600});
+  window.Show();
+  UpdateWindow(window.Handle());
+  BoxLayout layout(Orientation::Vertical);
+  for (int i = 0; i < kLabelCount; ++i) {
+    layout.Add(new Label(&window, {0, 0}, L"Label"));
+  }
+  layout.Attach(window, policy);
+  int resizes = 0;
+  int arranges = 0;
+  double lastResize = NowSeconds();
+  double lastArrange = lastResize;
+  window.OnResize.AddEvent([&]() {
+    ++resizes;
+    lastResize = NowSeconds();
+  });
+  window.OnResize.AddEvent(
+      [&]() {
+        ++arranges;
+        lastArrange = NowSeconds();
+      },
+      policy);
+
+  SendMessageW(window.Handle(), WM_ENTERSIZEMOVE, 0, 0);
+  int step = 0;
+  uint64_t start = TimerService::Now();
+  uint64_t now;
+  while ((now = TimerService::Now()) - start < kDragTime + kHoldTime) {
+    if (now - start < kDragTime && now - start >= 2 * uint64_t(step)) {
+      ++step;
+      window.SetSize({800 - step, 600 - step / 2});
+    }
+    MSG msg;
+    while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+      TranslateMessage(&msg);
+      DispatchMessageW(&msg);
+    }
+    MsgWaitForMultipleObjectsEx(0, nullptr, 1, QS_ALLINPUT, 0);
+  }
+  SendMessageW(window.Handle(), WM_EXITSIZEMOVE, 0, 0);
+  std::string prefix = std::string("coalesce_modal_") + name;
+  Report((prefix + "_resizes").c_str(), resizes, "events");
+  Report((prefix + "_arranges").c_str(), arranges, "calls");
+  // Negative if the layout was stale when the mouse was released.
+  Report((prefix + "_settle").c_str(), (lastArrange - lastResize) * 1e3, "ms");
+}
+
+static void BenchmarkPaintBox() {
+  const int kFrames = 1000;
+  Window window(nullptr, {800, 600});
+  window.Show();
+  PaintBox box(&window, {0, 0}, {780, 560});
+  int64_t painted = 0;
+  box.OnPaint.AddEvent([&](HDC dc, const RECT &rect) {
+    painted += static_cast<int64_t>(rect.right - rect.left) *
+               (rect.bottom - rect.top);
+    ExtTextOutW(dc, rect.left, rect.top, 0, nullptr, L"42.0", 4, nullptr);
+  });
+  UpdateWindow(box.Handle());
+
+  auto measure = [&](const char *name, const RECT *rect) {
+    painted = 0;
+    double time = MeasureSeconds([&]() {
+      for (int i = 0; i < kFrames; ++i) {
+        if (rect != nullptr) {
+          box.Invalidate(*rect);
+        } else {
+          box.Invalidate();
+        }
+        UpdateWindow(box.Handle());
+      }
+    });
+    Report((std::string(name) + "_time").c_str(), time / kFrames * 1e6,
+           "us/frame");
+    Report((std::string(name) + "_pixels").c_str(),
+           static_cast<double>(painted) / kFrames, "px/frame");
+  };
+  RECT status = {10, 10, 110, 30};
+  measure("paintbox_partial", &status);
+  measure("paintbox_full", nullptr);
+}
+
+static void BenchmarkChart() {
+  const size_t kSampleCount = 1 << 22;
+  const size_t kColumnCount = 1000;
+  const int kRounds = 20;
+  std::vector<float> samples(kSampleCount);
+  for (size_t i = 0; i < kSampleCount; ++i) {
+    samples[i] = static_cast<float>((i * 7919) % 10007) / 10007.0f;
+  }
+
+  size_t perColumn = kSampleCount / kColumnCount;
+  float total = 0;
+  double decimate = MeasureSeconds([&]() {
+    for (int round = 0; round < kRounds; ++round) {
+      for (size_t column = 0; column < kColumnCount; ++column) {
+        float min, max;
+        FindMinMax(&samples[column * perColumn], perColumn, min, max);
+        total += max - min;
+      }
+    }
+  });
+  Report("chart_decimate", kRounds * kSampleCount / decimate / 1e6,
+         "Msamples/s");
+
+  // Feed the chart in blocks, as a telemetry source would.
+  const size_t kBlockSize = 4096;
+  Window window(nullptr, {800, 300});
+  window.Show();
+  Chart chart(&window, {0, 0}, {780, 260});
+  chart.SetSamplesPerColumn(1000);
+  double ingest = MeasureSeconds([&]() {
+    for (size_t i = 0; i + kBlockSize <= kSampleCount; i += kBlockSize) {
+      chart.AddSamples(&samples[i], kBlockSize);
+    }
+  });
+  Report("chart_ingest", kSampleCount / ingest / 1e6, "Msamples/s");
+}
+
+static void BenchmarkMainLoop() {
+  const int kSignals = 100000;
+  HANDLE event = CreateEventW(nullptr, false, false, nullptr);
+  int signals = 0;
+  GetMainLoop().RegisterWaitableHandle(event, [&]() {
+    if (++signals == kSignals) {
+      PostQuitMessage(0);
+    } else {
+      SetEvent(event);
+    }
+  });
+  int idlePasses = 0;
+  GetMainLoop().AddIdleTask([&]() { return ++idlePasses < kSignals; });
+  SetEvent(event);
+  double time = MeasureSeconds([]() { StartMainLoop(); });
+  GetMainLoop().UnregisterWaitableHandle(event);
+  CloseHandle(event);
+  Report("mainloop_handle_signal", time / kSignals * 1e9, "ns/signal");
+  Report("mainloop_idle_passes", idlePasses, "passes");
+}
+
+// Count the distinct milliseconds in which 500 periodic timers fire during
+// one second, which is the number of wakeups they need.
+static void BenchmarkTimers(const char *name, DWORD tolerance) {
+  const int kTimerCount = 500;
+  TimerService &timers = GetTimerService();
+  std::vector<TimerId> ids;
+  std::set<uint64_t> wakeups;
+  for (int i = 0; i < kTimerCount; ++i) {
+    DWORD period = 50 + (i * 37) % 100;
+    ids.push_back(timers.SetInterval(
+        period, [&]() { wakeups.insert(TimerService::Now()); }, nullptr,
+        tolerance));
+  }
+  timers.SetTimeout(1000, []() { PostQuitMessage(0); });
+  StartMainLoop();
+  for (TimerId id : ids) {
+    timers.Cancel(id);
+  }
+  Report(name, static_cast<double>(wakeups.size()), "wakeups/s");
+}
+
+static void BenchmarkProfiling() {
+  const int kRounds = 100000;
+  Window window(nullptr, {400, 400});
+  Button button(&window, {0, 0}, L"Button");
+  int clicks = 0;
+  button.OnClick.AddEvent([&]() { ++clicks; });
+  WPARAM command = reinterpret_cast<intptr_t>(button.WidgetId());
+  auto dispatch = [&]() {
+    for (int i = 0; i < kRounds; ++i) {
+      SendMessageW(window.Handle(), WM_COMMAND, command,
+                   (LPARAM)button.Handle());
+    }
+  };
+  double disabled = MeasureSeconds(dispatch);
+  SetProfilingEnabled(true);
+  double enabled = MeasureSeconds(dispatch);
+  SetProfilingEnabled(false);
+  Report("profiling_disabled", disabled / kRounds * 1e9, "ns/msg");
+  Report("profiling_enabled", enabled / kRounds * 1e9, "ns/msg");
+  Report("profiling_histograms", static_cast<double>(GetProfileStats().size()),
+         "histograms");
+  ResetProfile();
+}
+
+#ifdef WINUTIL_HEADLESS
+// System calls made by common operations, as counted by the headless
+// backend.
+static void ReportCalls(const char *name, const ApiCallCounts &calls) {
+  std::string prefix = std::string("calls_") + name;
+  Report((prefix + "_total").c_str(), static_cast<double>(calls.total),
+         "calls");
+  Report((prefix + "_send_message").c_str(),
+         static_cast<double>(calls.sendMessage), "calls");
+  Report((prefix + "_move_window").c_str(),
+         static_cast<double>(calls.moveWindow), "calls");
+  Report((prefix + "_defer_window_pos").c_str(),
+         static_cast<double>(calls.deferWindowPos), "calls");
+  Report((prefix + "_invalidate").c_str(),
+         static_cast<double>(calls.invalidate), "calls");
+}
+
+static void BenchmarkCalls() {
+  const int kWidgetCount = 200;
+  Window window(nullptr, {800, 600});
+  window.Show();
+  ApiCallCounts start = GetApiCallCounts();
+  Panel *panel = new Panel(&window, {0, 0}, {800, 600});
+  std::vector<Label *> labels;
+  for (int i = 0; i < kWidgetCount; ++i) {
+    labels.push_back(new Label(panel, {0, 0}, L"Label"));
+  }
+  ReportCalls("create_200", GetApiCallCounts() - start);
+
+  BoxLayout layout(Orientation::Vertical);
+  for (Label *label : labels) {
+    layout.Add(label);
+  }
+  start = GetApiCallCounts();
+  layout.Arrange({0, 0, 800, 600});
+  ReportCalls("layout_200", GetApiCallCounts() - start);
+
+  start = GetApiCallCounts();
+  labels[0]->SetTitle(L"Title");
+  ReportCalls("set_title", GetApiCallCounts() - start);
+
+  start = GetApiCallCounts();
+  delete panel;
+  ReportCalls("destroy_200", GetApiCallCounts() - start);
+}
+#endif
+
+static void BenchmarkEventActivate() {
+  for (int subscriberCount : {1, 10, 1000}) {
+    BenchmarkEventActivate(subscriberCount);
+  }
+}
+
+static void BenchmarkCoalescing() {
+  BenchmarkCoalescing("none", CoalescePolicy());
+  BenchmarkCoalescing("per_frame", CoalescePolicy::LatestPerFrame());
+  BenchmarkCoalescing("throttle_30hz", CoalescePolicy::Throttle(30));
+  BenchmarkCoalescing("debounce_100ms", CoalescePolicy::Debounce(100));
+  BenchmarkModalCoalescing("per_frame", CoalescePolicy::LatestPerFrame());
+  BenchmarkModalCoalescing("debounce_50ms", CoalescePolicy::Debounce(50));
+}
+
+static void BenchmarkTimers() {
+  BenchmarkTimers("timers_exact", 0);
+  BenchmarkTimers("timers_coalesced", 20);
+}
+
+#ifdef WINUTIL_COROUTINES
+static std::wstring LoadSlowly() {
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  return L"Loaded";
+}
+
+static UiTask LoadInBackground(Window &window, Label &label) {
+  label.SetTitle(co_await RunInBackground(LoadSlowly));
+  GetTimerService().SetTimeout(50, []() { PostQuitMessage(0); });
+}
+
+// A click handler loads data for 300 ms while a 5 ms timer animates the UI.
+// Report the longest gap between the timer ticks, during which the UI hangs.
+static void BenchmarkCoroutineStall(const char *name, bool async) {
+  Window window(nullptr, {400, 300});
+  window.Show();
+  Button button(&window, {10, 10}, L"Load");
+  Label label(&window, {10, 50}, L"");
+  if (async) {
+    button.OnClick.AddEvent([&]() { LoadInBackground(window, label); });
+  } else {
+    button.OnClick.AddEvent([&]() {
+      label.SetTitle(LoadSlowly());
+      GetTimerService().SetTimeout(50, []() { PostQuitMessage(0); });
+    });
+  }
+  double lastTick = NowSeconds();
+  double maxGap = 0;
+  TimerId ticker = GetTimerService().SetInterval(5, [&]() {
+    double now = NowSeconds();
+    maxGap = std::max(maxGap, now - lastTick);
+    lastTick = now;
+  });
+  GetTimerService().SetTimeout(20, [&]() { button.OnClick.Activate(); });
+  StartMainLoop();
+  GetTimerService().Cancel(ticker);
+  Report(name, maxGap * 1e3, "ms");
+}
+
+static UiTask WaitForClicks(Button &button, int count, int &received) {
+  for (int i = 0; i < count; ++i) {
+    co_await NextEvent(button.OnClick);
+    ++received;
+  }
+}
+
+static UiTask WaitForTimeout(Window &window, int &finished) {
+  co_await Delay(60000);
+  ++finished;
+}
+
+static void BenchmarkCoroutines() {
+  BenchmarkCoroutineStall("coroutine_sync_stall", false);
+  BenchmarkCoroutineStall("coroutine_async_stall", true);
+
+  // Each click resumes the coroutine waiting for it.
+  const int kClicks = 100000;
+  Window window(nullptr, {400, 300});
+  Button button(&window, {10, 10}, L"Click");
+  int received = 0;
+  WaitForClicks(button, kClicks, received);
+  double resume = MeasureSeconds([&]() {
+    for (int i = 0; i < kClicks; ++i) {
+      button.OnClick.Activate();
+    }
+  });
+  Report("coroutine_event_resume", resume / received * 1e9, "ns/event");
+
+  // Destroying the owner cancels the coroutines waiting in it.
+  const int kTasks = 10000;
+  Window *owner = new Window(nullptr, {400, 300});
+  int finished = 0;
+  for (int i = 0; i < kTasks; ++i) {
+    WaitForTimeout(*owner, finished);
+  }
+  double cancel = MeasureSeconds([&]() { delete owner; });
+  Report("coroutine_cancel", cancel / kTasks * 1e9, "ns/coroutine");
+}
+#endif
+
+struct Benchmark {
+  const char *name;
+  void (*func)();
+};
+
+static const Benchmark kBenchmarks[] = {
+    {"widgets", BenchmarkWidgetLifetime},
+    {"listbox", BenchmarkListBoxFill},
+    {"title", BenchmarkTitle},
+    {"transcoding", BenchmarkTranscoding},
+    {"events", BenchmarkEventActivate},
+    {"dispatch", BenchmarkMessageDispatch},
+    {"profiling", BenchmarkProfiling},
+    {"text", BenchmarkTextMeasure},
+    {"deferred", BenchmarkDeferredCreation},
+    {"arena", BenchmarkWidgetArena},
+    {"teardown", BenchmarkTeardown},
+    {"grid", BenchmarkGrid},
+    {"typeahead", BenchmarkTypeAhead},
+    {"memo", BenchmarkMemo},
+    {"coalescing", BenchmarkCoalescing},
+    {"paintbox", BenchmarkPaintBox},
+    {"chart", BenchmarkChart},
+    {"mainloop", BenchmarkMainLoop},
+    {"timers", BenchmarkTimers},
+#ifdef WINUTIL_COROUTINES
+    {"coroutines", BenchmarkCoroutines},
+#endif
+#ifdef WINUTIL_HEADLESS
+    {"calls", BenchmarkCalls},
+#endif
+};
+
+// Runs the benchmark groups given on the command line, or all of them.
+int main(int argc, char **argv) {
+  InitApplication(GetModuleHandleW(nullptr));
+  std::set<std::string> selected(argv + 1, argv + argc);
+  for (const Benchmark &benchmark : kBenchmarks) {
+    if (selected.empty() || selected.count(benchmark.name)) {
+      benchmark.func();
+      std::fflush(stdout);
+    }
+  }
+  return 0;
+}
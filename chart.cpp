@@ -0,0 +1,295 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "chart.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHART_USE_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+// AVX2 code is compiled with target attributes and is selected at runtime.
+#define CHART_USE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+using MinMaxKernel = void (*)(const float *, size_t, float &, float &);
+
+static void FindMinMaxScalar(const float *samples, size_t count, float &min,
+                             float &max) {
+  float lo = samples[0];
+  float hi = samples[0];
+  for (size_t i = 1; i < count; ++i) {
+    lo = std::min(lo, samples[i]);
+    hi = std::max(hi, samples[i]);
+  }
+  min = lo;
+  max = hi;
+}
+
+#ifdef CHART_USE_SSE2
+
+static void FindMinMaxSse2(const float *samples, size_t count, float &min,
+                           float &max) {
+  if (count < 16) {
+    FindMinMaxScalar(samples, count, min, max);
+    return;
+  }
+  // Two independent accumulators for each result hide the instruction
+  // latency.
+  __m128 lo0 = _mm_loadu_ps(samples);
+  __m128 hi0 = lo0;
+  __m128 lo1 = _mm_loadu_ps(samples + 4);
+  __m128 hi1 = lo1;
+  size_t i = 8;
+  for (; i + 8 <= count; i += 8) {
+    __m128 a = _mm_loadu_ps(samples + i);
+    __m128 b = _mm_loadu_ps(samples + i + 4);
+    lo0 = _mm_min_ps(lo0, a);
+    hi0 = _mm_max_ps(hi0, a);
+    lo1 = _mm_min_ps(lo1, b);
+    hi1 = _mm_max_ps(hi1, b);
+  }
+  // The tail overlaps the part already seen, which doesn't change the result.
+  __m128 a = _mm_loadu_ps(samples + count - 8);
+  __m128 b = _mm_loadu_ps(samples + count - 4);
+  __m128 lo = _mm_min_ps(_mm_min_ps(lo0, a), _mm_min_ps(lo1, b));
+  __m128 hi = _mm_max_ps(_mm_max_ps(hi0, a), _mm_max_ps(hi1, b));
+  lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1, 0, 3, 2)));
+  lo = _mm_min_ss(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 3, 0, 1)));
+  hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(1, 0, 3, 2)));
+  hi = _mm_max_ss(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2, 3, 0, 1)));
+  min = _mm_cvtss_f32(lo);
+  max = _mm_cvtss_f32(hi);
+}
+
+#endif  // CHART_USE_SSE2
+
+#ifdef CHART_USE_AVX2
+
+__attribute__((target("avx2"))) static void FindMinMaxAvx2(
+    const float *samples, size_t count, float &min, float &max) {
+  if (count < 32) {
+    FindMinMaxSse2(samples, count, min, max);
+    return;
+  }
+  __m256 lo0 = _mm256_loadu_ps(samples);
+  __m256 hi0 = lo0;
+  __m256 lo1 = _mm256_loadu_ps(samples + 8);
+  __m256 hi1 = lo1;
+  size_t i = 16;
+  for (; i + 16 <= count; i += 16) {
+    __m256 a = _mm256_loadu_ps(samples + i);
+    __m256 b = _mm256_loadu_ps(samples + i + 8);
+    lo0 = _mm256_min_ps(lo0, a);
+    hi0 = _mm256_max_ps(hi0, a);
+    lo1 = _mm256_min_ps(lo1, b);
+    hi1 = _mm256_max_ps(hi1, b);
+  }
+  __m256 a = _mm256_loadu_ps(samples + count - 16);
+  __m256 b = _mm256_loadu_ps(samples + count - 8);
+  __m256 lo8 = _mm256_min_ps(_mm256_min_ps(lo0, a), _mm256_min_ps(lo1, b));
+  __m256 hi8 = _mm256_max_ps(_mm256_max_ps(hi0, a), _mm256_max_ps(hi1, b));
+  __m128 lo = _mm_min_ps(_mm256_castps256_ps128(lo8),
+                         _mm256_extractf128_ps(lo8, 1));
+  __m128 hi = _mm_max_ps(_mm256_castps256_ps128(hi8),
+                         _mm256_extractf128_ps(hi8, 1));
+  lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1, 0, 3, 2)));
+  lo = _mm_min_ss(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 3, 0, 1)));
+  hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(1, 0, 3, 2)));
+  hi = _mm_max_ss(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2, 3, 0, 1)));
+  min = _mm_cvtss_f32(lo);
+  max = _mm_cvtss_f32(hi);
+}
+
+#endif  // CHART_USE_AVX2
+
+static MinMaxKernel SelectMinMaxKernel() {
+#ifdef CHART_USE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return FindMinMaxAvx2;
+  }
+#endif
+#ifdef CHART_USE_SSE2
+  return FindMinMaxSse2;
+#else
+  return FindMinMaxScalar;
+#endif
+}
+
+void FindMinMax(const float *samples, size_t count, float &min, float &max) {
+  static const MinMaxKernel kernel = SelectMinMaxKernel();
+  kernel(samples, count, min, max);
+}
+
+static size_t RoundUpToPowerOfTwo(size_t value) {
+  size_t res = 1;
+  while (res < value) {
+    res *= 2;
+  }
+  return res;
+}
+
+Chart::Chart(Widget *parent, POINT pos, SIZE size, size_t capacity)
+    : PaintBox(parent, pos, size),
+      samples_(RoundUpToPowerOfTwo(std::max<size_t>(capacity, 1))),
+      columns_(kMaxColumns),
+      sampleCount_(0),
+      columnCount_(0),
+      samplesPerColumn_(1),
+      rangeMin_(0),
+      rangeMax_(1),
+      pendingColumns_(0),
+      flushPosted_(false) {}
+
+uint64_t Chart::FirstSample() const {
+  return sampleCount_ - std::min<uint64_t>(sampleCount_, samples_.size());
+}
+
+uint64_t Chart::FirstColumn() const {
+  uint64_t first = (FirstSample() + samplesPerColumn_ - 1) / samplesPerColumn_;
+  if (columnCount_ > kMaxColumns) {
+    first = std::max<uint64_t>(first, columnCount_ - kMaxColumns);
+  }
+  return std::min(first, columnCount_);
+}
+
+Chart::Column Chart::ReduceColumn(uint64_t column) const {
+  size_t mask = samples_.size() - 1;
+  size_t begin = static_cast<size_t>(column * samplesPerColumn_) & mask;
+  size_t count = samplesPerColumn_;
+  // The column may wrap around the end of the ring buffer.
+  size_t first = std::min(count, samples_.size() - begin);
+  Column res;
+  FindMinMax(&samples_[begin], first, res.min, res.max);
+  if (first < count) {
+    Column rest;
+    FindMinMax(&samples_[0], count - first, rest.min, rest.max);
+    res.min = std::min(res.min, rest.min);
+    res.max = std::max(res.max, rest.max);
+  }
+  return res;
+}
+
+void Chart::AddSample(float sample) { AddSamples(&sample, 1); }
+
+void Chart::AddSamples(const float *samples, size_t count) {
+  size_t capacity = samples_.size();
+  if (count > capacity) {
+    sampleCount_ += count - capacity;
+    samples += count - capacity;
+    count = capacity;
+  }
+  size_t mask = capacity - 1;
+  while (count > 0) {
+    size_t pos = static_cast<size_t>(sampleCount_) & mask;
+    size_t chunk = std::min(count, capacity - pos);
+    std::copy_n(samples, chunk, &samples_[pos]);
+    sampleCount_ += chunk;
+    samples += chunk;
+    count -= chunk;
+  }
+  CompleteColumns();
+}
+
+void Chart::CompleteColumns() {
+  uint64_t complete = sampleCount_ / samplesPerColumn_;
+  if (complete == columnCount_) {
+    return;
+  }
+  // Columns whose samples were overwritten already are never drawn.
+  uint64_t newColumns = complete - columnCount_;
+  columnCount_ = complete;
+  for (uint64_t column = std::max(FirstColumn(), complete - newColumns);
+       column < complete; ++column) {
+    columns_[column % kMaxColumns] = ReduceColumn(column);
+  }
+  pendingColumns_ = static_cast<int>(
+      std::min<uint64_t>(pendingColumns_ + newColumns, kMaxColumns));
+  if (!flushPosted_ && IsRealized()) {
+    flushPosted_ = true;
+    PostMessageW(Handle(), kFlushMessage, 0, 0);
+  }
+}
+
+void Chart::Clear() {
+  sampleCount_ = 0;
+  columnCount_ = 0;
+  pendingColumns_ = 0;
+  Invalidate();
+}
+
+void Chart::SetSamplesPerColumn(size_t count) {
+  samplesPerColumn_ = std::max<size_t>(count, 1);
+  columnCount_ = sampleCount_ / samplesPerColumn_;
+  for (uint64_t column = FirstColumn(); column < columnCount_; ++column) {
+    columns_[column % kMaxColumns] = ReduceColumn(column);
+  }
+  pendingColumns_ = 0;
+  Invalidate();
+}
+
+void Chart::SetRange(float min, float max) {
+  rangeMin_ = min;
+  rangeMax_ = max;
+  Invalidate();
+}
+
+bool Chart::HandleFlush(WPARAM, LPARAM, LRESULT &result) {
+  flushPosted_ = false;
+  int shift = pendingColumns_;
+  pendingColumns_ = 0;
+  RECT client;
+  GetClientRect(Handle(), &client);
+  if (shift >= client.right) {
+    Invalidate();
+  } else if (shift > 0) {
+    // Move the columns already on the screen and repaint only the new ones.
+    ScrollWindowEx(Handle(), -shift, 0, nullptr, nullptr, nullptr, nullptr,
+                   SW_INVALIDATE);
+  }
+  result = 0;
+  return true;
+}
+
+void Chart::Paint(HDC dc, const RECT &rect) {
+  PaintBox::Paint(dc, rect);
+  RECT client;
+  GetClientRect(Handle(), &client);
+  int height = client.bottom;
+  if (height <= 0 || rangeMax_ <= rangeMin_) {
+    return;
+  }
+  float scale = (height - 1) / (rangeMax_ - rangeMin_);
+  auto toY = [&](float value) {
+    float y = (rangeMax_ - value) * scale;
+    return static_cast<int>(std::min(std::max(y, 0.0f), height - 1.0f));
+  };
+  // The rightmost pixel column shows the newest complete column. The one
+  // before the painted area is also read to join the lines.
+  uint64_t first = FirstColumn();
+  int64_t offset = static_cast<int64_t>(columnCount_) - client.right;
+  HBRUSH brush = GetSysColorBrush(COLOR_HIGHLIGHT);
+  for (int x = std::max<LONG>(rect.left, 0); x < rect.right; ++x) {
+    int64_t column = offset + x;
+    if (column < static_cast<int64_t>(first)) {
+      continue;
+    }
+    Column value = columns_[column % kMaxColumns];
+    int top = toY(value.max);
+    int bottom = toY(value.min);
+    if (column > static_cast<int64_t>(first)) {
+      const Column &prev = columns_[(column - 1) % kMaxColumns];
+      top = std::min(top, toY(prev.min));
+      bottom = std::max(bottom, toY(prev.max));
+    }
+    RECT line = {x, top, x + 1, bottom + 1};
+    FillRect(dc, &line, brush);
+  }
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef CHART_H_INCLUDED
+#define CHART_H_INCLUDED
+
+#include "win32api.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "winutil.hpp"
+
+// Find the minimum and the maximum of count > 0 samples, which must not be
+// NaN.
+void FindMinMax(const float *samples, size_t count, float &min, float &max);
+
+// Scrolling chart of a stream of samples. The latest samples are kept in a
+// ring buffer of fixed capacity. Every samplesPerColumn samples are reduced
+// to the minimum and the maximum drawn as one pixel column, the newest column
+// being on the right. When new columns are complete, the chart is scrolled
+// once per batch of messages and only the new columns are painted.
+class Chart : public PaintBox {
+ public:
+  Chart(Widget *parent, POINT pos, SIZE size, size_t capacity = 1 << 22);
+
+  void AddSample(float sample);
+  void AddSamples(const float *samples, size_t count);
+  void Clear();
+
+  // Rebuild the columns from the samples kept in the ring buffer.
+  void SetSamplesPerColumn(size_t count);
+  // Values mapped to the bottom and the top of the chart.
+  void SetRange(float min, float max);
+
+  size_t GetCapacity() const { return samples_.size(); }
+
+ protected:
+  void Paint(HDC dc, const RECT &rect) override;
+
+  bool HandleFlush(WPARAM wParam, LPARAM lParam, LRESULT &result);
+
+  // Posted when new columns are complete, so scrolling is done once for all
+  // the samples added while handling the current message.
+  static constexpr UINT kFlushMessage = WM_USER + 1;
+
+  MessageMapView GetMessageMap() const override { return kMessageMap; }
+
+  static constexpr auto kMessageMap = ExtendMessageMap(
+      PaintBox::kMessageMap,
+      {{kFlushMessage, &MessageHandlerOf<Chart, &Chart::HandleFlush>}});
+
+ private:
+  struct Column {
+    float min;
+    float max;
+  };
+
+  static constexpr size_t kMaxColumns = 4096;
+
+  uint64_t FirstSample() const;
+  uint64_t FirstColumn() const;
+  Column ReduceColumn(uint64_t column) const;
+  void CompleteColumns();
+
+  // Both buffers have power of two sizes and are indexed by the number of
+  // the sample or column modulo their size.
+  std::vector<float> samples_;
+  std::vector<Column> columns_;
+  uint64_t sampleCount_;
+  uint64_t columnCount_;
+  size_t samplesPerColumn_;
+  float rangeMin_;
+  float rangeMax_;
+  int pendingColumns_;
+  bool flushPosted_;
+};
+
+#endif  // CHART_H_INCLUDED
@@ -0,0 +1,32 @@
+# This file is part of WinUtil.
+# This software is public domain. See UNLICENSE for more information.
+# WinUtil was created by Alexander Kernozhitsky.
+
+# Toolchain for cross-compiling with MinGW-w64. Use it as
+#   cmake -S . -B build -DCMAKE_TOOLCHAIN_FILE=cmake/mingw-w64.cmake
+# and set MINGW_PREFIX to i686-w64-mingw32 to build 32-bit binaries.
+
+set(CMAKE_SYSTEM_NAME Windows)
+
+if(NOT MINGW_PREFIX)
+  set(MINGW_PREFIX x86_64-w64-mingw32)
+endif()
+if(MINGW_PREFIX MATCHES "^i686")
+  set(CMAKE_SYSTEM_PROCESSOR x86)
+else()
+  set(CMAKE_SYSTEM_PROCESSOR x86_64)
+endif()
+
+set(CMAKE_C_COMPILER ${MINGW_PREFIX}-gcc)
+set(CMAKE_CXX_COMPILER ${MINGW_PREFIX}-g++)
+set(CMAKE_RC_COMPILER ${MINGW_PREFIX}-windres)
+
+set(CMAKE_FIND_ROOT_PATH /usr/${MINGW_PREFIX})
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+
+find_program(WINE_EXECUTABLE NAMES wine64 wine)
+if(WINE_EXECUTABLE)
+  set(CMAKE_CROSSCOMPILING_EMULATOR ${WINE_EXECUTABLE})
+endif()
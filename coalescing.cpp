@@ -0,0 +1,72 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "coalescing.hpp"
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include "timer.hpp"
+
+struct ScheduledCall {
+  std::weak_ptr<CoalescedCall> call;
+  uint64_t due;
+};
+
+// Only a few subscribers are coalesced, so the calls are kept unordered.
+static std::vector<ScheduledCall> g_scheduledCalls;
+
+uint64_t GetCoalescingTime() { return TimerService::Now(); }
+
+void ScheduleCoalescedCall(const std::shared_ptr<CoalescedCall> &call,
+                           uint64_t due) {
+  g_scheduledCalls.push_back(ScheduledCall{call, due});
+}
+
+void RunCoalescedCalls() {
+  if (g_scheduledCalls.empty()) {
+    return;
+  }
+  uint64_t now = TimerService::Now();
+  auto firstDue = std::partition(
+      g_scheduledCalls.begin(), g_scheduledCalls.end(),
+      [now](const ScheduledCall &scheduled) { return scheduled.due > now; });
+  if (firstDue == g_scheduledCalls.end()) {
+    return;
+  }
+  std::vector<ScheduledCall> dueCalls(std::make_move_iterator(firstDue),
+                                      std::make_move_iterator(
+                                          g_scheduledCalls.end()));
+  g_scheduledCalls.erase(firstDue, g_scheduledCalls.end());
+  for (size_t i = 0; i < dueCalls.size(); ++i) {
+    std::shared_ptr<CoalescedCall> call = dueCalls[i].call.lock();
+    if (call == nullptr) {
+      continue;
+    }
+    try {
+      call->Run();
+    } catch (...) {
+      // The rest are run next time.
+      std::move(dueCalls.begin() + i + 1, dueCalls.end(),
+                std::back_inserter(g_scheduledCalls));
+      throw;
+    }
+  }
+}
+
+DWORD GetCoalescedCallDelay() {
+  if (g_scheduledCalls.empty()) {
+    return INFINITE;
+  }
+  uint64_t due = std::min_element(g_scheduledCalls.begin(),
+                                  g_scheduledCalls.end(),
+                                  [](const ScheduledCall &lhs,
+                                     const ScheduledCall &rhs) {
+                                    return lhs.due < rhs.due;
+                                  })
+                     ->due;
+  uint64_t now = TimerService::Now();
+  return due > now ? static_cast<DWORD>(due - now) : 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef COALESCING_H_INCLUDED
+#define COALESCING_H_INCLUDED
+
+#include "win32api.hpp"
+#include <cstdint>
+#include <memory>
+
+// How an event subscriber is called when the event is activated often, e.g.
+// on every WM_SIZE of a drag-resize. A coalesced subscriber isn't called by
+// Activate(). It's called later from the main loop with the arguments of the
+// latest activation, and the activations in between are dropped. The other
+// subscribers of the same event still see every activation. Modal loops
+// don't run the main loop, so the calls which are due are also run before
+// painting, and every frame while a window is dragged or resized. In other
+// modal loops, e.g. of menus and message boxes, they only run before
+// painting.
+class CoalescePolicy {
+ public:
+  enum class Kind { None, LatestPerFrame, Debounce, Throttle };
+
+  // Called on every activation.
+  CoalescePolicy() : kind_(Kind::None), interval_(0) {}
+
+  // Called at most once per frame of a 60 Hz display. The first activation
+  // after a pause is handled once the queued messages are processed.
+  static CoalescePolicy LatestPerFrame() {
+    return CoalescePolicy(Kind::LatestPerFrame, kFrameTime);
+  }
+  // Called when the event hasn't been activated for the given time.
+  static CoalescePolicy Debounce(DWORD milliseconds) {
+    return CoalescePolicy(Kind::Debounce, milliseconds);
+  }
+  // Called at most the given number of times per second, like
+  // LatestPerFrame.
+  static CoalescePolicy Throttle(DWORD hz) {
+    return CoalescePolicy(Kind::Throttle, hz == 0 ? 1000 : 1000 / hz);
+  }
+
+  static constexpr DWORD kFrameTime = 16;
+
+  inline Kind GetKind() const { return kind_; }
+  // Delay in milliseconds for Debounce, minimum period for the others.
+  inline DWORD GetInterval() const { return interval_; }
+
+ private:
+  CoalescePolicy(Kind kind, DWORD interval)
+      : kind_(kind), interval_(interval) {}
+
+  Kind kind_;
+  DWORD interval_;
+};
+
+// Postponed call of a coalesced subscriber.
+class CoalescedCall {
+ public:
+  virtual ~CoalescedCall() = default;
+  virtual void Run() = 0;
+};
+
+// The functions below are used on the UI thread only. The time is measured
+// in milliseconds, by the same clock as TimerService::Now().
+
+uint64_t GetCoalescingTime();
+
+// Run the call from the main loop once the due time has come. The call isn't
+// run if it's destroyed before.
+void ScheduleCoalescedCall(const std::shared_ptr<CoalescedCall> &call,
+                           uint64_t due);
+// Run the calls whose due time has come. The calls scheduled meanwhile are
+// run next time.
+void RunCoalescedCalls();
+// Milliseconds until the next call is due, or INFINITE if there are none.
+DWORD GetCoalescedCallDelay();
+
+#endif  // COALESCING_H_INCLUDED
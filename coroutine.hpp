@@ -0,0 +1,332 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef COROUTINE_H_INCLUDED
+#define COROUTINE_H_INCLUDED
+
+// Coroutines need C++20, the rest of the library only needs C++17. This
+// header is empty in earlier modes, WINUTIL_COROUTINES tells whether it's not.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#define WINUTIL_COROUTINES
+
+#include "win32api.hpp"
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "dispatcher.hpp"
+#include "eventhandler.hpp"
+#include "threadpool.hpp"
+#include "timer.hpp"
+
+// Coroutine run on the UI thread, e.g. the handler of a click:
+//
+//   UiTask LoadFile(MainWindow &window, std::wstring path) {
+//     std::wstring text = co_await RunInBackground(
+//         [path]() { return ReadFile(path); });
+//     window.memo.SetTitle(text);
+//   }
+//
+//   button.OnClick.AddEvent([&]() { LoadFile(window, path); });
+//
+// It starts when called and runs until the first co_await which has to wait.
+// The awaitables below resume it on the UI thread, so the code between them
+// may use widgets, and the main loop keeps running while it waits. Nobody
+// waits for the coroutine itself. An exception escaping it is rethrown from
+// the main loop. The parameters are copied into the coroutine, but the
+// captures of a lambda coroutine are not, so they may be gone after the
+// first co_await.
+//
+// The coroutine is cancelled when its owner is destroyed: it's destroyed
+// instead of being resumed, like the code after a co_await is never run. The
+// owner is the object a member coroutine is called on, or the first argument
+// if it's an EventOwner, or the one given to CancelOnDestroy. If the owner is
+// destroyed while the coroutine is running, it's destroyed on the next
+// co_await.
+class UiTask {
+ public:
+  class promise_type {
+   public:
+    promise_type() = default;
+
+    template <typename First, typename... Rest>
+    promise_type(First &first, Rest &...) {
+      if constexpr (std::is_convertible<First &, EventOwner &>::value) {
+        Bind(first);
+      }
+    }
+
+    promise_type(const promise_type &) = delete;
+    promise_type &operator=(const promise_type &) = delete;
+
+    ~promise_type() {
+      if (owner_ != nullptr) {
+        owner_->RemoveDestroyHook(hook_);
+      }
+    }
+
+    UiTask get_return_object() { return UiTask(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+
+    void unhandled_exception() {
+      GetDispatcher().Post([error = std::current_exception()]() {
+        std::rethrow_exception(error);
+      });
+    }
+
+    // Wraps every awaitable, so the coroutine is destroyed instead of being
+    // suspended once it's cancelled.
+    template <typename Awaiter>
+    auto await_transform(Awaiter &&awaiter) {
+      return CancellableAwaiter<Awaiter>{std::forward<Awaiter>(awaiter),
+                                         *this};
+    }
+
+    // Cancel the coroutine when the owner is destroyed. It can be bound to
+    // a single owner only.
+    void Bind(EventOwner &owner) {
+      if (owner_ == &owner) {
+        return;
+      }
+      if (owner_ != nullptr) {
+        owner_->RemoveDestroyHook(hook_);
+      }
+      owner_ = &owner;
+      hook_ = owner.AddDestroyHook([this]() { Cancel(); });
+    }
+
+   private:
+    template <typename Awaiter>
+    struct CancellableAwaiter {
+      Awaiter awaiter;
+      promise_type &promise;
+
+      bool await_ready() {
+        return !promise.cancelled_ && awaiter.await_ready();
+      }
+
+      bool await_suspend(std::coroutine_handle<promise_type> handle) {
+        if (promise.cancelled_) {
+          handle.destroy();
+          return true;
+        }
+        promise.running_ = false;
+        bool suspended = true;
+        if constexpr (std::is_void<decltype(awaiter.await_suspend(
+                          handle))>::value) {
+          awaiter.await_suspend(handle);
+        } else {
+          suspended = awaiter.await_suspend(handle);
+        }
+        if (!suspended) {
+          promise.running_ = true;
+        }
+        return suspended;
+      }
+
+      decltype(auto) await_resume() {
+        promise.running_ = true;
+        return awaiter.await_resume();
+      }
+    };
+
+    void Cancel() {
+      owner_ = nullptr;
+      if (running_) {
+        cancelled_ = true;
+      } else {
+        std::coroutine_handle<promise_type>::from_promise(*this).destroy();
+      }
+    }
+
+    EventOwner *owner_ = nullptr;
+    EventId hook_;
+    bool running_ = true;
+    bool cancelled_ = false;
+  };
+
+ private:
+  UiTask() = default;
+};
+
+// Cancel the coroutine when the owner is destroyed, see UiTask.
+inline auto CancelOnDestroy(EventOwner &owner) {
+  struct Awaiter {
+    EventOwner &owner;
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<UiTask::promise_type> handle) {
+      handle.promise().Bind(owner);
+      return false;
+    }
+    void await_resume() {}
+  };
+  return Awaiter{owner};
+}
+
+// Resume the coroutine after the delay, in milliseconds.
+inline auto Delay(DWORD milliseconds, DWORD tolerance = 0) {
+  class Awaiter {
+   public:
+    Awaiter(DWORD milliseconds, DWORD tolerance)
+        : milliseconds_(milliseconds), tolerance_(tolerance), armed_(false) {}
+    Awaiter(Awaiter &&other)
+        : milliseconds_(other.milliseconds_),
+          tolerance_(other.tolerance_),
+          armed_(false) {}
+    Awaiter &operator=(const Awaiter &) = delete;
+
+    ~Awaiter() {
+      if (armed_) {
+        GetTimerService().Cancel(timer_);
+      }
+    }
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      timer_ = GetTimerService().SetTimeout(
+          milliseconds_,
+          [this, handle]() {
+            armed_ = false;
+            handle.resume();
+          },
+          nullptr, tolerance_);
+      armed_ = true;
+    }
+    void await_resume() {}
+
+   private:
+    DWORD milliseconds_;
+    DWORD tolerance_;
+    TimerId timer_;
+    bool armed_;
+  };
+  return Awaiter(milliseconds, tolerance);
+}
+
+// Run func on the thread pool and resume the coroutine with its result. If
+// func throws, the exception is rethrown by co_await. A cancelled coroutine
+// doesn't wait for func, but func still runs to the end, so it must not use
+// the objects owned by the coroutine.
+template <typename Func>
+auto RunInBackground(Func func) {
+  using Result = decltype(func());
+  using Value = typename std::conditional<std::is_void<Result>::value,
+                                          std::tuple<>, Result>::type;
+
+  // Shared with the worker, as the coroutine may be destroyed first.
+  struct Work {
+    Func func;
+    std::optional<Value> value;
+    std::exception_ptr error;
+    // Reset when the coroutine is destroyed. Used on the UI thread only.
+    std::coroutine_handle<> handle;
+  };
+
+  class Awaiter {
+   public:
+    explicit Awaiter(Func func)
+        : work_(std::make_shared<Work>(Work{std::move(func), {}, {}, {}})) {}
+    Awaiter(Awaiter &&) = default;
+    Awaiter &operator=(const Awaiter &) = delete;
+
+    ~Awaiter() {
+      if (work_ != nullptr) {
+        work_->handle = nullptr;
+      }
+    }
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      work_->handle = handle;
+      GetThreadPool().Submit([work = work_]() {
+        try {
+          if constexpr (std::is_void<Result>::value) {
+            work->func();
+            work->value.emplace();
+          } else {
+            work->value.emplace(work->func());
+          }
+        } catch (...) {
+          work->error = std::current_exception();
+        }
+        GetDispatcher().Post([work]() {
+          if (work->handle) {
+            work->handle.resume();
+          }
+        });
+      });
+    }
+    Result await_resume() {
+      work_->handle = nullptr;
+      if (work_->error) {
+        std::rethrow_exception(work_->error);
+      }
+      if constexpr (!std::is_void<Result>::value) {
+        return std::move(*work_->value);
+      }
+    }
+
+   private:
+    std::shared_ptr<Work> work_;
+  };
+  return Awaiter(std::move(func));
+}
+
+// Resume the coroutine on the next activation of the event. co_await gives
+// nothing for events without arguments, the argument for events with one,
+// and a tuple of the arguments otherwise. If the handler is destroyed first,
+// the coroutine is never resumed, so it should be cancelled by an owner
+// which is destroyed together with the handler.
+template <typename... Args>
+auto NextEvent(EventHandler<void(Args...)> &handler) {
+  using Values = std::tuple<typename std::decay<Args>::type...>;
+
+  class Awaiter {
+   public:
+    explicit Awaiter(EventHandler<void(Args...)> &handler)
+        : handler_(handler) {}
+    Awaiter(Awaiter &&other) : handler_(other.handler_) {}
+    Awaiter &operator=(const Awaiter &) = delete;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      // The subscription is owned by the awaiter, so it's dropped when the
+      // coroutine is destroyed.
+      subscription_ = handler_.AddEvent(
+          [this, handle](EventArg<Args>... args) {
+            values_.emplace(args...);
+            handler_.RemoveEvent(subscription_);
+            handle.resume();
+          },
+          &owner_);
+    }
+    auto await_resume() {
+      if constexpr (sizeof...(Args) == 1) {
+        return std::get<0>(std::move(*values_));
+      } else if constexpr (sizeof...(Args) > 1) {
+        return std::move(*values_);
+      }
+    }
+
+   private:
+    EventHandler<void(Args...)> &handler_;
+    EventOwner owner_;
+    EventId subscription_;
+    std::optional<Values> values_;
+  };
+  return Awaiter(handler);
+}
+
+#endif  // defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#endif  // COROUTINE_H_INCLUDED
@@ -36,6 +36,12 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
   new Label(&window, {4, 230}, L"Labels just keep static text");
 
+  VirtualListBox virtualList(
+      &window, {4, 250}, {200, 150}, [](int row, std::wstring &text) {
+        text = L"Virtual row " + Utf8ToWideString(std::to_string(row));
+      });
+  virtualList.SetRowCount(1000000);
+
   new Memo(&panel, {5, 5}, {190, 190},
            L"Here you can enter long\nmultiline text");
 
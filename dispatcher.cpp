@@ -0,0 +1,128 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "dispatcher.hpp"
+#include <exception>
+#include <memory>
+#include "winutil.hpp"
+
+static const UINT WM_DISPATCHER_WAKEUP = WM_APP + 1;
+
+LRESULT CALLBACK DispatcherWndProc(HWND hWnd, UINT message, WPARAM wParam,
+                                   LPARAM lParam) {
+  if (message == WM_DISPATCHER_WAKEUP) {
+    // Exceptions must not unwind through DispatchMessageW, so the error is
+    // kept until the main loop asks for it.
+    Dispatcher &dispatcher = GetDispatcher();
+    try {
+      dispatcher.Drain();
+    } catch (...) {
+      if (!dispatcher.error_) {
+        dispatcher.error_ = std::current_exception();
+      }
+    }
+    return 0;
+  }
+  return DefWindowProcW(hWnd, message, wParam, lParam);
+}
+
+Dispatcher::Dispatcher()
+    : head_(nullptr), wakeupPending_(false), threadId_(0), hWnd_(0) {}
+
+Dispatcher::~Dispatcher() {
+  Node *node = head_.exchange(nullptr);
+  while (node != nullptr) {
+    std::unique_ptr<Node> current(node);
+    node = node->next;
+  }
+}
+
+void Dispatcher::Init(HINSTANCE hInstance) {
+  WNDCLASSEXW wndClass = {};
+  wndClass.cbSize = sizeof(WNDCLASSEXW);
+  wndClass.lpfnWndProc = (WNDPROC)DispatcherWndProc;
+  wndClass.hInstance = hInstance;
+  wndClass.lpszClassName = L"WinUtilDispatcher";
+  if (RegisterClassExW(&wndClass) == 0) {
+    throw WindowsError("unable to register window class");
+  }
+  // Use a message-only window instead of thread messages, as the latter are
+  // lost when a modal loop (e.g. MessageBox) is running.
+  hWnd_ = CreateWindowExW(0, L"WinUtilDispatcher", L"", 0, 0, 0, 0, 0,
+                          HWND_MESSAGE, 0, hInstance, nullptr);
+  if (hWnd_ == 0) {
+    throw WindowsError("could not create window");
+  }
+  threadId_ = GetCurrentThreadId();
+  if (head_.load() != nullptr) {
+    wakeupPending_ = true;
+    Wakeup();
+  }
+}
+
+void Dispatcher::Post(SmallFunction<void()> func) {
+  Node *node = new Node{std::move(func), head_.load()};
+  while (!head_.compare_exchange_weak(node->next, node)) {
+  }
+  if (!wakeupPending_.exchange(true)) {
+    Wakeup();
+  }
+}
+
+bool Dispatcher::IsUiThread() const {
+  return threadId_ == GetCurrentThreadId();
+}
+
+void Dispatcher::Wakeup() {
+  // If the message can't be posted (e.g. the queue is full), let the next
+  // Post() try again instead of waiting for a message that never comes.
+  if (hWnd_ != 0 && !PostMessageW(hWnd_, WM_DISPATCHER_WAKEUP, 0, 0)) {
+    wakeupPending_ = false;
+  }
+}
+
+void Dispatcher::Drain() {
+  // Clear the flag first, so functions posted after we grab the queue will
+  // wake us up again.
+  wakeupPending_ = false;
+  Node *node = head_.exchange(nullptr);
+  // The queue is a stack, so reverse it to run the functions in order.
+  Node *ordered = nullptr;
+  while (node != nullptr) {
+    Node *next = node->next;
+    node->next = ordered;
+    ordered = node;
+    node = next;
+  }
+  // A throwing function doesn't stop the batch, as the rest may be waited
+  // for, e.g. by coroutines. The first exception is rethrown at the end.
+  std::exception_ptr error;
+  while (ordered != nullptr) {
+    std::unique_ptr<Node> current(ordered);
+    ordered = ordered->next;
+    try {
+      current->func();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void Dispatcher::RethrowError() {
+  if (error_) {
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+}
+
+Dispatcher &GetDispatcher() {
+  static Dispatcher dispatcher;
+  return dispatcher;
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef DISPATCHER_H_INCLUDED
+#define DISPATCHER_H_INCLUDED
+
+#include "win32api.hpp"
+#include <atomic>
+#include <exception>
+#include <future>
+#include <utility>
+#include "eventhandler.hpp"
+
+// Runs functions on the UI thread on behalf of other threads. Functions are
+// pushed into a lock-free queue, and the UI thread is woken up by a single
+// posted message per batch, so producers never block on the UI.
+class Dispatcher {
+ public:
+  Dispatcher();
+  Dispatcher(const Dispatcher &) = delete;
+  Dispatcher(Dispatcher &&) = delete;
+  Dispatcher &operator=(const Dispatcher &) = delete;
+  Dispatcher &operator=(Dispatcher &&) = delete;
+  ~Dispatcher();
+
+  // Called by InitApplication() on the UI thread.
+  void Init(HINSTANCE hInstance);
+
+  // Queue the function to be run on the UI thread. Can be called from any
+  // thread. The functions are run in the order they were posted.
+  void Post(SmallFunction<void()> func);
+
+  // Run the function on the UI thread and wait for its result. When called
+  // from the UI thread, the function is run immediately. Don't invoke while
+  // the UI thread is waiting for the calling thread, as it will deadlock.
+  template <typename Func>
+  auto Invoke(Func func) -> decltype(func()) {
+    if (IsUiThread()) {
+      return func();
+    }
+    std::packaged_task<decltype(func())()> task(std::move(func));
+    auto result = task.get_future();
+    Post([&task]() { task(); });
+    return result.get();
+  }
+
+  bool IsUiThread() const;
+
+  // Run all the queued functions. If some of them throw, the first exception
+  // is rethrown after all of them are run.
+  void Drain();
+
+  // Rethrow the first exception thrown by the functions run from the wakeup
+  // message, if any. Called by the main loop after dispatching a message.
+  void RethrowError();
+
+ private:
+  struct Node {
+    SmallFunction<void()> func;
+    Node *next;
+  };
+
+  void Wakeup();
+
+  friend LRESULT CALLBACK DispatcherWndProc(HWND hWnd, UINT message,
+                                            WPARAM wParam, LPARAM lParam);
+
+  std::atomic<Node *> head_;
+  std::atomic<bool> wakeupPending_;
+  DWORD threadId_;
+  HWND hWnd_;
+  // Used on the UI thread only.
+  std::exception_ptr error_;
+};
+
+Dispatcher &GetDispatcher();
+
+#endif  // DISPATCHER_H_INCLUDED
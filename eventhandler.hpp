@@ -7,21 +7,242 @@
 #ifndef EVENTHANDLER_H_INCLUDED
 #define EVENTHANDLER_H_INCLUDED
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
-#include <iostream>
-#include <map>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+#include "coalescing.hpp"
+#include "profiler.hpp"
+#include "widgetarena.hpp"
+
+// The way event arguments are passed to the subscribers: arguments declared
+// by value are passed by const reference, so they are not copied for every
+// subscriber.
+template <typename T>
+using EventArg = typename std::conditional<std::is_reference<T>::value, T,
+                                           const T &>::type;
+
+// Type-erased callable, like std::function. Callables which are small enough
+// (e.g. lambdas capturing a few pointers) are kept inside the object, so
+// storing them doesn't allocate memory.
+template <typename Signature>
+class SmallFunction;
+
+template <typename R, typename... Args>
+class SmallFunction<R(Args...)> {
+ public:
+  static constexpr size_t kInlineSize = 4 * sizeof(void *);
+
+  SmallFunction() noexcept : invoke_(nullptr), manage_(nullptr) {}
+  SmallFunction(std::nullptr_t) noexcept : SmallFunction() {}
+
+  template <typename Func,
+            typename = typename std::enable_if<!std::is_same<
+                typename std::decay<Func>::type, SmallFunction>::value>::type>
+  SmallFunction(Func &&func) : SmallFunction() {
+    Init(std::forward<Func>(func));
+  }
+
+  SmallFunction(SmallFunction &&other) noexcept : SmallFunction() {
+    MoveFrom(other);
+  }
+
+  SmallFunction &operator=(SmallFunction &&other) noexcept {
+    if (this != &other) {
+      Reset();
+      MoveFrom(other);
+    }
+    return *this;
+  }
+
+  SmallFunction(const SmallFunction &) = delete;
+  SmallFunction &operator=(const SmallFunction &) = delete;
+
+  ~SmallFunction() { Reset(); }
+
+  explicit operator bool() const noexcept { return invoke_ != nullptr; }
+
+  R operator()(EventArg<Args>... args) const {
+    if (invoke_ == nullptr) {
+      throw std::bad_function_call();
+    }
+    return invoke_(const_cast<Storage *>(&storage_),
+                   std::forward<EventArg<Args>>(args)...);
+  }
+
+  // Type of the stored callable, or void if there is none.
+  const std::type_info &TargetType() const noexcept {
+    if (manage_ == nullptr) {
+      return typeid(void);
+    }
+    Storage type;
+    manage_(Operation::Type, &type, nullptr);
+    return **reinterpret_cast<const std::type_info **>(type.data);
+  }
+
+  void Reset() noexcept {
+    if (manage_ != nullptr) {
+      manage_(Operation::Destroy, &storage_, nullptr);
+    }
+    invoke_ = nullptr;
+    manage_ = nullptr;
+  }
+
+ private:
+  struct Storage {
+    alignas(std::max_align_t) unsigned char data[kInlineSize];
+  };
+
+  enum class Operation { Move, Destroy, Type };
+
+  using Invoker = R (*)(Storage *, EventArg<Args>...);
+  using Manager = void (*)(Operation, Storage *, Storage *);
+
+  template <typename Func>
+  struct IsInline
+      : std::integral_constant<
+            bool, sizeof(Func) <= kInlineSize &&
+                      alignof(Func) <= alignof(Storage) &&
+                      std::is_nothrow_move_constructible<Func>::value> {};
+
+  template <typename Func>
+  static Func *Target(Storage *storage, std::true_type) {
+    return reinterpret_cast<Func *>(storage->data);
+  }
+
+  template <typename Func>
+  static Func *Target(Storage *storage, std::false_type) {
+    return *reinterpret_cast<Func **>(storage->data);
+  }
+
+  // Like std::function, a function returning void discards the result of
+  // the callable, e.g. a coroutine subscriber returning UiTask.
+  template <typename Func>
+  static R Invoke(Storage *storage, EventArg<Args>... args) {
+    if constexpr (std::is_void<R>::value) {
+      (*Target<Func>(storage, IsInline<Func>()))(
+          std::forward<EventArg<Args>>(args)...);
+    } else {
+      return (*Target<Func>(storage, IsInline<Func>()))(
+          std::forward<EventArg<Args>>(args)...);
+    }
+  }
+
+  template <typename Func>
+  static void Manage(Operation op, Storage *dst, Storage *src) {
+    switch (op) {
+      case Operation::Move: {
+        Move<Func>(dst, src, IsInline<Func>());
+        break;
+      }
+      case Operation::Destroy: {
+        Destroy<Func>(dst, IsInline<Func>());
+        break;
+      }
+      case Operation::Type: {
+        *reinterpret_cast<const std::type_info **>(dst->data) = &typeid(Func);
+        break;
+      }
+    }
+  }
+
+  template <typename Func>
+  static void Move(Storage *dst, Storage *src, std::true_type) {
+    Func *func = Target<Func>(src, std::true_type());
+    new (dst->data) Func(std::move(*func));
+    func->~Func();
+  }
+
+  template <typename Func>
+  static void Move(Storage *dst, Storage *src, std::false_type) {
+    *dst = *src;
+  }
+
+  template <typename Func>
+  static void Destroy(Storage *storage, std::true_type) {
+    Target<Func>(storage, std::true_type())->~Func();
+  }
+
+  template <typename Func>
+  static void Destroy(Storage *storage, std::false_type) {
+    delete Target<Func>(storage, std::false_type());
+  }
+
+  template <typename Func>
+  void Init(Func &&func) {
+    using Decayed = typename std::decay<Func>::type;
+    if (IsNull(func)) {
+      return;
+    }
+    Construct<Decayed>(std::forward<Func>(func), IsInline<Decayed>());
+    invoke_ = &Invoke<Decayed>;
+    manage_ = &Manage<Decayed>;
+  }
+
+  template <typename Decayed, typename Func>
+  void Construct(Func &&func, std::true_type) {
+    new (storage_.data) Decayed(std::forward<Func>(func));
+  }
+
+  template <typename Decayed, typename Func>
+  void Construct(Func &&func, std::false_type) {
+    *reinterpret_cast<Decayed **>(storage_.data) =
+        new Decayed(std::forward<Func>(func));
+  }
+
+  template <typename Func>
+  static bool IsNull(const Func &) {
+    return false;
+  }
+
+  template <typename Signature>
+  static bool IsNull(const std::function<Signature> &func) {
+    return !func;
+  }
+
+  template <typename Ret, typename... FuncArgs>
+  static bool IsNull(Ret (*func)(FuncArgs...)) {
+    return func == nullptr;
+  }
+
+  void MoveFrom(SmallFunction &other) noexcept {
+    if (other.manage_ != nullptr) {
+      other.manage_(Operation::Move, &storage_, &other.storage_);
+    }
+    invoke_ = other.invoke_;
+    manage_ = other.manage_;
+    other.invoke_ = nullptr;
+    other.manage_ = nullptr;
+  }
+
+  Storage storage_;
+  Invoker invoke_;
+  Manager manage_;
+};
 
 class EventId {
-  int64_t id;
+  int64_t id = 0;
   template <typename FuncArgs>
   friend class EventHandler;
   friend class EventOwner;
 };
 
+// The subscription lists of event owners and handlers are allocated from the
+// arena which was current when the object was constructed.
 class EventOwner {
  public:
-  EventOwner() {}
+  EventOwner() : destroyHooks_(CurrentArenaResource()) {}
   EventOwner(const EventOwner &) = delete;
   EventOwner(EventOwner &&) = delete;
   EventOwner &operator=(const EventOwner &) = delete;
@@ -29,55 +250,85 @@ class EventOwner {
 
   virtual ~EventOwner() {
     destroying_ = true;
-    for (const auto &iter : destroyHooks_) {
-      iter.second();
+    // Hooks may be added while running the other ones, so don't use
+    // iterators here. Each hook is moved out before it's run, so it isn't
+    // moved while running if the vector grows.
+    for (size_t i = 0; i < destroyHooks_.size(); ++i) {
+      SmallFunction<void()> hook = std::move(destroyHooks_[i].func);
+      if (hook) {
+        hook();
+      }
     }
   }
 
-  EventId AddDestroyHook(std::function<void()> hook) {
+  EventId AddDestroyHook(SmallFunction<void()> hook) {
     EventId id;
     id.id = lastEvent_++;
-    destroyHooks_[id.id] = hook;
+    destroyHooks_.push_back(DestroyHook{id.id, std::move(hook)});
     return id;
   }
 
-  void RemoveDestroyHook(EventId id) { destroyHooks_.erase(id.id); }
-
-  template <typename FuncArgs>
-  friend class EventHandler;
+  void RemoveDestroyHook(EventId id) {
+    auto iter = std::lower_bound(
+        destroyHooks_.begin(), destroyHooks_.end(), id.id,
+        [](const DestroyHook &hook, int64_t id) { return hook.id < id; });
+    if (iter == destroyHooks_.end() || iter->id != id.id) {
+      return;
+    }
+    if (destroying_) {
+      // The hooks are being run by index, so it's only disabled.
+      iter->func.Reset();
+    } else {
+      destroyHooks_.erase(iter);
+    }
+  }
 
  private:
-  std::map<int64_t, std::function<void()>> destroyHooks_;
+  struct DestroyHook {
+    int64_t id;
+    SmallFunction<void()> func;
+  };
+
+  // Sorted by id, as ids only grow.
+  std::pmr::vector<DestroyHook> destroyHooks_;
   int64_t lastEvent_ = 0;
   bool destroying_ = false;
 };
 
 template <typename FuncArgs>
-class EventHandler {
+class EventHandler;
+
+template <typename R, typename... Args>
+class EventHandler<R(Args...)> {
  private:
   struct Event {
+    int64_t id;
     EventOwner *owner;
-    std::function<FuncArgs> func;
+    SmallFunction<R(Args...)> func;
     EventId hook;
+    bool active;
   };
 
  public:
-  EventHandler() {}
+  EventHandler()
+      : events_(CurrentArenaResource()), addedEvents_(CurrentArenaResource()) {}
   EventHandler(const EventHandler &) = delete;
   EventHandler(EventHandler &&) = delete;
   EventHandler &operator=(const EventHandler &) = delete;
   EventHandler &operator=(EventHandler &&) = delete;
 
   ~EventHandler() {
-    for (const auto &iter : events_) {
-      const Event &event = iter.second;
-      if (event.owner != nullptr) {
-        event.owner->RemoveDestroyHook(event.hook);
+    for (const std::pmr::vector<Event> *events : {&events_, &addedEvents_}) {
+      for (const Event &event : *events) {
+        if (event.active && event.owner != nullptr) {
+          event.owner->RemoveDestroyHook(event.hook);
+        }
       }
     }
   }
 
-  EventId AddEvent(std::function<FuncArgs> func, EventOwner *owner = nullptr) {
+  EventId AddEvent(SmallFunction<R(Args...)> func,
+                   EventOwner *owner = nullptr) {
     int64_t id = ++lastEvent_;
     EventId res;
     res.id = id;
@@ -85,28 +336,188 @@ class EventHandler {
     if (owner != nullptr) {
       hook = owner->AddDestroyHook([this, res]() { RemoveEvent(res); });
     }
-    events_[id] = Event{owner, func, hook};
+    // Events which are running now must stay in place, so the new ones are
+    // kept aside until the dispatch is finished.
+    std::pmr::vector<Event> &events = activating_ > 0 ? addedEvents_ : events_;
+    events.push_back(Event{id, owner, std::move(func), hook, true});
     return res;
   }
 
+  // Add a subscriber called as the policy says, see CoalescePolicy.
+  EventId AddEvent(SmallFunction<R(Args...)> func, CoalescePolicy policy,
+                   EventOwner *owner = nullptr) {
+    static_assert(std::is_void<R>::value,
+                  "only subscribers returning void can be coalesced");
+    if (policy.GetKind() == CoalescePolicy::Kind::None) {
+      return AddEvent(std::move(func), owner);
+    }
+    return AddEvent(CoalescedEvent(std::move(func), policy), owner);
+  }
+
   void RemoveEvent(EventId id) {
-    const Event &event = events_.at(id.id);
-    if (event.owner != nullptr && !event.owner->destroying_) {
-      event.owner->RemoveDestroyHook(event.hook);
+    auto iter = Find(addedEvents_, id);
+    if (iter != addedEvents_.end()) {
+      Deactivate(*iter);
+      addedEvents_.erase(iter);
+      return;
+    }
+    iter = Find(events_, id);
+    if (iter == events_.end()) {
+      throw std::out_of_range("no such event");
+    }
+    Deactivate(*iter);
+    if (activating_ > 0) {
+      // The event may be running now, so it's destroyed after the dispatch.
+      hasRemovedEvents_ = true;
+    } else {
+      events_.erase(iter);
     }
-    events_.erase(id.id);
   }
 
-  template <typename... Args>
-  void Activate(Args... args) {
-    for (const auto &iter : events_) {
-      iter.second.func(args...);
+  void Activate(EventArg<Args>... args) {
+    ActivationGuard guard(*this);
+    size_t count = events_.size();
+    bool profile = IsProfilingEnabled();
+    for (size_t i = 0; i < count; ++i) {
+      const Event &event = events_[i];
+      if (!event.active) {
+        continue;
+      }
+      if (profile) {
+        int64_t start = ProfilerClock();
+        event.func(std::forward<EventArg<Args>>(args)...);
+        RecordProfile(ProfileCategory::Subscriber, 0,
+                      event.func.TargetType().name(), ProfilerClock() - start);
+      } else {
+        event.func(std::forward<EventArg<Args>>(args)...);
+      }
     }
   }
 
  private:
-  std::map<int64_t, Event> events_;
+  class ActivationGuard {
+   public:
+    explicit ActivationGuard(EventHandler &handler) : handler_(handler) {
+      ++handler_.activating_;
+    }
+    ActivationGuard(const ActivationGuard &) = delete;
+    ActivationGuard &operator=(const ActivationGuard &) = delete;
+    ~ActivationGuard() {
+      if (--handler_.activating_ == 0) {
+        handler_.Compact();
+      }
+    }
+
+   private:
+    EventHandler &handler_;
+  };
+
+  // Subscriber which keeps the arguments of the latest activation and passes
+  // them to func when the policy allows.
+  class CoalescedEvent {
+   public:
+    CoalescedEvent(SmallFunction<R(Args...)> func, CoalescePolicy policy)
+        : state_(std::make_shared<State>(std::move(func), policy)) {}
+
+    void operator()(EventArg<Args>... args) const {
+      state_->args.emplace(args...);
+      state_->lastActivation = GetCoalescingTime();
+      if (state_->scheduled) {
+        return;
+      }
+      state_->scheduled = true;
+      ScheduleCoalescedCall(state_, state_->GetDue());
+    }
+
+   private:
+    struct State : public CoalescedCall,
+                   public std::enable_shared_from_this<State> {
+      State(SmallFunction<R(Args...)> func, CoalescePolicy policy)
+          : func(std::move(func)),
+            policy(policy),
+            lastActivation(0),
+            lastRun(0),
+            scheduled(false) {}
+
+      uint64_t GetDue() const {
+        switch (policy.GetKind()) {
+          case CoalescePolicy::Kind::Debounce: {
+            return lastActivation + policy.GetInterval();
+          }
+          default: {
+            return std::max(lastActivation, lastRun + policy.GetInterval());
+          }
+        }
+      }
+
+      void Run() override {
+        // The debounce delay is counted from the latest activation, which
+        // may have come after the call was scheduled.
+        uint64_t now = GetCoalescingTime();
+        uint64_t due = GetDue();
+        if (due > now) {
+          ScheduleCoalescedCall(this->shared_from_this(), due);
+          return;
+        }
+        scheduled = false;
+        lastRun = now;
+        std::tuple<typename std::decay<Args>::type...> values(
+            std::move(*args));
+        args.reset();
+        std::apply([this](auto &...values) { func(values...); }, values);
+      }
+
+      SmallFunction<R(Args...)> func;
+      CoalescePolicy policy;
+      std::optional<std::tuple<typename std::decay<Args>::type...>> args;
+      uint64_t lastActivation;
+      uint64_t lastRun;
+      bool scheduled;
+    };
+
+    std::shared_ptr<State> state_;
+  };
+
+  static typename std::pmr::vector<Event>::iterator Find(
+      std::pmr::vector<Event> &events, EventId id) {
+    auto iter = std::lower_bound(
+        events.begin(), events.end(), id.id,
+        [](const Event &event, int64_t id) { return event.id < id; });
+    if (iter == events.end() || iter->id != id.id || !iter->active) {
+      return events.end();
+    }
+    return iter;
+  }
+
+  static void Deactivate(Event &event) {
+    if (event.owner != nullptr) {
+      event.owner->RemoveDestroyHook(event.hook);
+    }
+    event.active = false;
+  }
+
+  void Compact() {
+    if (hasRemovedEvents_) {
+      events_.erase(
+          std::remove_if(events_.begin(), events_.end(),
+                         [](const Event &event) { return !event.active; }),
+          events_.end());
+      hasRemovedEvents_ = false;
+    }
+    if (!addedEvents_.empty()) {
+      std::move(addedEvents_.begin(), addedEvents_.end(),
+                std::back_inserter(events_));
+      addedEvents_.clear();
+    }
+  }
+
+  // Both are sorted by id, and all the ids in addedEvents_ are greater than
+  // the ones in events_.
+  std::pmr::vector<Event> events_;
+  std::pmr::vector<Event> addedEvents_;
   int64_t lastEvent_ = 0;
+  int activating_ = 0;
+  bool hasRemovedEvents_ = false;
 };
 
 #endif  // EVENTHANDLER_H_INCLUDED
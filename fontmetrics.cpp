@@ -0,0 +1,103 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "fontmetrics.hpp"
+#include "winutil.hpp"
+
+// Characters which GDI may shape into glyphs of different widths, so the sum
+// of advance widths would be wrong.
+static bool NeedsShaping(wchar_t ch) {
+  return (ch >= 0x0590 && ch < 0x1100) || (ch >= 0xd800 && ch < 0xe000) ||
+         static_cast<size_t>(ch) >= 0x10000;
+}
+
+FontMetrics::FontMetrics(HFONT font) : oldFont_(nullptr) {
+  dc_ = CreateCompatibleDC(nullptr);
+  if (dc_ == nullptr) {
+    throw WindowsError("could not create memory DC");
+  }
+  if (font != nullptr) {
+    oldFont_ = SelectObject(dc_, font);
+  }
+  TEXTMETRICW metrics;
+  if (!GetTextMetricsW(dc_, &metrics)) {
+    metrics.tmHeight = 0;
+    metrics.tmOverhang = 0;
+  }
+  height_ = metrics.tmHeight;
+  overhang_ = metrics.tmOverhang;
+}
+
+FontMetrics::~FontMetrics() {
+  if (oldFont_ != nullptr) {
+    SelectObject(dc_, oldFont_);
+  }
+  DeleteDC(dc_);
+}
+
+SIZE FontMetrics::Measure(std::wstring_view text) {
+  int width = 0;
+  for (wchar_t ch : text) {
+    if (NeedsShaping(ch)) {
+      return MeasureShaped(text);
+    }
+    width += LoadPage(ch / kPageSize)[ch % kPageSize];
+  }
+  if (!text.empty()) {
+    width += overhang_;
+  }
+  return {width, height_};
+}
+
+int FontMetrics::GetCharWidth(wchar_t ch) {
+  if (static_cast<size_t>(ch) >= 0x10000) {
+    return MeasureShaped(std::wstring_view(&ch, 1)).cx;
+  }
+  return LoadPage(ch / kPageSize)[ch % kPageSize];
+}
+
+const FontMetrics::Page &FontMetrics::LoadPage(size_t index) {
+  std::unique_ptr<Page> &page = pages_[index];
+  if (page == nullptr) {
+    page.reset(new Page());
+    UINT first = static_cast<UINT>(index * kPageSize);
+    if (!GetCharWidth32W(dc_, first, first + kPageSize - 1, page->data())) {
+      page->fill(0);
+    }
+  }
+  return *page;
+}
+
+SIZE FontMetrics::MeasureShaped(std::wstring_view text) {
+  std::wstring key(text);
+  auto iter = extents_.find(key);
+  if (iter != extents_.end()) {
+    return iter->second;
+  }
+  SIZE size = {0, height_};
+  GetTextExtentPoint32W(dc_, key.c_str(), static_cast<int>(key.size()), &size);
+  if (extents_.size() >= kMaxCachedExtents) {
+    extents_.clear();
+  }
+  extents_.emplace(std::move(key), size);
+  return size;
+}
+
+static std::unordered_map<HFONT, std::unique_ptr<FontMetrics>> &
+FontMetricsCache() {
+  thread_local std::unordered_map<HFONT, std::unique_ptr<FontMetrics>> cache;
+  return cache;
+}
+
+FontMetrics &GetFontMetrics(HFONT font) {
+  std::unique_ptr<FontMetrics> &metrics = FontMetricsCache()[font];
+  if (metrics == nullptr) {
+    metrics.reset(new FontMetrics(font));
+  }
+  return *metrics;
+}
+
+void ForgetFontMetrics(HFONT font) { FontMetricsCache().erase(font); }
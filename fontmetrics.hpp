@@ -0,0 +1,60 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef FONTMETRICS_H_INCLUDED
+#define FONTMETRICS_H_INCLUDED
+
+#include "win32api.hpp"
+#include <array>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Measures text drawn with one font. The font is kept selected into a memory
+// DC, advance widths are loaded a page of 256 characters at a time, and the
+// extent of a string is the sum of them. Strings which need complex shaping
+// (surrogate pairs, right-to-left and Indic scripts) are measured by GDI, and
+// the results are cached. The object doesn't own the font.
+class FontMetrics {
+ public:
+  explicit FontMetrics(HFONT font);
+  FontMetrics(const FontMetrics &) = delete;
+  FontMetrics &operator=(const FontMetrics &) = delete;
+  ~FontMetrics();
+
+  SIZE Measure(std::wstring_view text);
+  int GetCharWidth(wchar_t ch);
+  int GetHeight() const { return height_; }
+
+ private:
+  static constexpr size_t kPageSize = 256;
+  static constexpr size_t kPageCount = 0x10000 / kPageSize;
+  static constexpr size_t kMaxCachedExtents = 4096;
+
+  using Page = std::array<int, kPageSize>;
+
+  const Page &LoadPage(size_t index);
+  SIZE MeasureShaped(std::wstring_view text);
+
+  HDC dc_;
+  HGDIOBJ oldFont_;
+  int height_;
+  int overhang_;
+  std::array<std::unique_ptr<Page>, kPageCount> pages_;
+  std::unordered_map<std::wstring, SIZE> extents_;
+};
+
+// Return the shared metrics of the font, creating them on first use. A null
+// font means the system font. The metrics are per thread, so the UI thread
+// doesn't need any locking.
+FontMetrics &GetFontMetrics(HFONT font);
+
+// Drop the cached metrics, e.g. before the font is deleted or when the system
+// settings change.
+void ForgetFontMetrics(HFONT font);
+
+#endif  // FONTMETRICS_H_INCLUDED
@@ -0,0 +1,398 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "grid.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include "threadpool.hpp"
+
+// Rows are split into chunks of at least this size for the worker threads.
+static const size_t kMinChunkRows = 16384;
+
+// Thrown by the comparer and the filter to stop a cancelled operation.
+struct OperationCancelled {};
+
+struct VirtualGrid::Operation {
+  // Cleared on the UI thread when the result is no longer needed.
+  VirtualGrid *grid;
+  std::atomic<bool> cancelled{false};
+  // Whether the worker may call the comparer or the filter.
+  bool running = false;
+  std::mutex mutex;
+  std::condition_variable stopped;
+  int rowCount;
+  RowComparer less;
+  RowFilter filter;
+  size_t chunkCount;
+  // Each filtered chunk, sorted chunk and merge of two chunks is a step.
+  size_t totalSteps;
+  std::atomic<size_t> doneSteps{0};
+  std::atomic<int> reportedPercent{0};
+  std::vector<int> rows;
+};
+
+Widget::WidgetCreationOptions VirtualGrid::GetCreationOptions() {
+  WidgetCreationOptions options = {};
+  options.dwExStyle = WS_EX_CLIENTEDGE;
+  options.dwStyle = WS_VISIBLE | WS_TABSTOP | LVS_REPORT | LVS_OWNERDATA |
+                    LVS_SINGLESEL | LVS_SHOWSELALWAYS;
+  return options;
+}
+
+VirtualGrid::VirtualGrid(Widget *parent, POINT pos, SIZE size,
+                         CellProvider provider)
+    : Widget(parent, WC_LISTVIEWW, pos, size, GetCreationOptions()),
+      provider_(std::move(provider)),
+      rowCount_(0),
+      modelOrder_(true) {
+  if (IsRealized()) {
+    OnRealize();
+  }
+}
+
+VirtualGrid::~VirtualGrid() { CancelOperation(); }
+
+void VirtualGrid::OnRealize() {
+  DWORD style = LVS_EX_FULLROWSELECT | LVS_EX_DOUBLEBUFFER;
+  SendMessageW(Handle(), LVM_SETEXTENDEDLISTVIEWSTYLE, style, style);
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    InsertColumn(static_cast<int>(i));
+  }
+  if (GetCount() > 0) {
+    SendMessageW(Handle(), LVM_SETITEMCOUNT, GetCount(), 0);
+  }
+}
+
+void VirtualGrid::AddColumn(const std::wstring &title, int width) {
+  columns_.push_back(Column{title, width});
+  if (IsRealized()) {
+    InsertColumn(static_cast<int>(columns_.size()) - 1);
+  }
+}
+
+void VirtualGrid::InsertColumn(int index) {
+  const Column &column = columns_[index];
+  LVCOLUMNW info = {};
+  info.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_SUBITEM;
+  info.cx = column.width;
+  info.pszText = const_cast<LPWSTR>(column.title.c_str());
+  info.iSubItem = index;
+  SendMessageW(Handle(), LVM_INSERTCOLUMNW, index, (LPARAM)&info);
+}
+
+void VirtualGrid::SetCellProvider(CellProvider provider) {
+  provider_ = std::move(provider);
+  RefreshRows();
+}
+
+void VirtualGrid::SetRowCount(int count) {
+  CancelOperation();
+  rowCount_ = count;
+  less_ = nullptr;
+  filter_ = nullptr;
+  modelOrder_ = true;
+  rows_ = std::vector<int>();
+  if (IsRealized()) {
+    SendMessageW(Handle(), LVM_SETITEMCOUNT, count, 0);
+  }
+}
+
+void VirtualGrid::RefreshRows() {
+  if (IsRealized()) {
+    InvalidateRect(Handle(), nullptr, false);
+  }
+}
+
+void VirtualGrid::Sort(RowComparer less) {
+  less_ = std::move(less);
+  StartOperation();
+}
+
+void VirtualGrid::Filter(RowFilter filter) {
+  filter_ = std::move(filter);
+  StartOperation();
+}
+
+int VirtualGrid::GetCount() const {
+  return modelOrder_ ? rowCount_ : static_cast<int>(rows_.size());
+}
+
+int VirtualGrid::GetModelRow(int position) const {
+  return modelOrder_ ? position : rows_[position];
+}
+
+int VirtualGrid::GetSelectedRow() {
+  if (!IsRealized()) {
+    return -1;
+  }
+  int position = static_cast<int>(
+      SendMessageW(Handle(), LVM_GETNEXTITEM, -1, LVNI_SELECTED));
+  if (position < 0 || position >= GetCount()) {
+    return -1;
+  }
+  return GetModelRow(position);
+}
+
+void VirtualGrid::StartOperation() {
+  CancelOperation();
+  if (!less_ && !filter_) {
+    int selectedRow = GetSelectedRow();
+    modelOrder_ = true;
+    rows_ = std::vector<int>();
+    ShowRows(selectedRow);
+    OnProgress.Activate(1.0);
+    return;
+  }
+  auto operation = std::make_shared<Operation>();
+  operation->grid = this;
+  operation->rowCount = rowCount_;
+  operation->less = less_;
+  operation->filter = filter_;
+  size_t maxChunks = (GetThreadPool().GetThreadCount() + 1) * 4;
+  operation->chunkCount = std::max<size_t>(
+      1, std::min(maxChunks, static_cast<size_t>(rowCount_) / kMinChunkRows));
+  size_t chunks = operation->chunkCount;
+  operation->totalSteps =
+      (filter_ ? chunks : 0) + (less_ ? 2 * chunks - 1 : 0);
+  operation_ = operation;
+  GetThreadPool().Submit([operation]() { RunOperation(operation); });
+}
+
+void VirtualGrid::CancelOperation() {
+  if (operation_ == nullptr) {
+    return;
+  }
+  std::shared_ptr<Operation> operation = std::move(operation_);
+  operation->grid = nullptr;
+  // The comparer and the filter check the flag on each call, so the wait
+  // is short.
+  std::unique_lock<std::mutex> lock(operation->mutex);
+  operation->cancelled = true;
+  operation->stopped.wait(lock, [&]() { return !operation->running; });
+}
+
+void VirtualGrid::FinishOperation(Operation &operation) {
+  int selectedRow = GetSelectedRow();
+  rows_.swap(operation.rows);
+  modelOrder_ = false;
+  operation_.reset();
+  ShowRows(selectedRow);
+  OnProgress.Activate(1.0);
+}
+
+void VirtualGrid::ShowRows(int selectedRow) {
+  if (!IsRealized()) {
+    return;
+  }
+  SendMessageW(Handle(), LVM_SETITEMCOUNT, GetCount(), LVSICF_NOSCROLL);
+  // The list view keeps the selection by position, so it's moved to where
+  // the selected row is now.
+  LVITEMW state = {};
+  state.stateMask = LVIS_SELECTED | LVIS_FOCUSED;
+  SendMessageW(Handle(), LVM_SETITEMSTATE, -1, (LPARAM)&state);
+  if (selectedRow >= 0) {
+    int position = -1;
+    if (modelOrder_) {
+      position = selectedRow < rowCount_ ? selectedRow : -1;
+    } else {
+      auto iter = std::find(rows_.begin(), rows_.end(), selectedRow);
+      if (iter != rows_.end()) {
+        position = static_cast<int>(iter - rows_.begin());
+      }
+    }
+    if (position >= 0) {
+      state.state = LVIS_SELECTED | LVIS_FOCUSED;
+      SendMessageW(Handle(), LVM_SETITEMSTATE, position, (LPARAM)&state);
+    }
+  }
+  InvalidateRect(Handle(), nullptr, false);
+}
+
+bool VirtualGrid::HandleNotify(WPARAM, LPARAM lParam, LRESULT &result) {
+  const NMHDR *header = reinterpret_cast<const NMHDR *>(lParam);
+  switch (header->code) {
+    case LVN_GETDISPINFOW: {
+      LVITEMW &item = reinterpret_cast<NMLVDISPINFOW *>(lParam)->item;
+      if (item.mask & LVIF_TEXT) {
+        FillCell(item);
+      }
+      break;
+    }
+    case LVN_ODCACHEHINT: {
+      const NMLVCACHEHINT *hint =
+          reinterpret_cast<const NMLVCACHEHINT *>(lParam);
+      OnCacheHint.Activate(hint->iFrom, hint->iTo);
+      break;
+    }
+    case LVN_COLUMNCLICK: {
+      OnColumnClick.Activate(
+          reinterpret_cast<const NMLISTVIEW *>(lParam)->iSubItem);
+      break;
+    }
+    default: {
+      return false;
+    }
+  }
+  result = 0;
+  return true;
+}
+
+void VirtualGrid::FillCell(LVITEMW &item) {
+  cellText_.clear();
+  if (provider_ && item.iItem >= 0 && item.iItem < GetCount()) {
+    provider_(GetModelRow(item.iItem), item.iSubItem, cellText_);
+  }
+  if (item.cchTextMax <= 0) {
+    return;
+  }
+  size_t length =
+      std::min(cellText_.size(), static_cast<size_t>(item.cchTextMax - 1));
+  std::copy(cellText_.begin(), cellText_.begin() + length, item.pszText);
+  item.pszText[length] = 0;
+}
+
+void VirtualGrid::CompleteStep(const std::shared_ptr<Operation> &operation) {
+  size_t done = ++operation->doneSteps;
+  int percent = static_cast<int>(done * 100 / operation->totalSteps);
+  int reported = operation->reportedPercent;
+  // Completion is reported by FinishOperation(), and at most one update is
+  // posted per percent.
+  while (percent > reported && percent < 100) {
+    if (operation->reportedPercent.compare_exchange_weak(reported, percent)) {
+      GetDispatcher().Post([operation, percent]() {
+        if (operation->grid != nullptr) {
+          operation->grid->OnProgress.Activate(percent / 100.0);
+        }
+      });
+      break;
+    }
+  }
+}
+
+void VirtualGrid::RunOperation(const std::shared_ptr<Operation> &operation) {
+  {
+    std::lock_guard<std::mutex> lock(operation->mutex);
+    if (operation->cancelled) {
+      return;
+    }
+    operation->running = true;
+  }
+  std::exception_ptr error;
+  try {
+    BuildRows(operation);
+  } catch (const OperationCancelled &) {
+  } catch (...) {
+    error = std::current_exception();
+  }
+  bool cancelled;
+  {
+    std::lock_guard<std::mutex> lock(operation->mutex);
+    operation->running = false;
+    cancelled = operation->cancelled;
+  }
+  operation->stopped.notify_all();
+  if (cancelled) {
+    return;
+  }
+  if (error) {
+    // Errors of the comparer or the filter are rethrown on the UI thread.
+    GetDispatcher().Post([operation, error]() {
+      if (operation->grid != nullptr) {
+        operation->grid->CancelOperation();
+        std::rethrow_exception(error);
+      }
+    });
+    return;
+  }
+  GetDispatcher().Post([operation]() {
+    if (operation->grid != nullptr) {
+      operation->grid->FinishOperation(*operation);
+    }
+  });
+}
+
+void VirtualGrid::BuildRows(const std::shared_ptr<Operation> &operation) {
+  Operation &op = *operation;
+  ThreadPool &pool = GetThreadPool();
+  size_t chunkCount = op.chunkCount;
+  std::vector<int> &rows = op.rows;
+  auto checkCancelled = [&op]() {
+    if (op.cancelled.load(std::memory_order_relaxed)) {
+      throw OperationCancelled();
+    }
+  };
+  // Filter the chunks of the model rows, then concatenate the results,
+  // which keeps the model order.
+  if (op.filter) {
+    size_t rowCount = op.rowCount;
+    std::vector<std::vector<int>> parts(chunkCount);
+    pool.ParallelFor(chunkCount, [&](size_t chunk) {
+      int begin = static_cast<int>(rowCount * chunk / chunkCount);
+      int end = static_cast<int>(rowCount * (chunk + 1) / chunkCount);
+      for (int row = begin; row < end; ++row) {
+        checkCancelled();
+        if (op.filter(row)) {
+          parts[chunk].push_back(row);
+        }
+      }
+      CompleteStep(operation);
+    });
+    size_t total = 0;
+    for (const std::vector<int> &part : parts) {
+      total += part.size();
+    }
+    rows.reserve(total);
+    for (const std::vector<int> &part : parts) {
+      rows.insert(rows.end(), part.begin(), part.end());
+    }
+  } else {
+    rows.resize(op.rowCount);
+    std::iota(rows.begin(), rows.end(), 0);
+  }
+  if (!op.less) {
+    return;
+  }
+  // Sort the chunks, then merge them pairwise. Both steps are stable.
+  auto less = [&](int lhs, int rhs) {
+    checkCancelled();
+    return op.less(lhs, rhs);
+  };
+  std::vector<size_t> bounds;
+  for (size_t chunk = 0; chunk <= chunkCount; ++chunk) {
+    bounds.push_back(rows.size() * chunk / chunkCount);
+  }
+  pool.ParallelFor(chunkCount, [&](size_t chunk) {
+    std::stable_sort(rows.begin() + bounds[chunk],
+                     rows.begin() + bounds[chunk + 1], less);
+    CompleteStep(operation);
+  });
+  std::vector<int> merged(rows.size());
+  while (bounds.size() > 2) {
+    size_t runs = bounds.size() - 1;
+    pool.ParallelFor((runs + 1) / 2, [&](size_t pair) {
+      size_t begin = bounds[2 * pair];
+      size_t middle = bounds[std::min(2 * pair + 1, runs)];
+      size_t end = bounds[std::min(2 * pair + 2, runs)];
+      std::merge(rows.begin() + begin, rows.begin() + middle,
+                 rows.begin() + middle, rows.begin() + end,
+                 merged.begin() + begin, less);
+      if (middle != end) {
+        CompleteStep(operation);
+      }
+    });
+    rows.swap(merged);
+    std::vector<size_t> mergedBounds;
+    for (size_t i = 0; i < runs; i += 2) {
+      mergedBounds.push_back(bounds[i]);
+    }
+    mergedBounds.push_back(bounds[runs]);
+    bounds.swap(mergedBounds);
+  }
+}
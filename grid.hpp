@@ -0,0 +1,127 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef GRID_H_INCLUDED
+#define GRID_H_INCLUDED
+
+#include "win32api.hpp"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "winutil.hpp"
+
+// Multi-column grid which doesn't store its rows, based on the list view in
+// owner-data report mode. The provider is asked for the text of the cells
+// being painted only, and OnCacheHint tells in advance which rows are about
+// to be painted, so their data can be prepared at once.
+//
+// The grid shows a permutation of the model rows. Sorting and filtering build
+// the new permutation in parallel on the thread pool, while the grid keeps
+// showing the previous one and the UI thread stays responsive. The result is
+// swapped in on the UI thread when it's ready. The comparer and the filter
+// are called from several worker threads at once, so the data they read must
+// not change until OnProgress reports completion, or until the operation is
+// cancelled. Starting another sort or filter, SetRowCount() and destroying
+// the grid cancel the running operation, and return once the workers have
+// stopped calling the comparer and the filter.
+class VirtualGrid : public Widget {
+ public:
+  using CellProvider =
+      std::function<void(int row, int column, std::wstring &text)>;
+  // Whether the lhs model row goes before the rhs one.
+  using RowComparer = std::function<bool(int lhs, int rhs)>;
+  // Whether the model row is shown.
+  using RowFilter = std::function<bool(int row)>;
+
+  VirtualGrid(Widget *parent, POINT pos, SIZE size,
+              CellProvider provider = nullptr);
+  ~VirtualGrid() override;
+
+  void AddColumn(const std::wstring &title, int width);
+  int GetColumnCount() const { return static_cast<int>(columns_.size()); }
+
+  void SetCellProvider(CellProvider provider);
+  // Set the number of the model rows. They are shown in the model order, the
+  // sort order and the filter are dropped.
+  void SetRowCount(int count);
+  void RefreshRows();
+
+  // Sort the shown rows in the background. Equal rows keep the model order.
+  // A null comparer restores the model order.
+  void Sort(RowComparer less);
+  // Show only the rows accepted by the filter, which is applied in the
+  // background. A null filter shows all the rows.
+  void Filter(RowFilter filter);
+  // Whether a sort or a filter is running.
+  bool IsBusy() const { return operation_ != nullptr; }
+
+  // Number of the rows shown.
+  int GetCount() const;
+  // Model row shown at the given position.
+  int GetModelRow(int position) const;
+  // Model row of the selected line, or -1 if there is none.
+  int GetSelectedRow();
+
+  // Progress of the running sort or filter, from 0 to 1. It's activated with
+  // 1 when the new order is shown.
+  EventHandler<void(double progress)> OnProgress;
+  // The rows shown at positions from..to (inclusive) are about to be painted.
+  EventHandler<void(int from, int to)> OnCacheHint;
+  EventHandler<void(int column)> OnColumnClick;
+
+ protected:
+  bool HandleNotify(WPARAM wParam, LPARAM lParam, LRESULT &result);
+
+  void OnRealize() override;
+
+  MessageMapView GetMessageMap() const override { return kMessageMap; }
+
+  static constexpr auto kMessageMap = ExtendMessageMap(
+      Widget::kMessageMap,
+      {{WM_NOTIFY,
+        &MessageHandlerOf<VirtualGrid, &VirtualGrid::HandleNotify>}});
+
+ private:
+  struct Column {
+    std::wstring title;
+    int width;
+  };
+
+  // State of a sort or a filter, shared with the worker threads.
+  struct Operation;
+
+  WidgetCreationOptions GetCreationOptions();
+  void InsertColumn(int index);
+  void FillCell(LVITEMW &item);
+
+  void StartOperation();
+  void CancelOperation();
+  void FinishOperation(Operation &operation);
+  // Update the list view after the order has changed, keeping the selected
+  // model row selected.
+  void ShowRows(int selectedRow);
+
+  static void RunOperation(const std::shared_ptr<Operation> &operation);
+  // Build the rows of the operation. Throws OperationCancelled when it's
+  // cancelled.
+  static void BuildRows(const std::shared_ptr<Operation> &operation);
+  static void CompleteStep(const std::shared_ptr<Operation> &operation);
+
+  std::vector<Column> columns_;
+  CellProvider provider_;
+  std::wstring cellText_;
+  RowComparer less_;
+  RowFilter filter_;
+  int rowCount_;
+  // Whether all the rows are shown in the model order. Otherwise, rows_ has
+  // the model rows in the order they are shown.
+  bool modelOrder_;
+  std::vector<int> rows_;
+  std::shared_ptr<Operation> operation_;
+};
+
+#endif  // GRID_H_INCLUDED
@@ -0,0 +1,2302 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "headless.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Windows, device contexts and GDI objects are only used from the UI thread,
+// as in Win32 API. The message queue and the kernel objects may be used from
+// any thread and are guarded by g_mutex.
+
+using Clock = std::chrono::steady_clock;
+
+struct CallCounters {
+  std::atomic<size_t> createWindow{0};
+  std::atomic<size_t> destroyWindow{0};
+  std::atomic<size_t> sendMessage{0};
+  std::atomic<size_t> postMessage{0};
+  std::atomic<size_t> moveWindow{0};
+  std::atomic<size_t> deferWindowPos{0};
+  std::atomic<size_t> invalidate{0};
+  std::atomic<size_t> windowText{0};
+  std::atomic<size_t> total{0};
+};
+
+static CallCounters g_calls;
+
+static void CountCall(std::atomic<size_t> *kind = nullptr) {
+  g_calls.total.fetch_add(1, std::memory_order_relaxed);
+  if (kind != nullptr) {
+    kind->fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// Metrics of the only font, which is monospaced except for wide characters.
+static const LONG kFontHeight = 16;
+static const LONG kFontAscent = 13;
+static const LONG kCharWidth = 7;
+
+static DWORD TickCount() {
+  return static_cast<DWORD>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          Clock::now().time_since_epoch())
+          .count());
+}
+
+static LONG CharWidth(UINT c) {
+  bool wide = (c >= 0x2E80 && c < 0xD800) || (c >= 0xF900 && c < 0xFB00) ||
+              (c >= 0xFF00 && c < 0xFF61) || c >= 0x20000;
+  return wide ? 2 * kCharWidth : kCharWidth;
+}
+
+enum class GdiKind { Font, Brush, Bitmap };
+
+// All GDI objects have the same type, and handles point to it.
+struct GdiObject {
+  GdiKind kind;
+  bool stock;
+  // Brush color.
+  COLORREF color;
+  // Bitmap size and pixels, as 0x00RRGGBB.
+  LONG width;
+  LONG height;
+  bool bottomUp;
+  std::vector<uint32_t> pixels;
+};
+
+static GdiObject *MakeStockObject(GdiKind kind, COLORREF color = 0) {
+  return new GdiObject{kind, true, color, 1, 1, false, {}};
+}
+
+struct DeviceContext {
+  struct State {
+    GdiObject *font;
+    GdiObject *brush;
+    GdiObject *bitmap;
+    COLORREF textColor;
+    COLORREF bkColor;
+    int bkMode;
+    RECT clip;
+  };
+
+  HWND window;
+  State state;
+  std::vector<State> saved;
+};
+
+template <typename Handle>
+static GdiObject *ToObject(Handle handle) {
+  return static_cast<GdiObject *>(static_cast<void *>(handle));
+}
+
+template <typename Handle>
+static Handle FromObject(GdiObject *object) {
+  return reinterpret_cast<Handle>(object);
+}
+
+static DeviceContext *ToContext(HDC dc) {
+  return reinterpret_cast<DeviceContext *>(dc);
+}
+
+static HDC FromContext(DeviceContext *context) {
+  return reinterpret_cast<HDC>(context);
+}
+
+static RECT Intersect(const RECT &a, const RECT &b) {
+  RECT res = {std::max(a.left, b.left), std::max(a.top, b.top),
+              std::min(a.right, b.right), std::min(a.bottom, b.bottom)};
+  if (IsRectEmpty(&res)) {
+    res = {0, 0, 0, 0};
+  }
+  return res;
+}
+
+static RECT Union(const RECT &a, const RECT &b) {
+  if (IsRectEmpty(&a)) {
+    return b;
+  }
+  if (IsRectEmpty(&b)) {
+    return a;
+  }
+  return {std::min(a.left, b.left), std::min(a.top, b.top),
+          std::max(a.right, b.right), std::max(a.bottom, b.bottom)};
+}
+
+static const LONG kUnclipped = 1 << 30;
+
+struct WindowClass {
+  std::wstring name;
+  WNDPROC proc;
+  HBRUSH background;
+};
+
+struct ListBoxState {
+  std::vector<std::wstring> items;
+  // Number of items of LBS_NODATA list boxes.
+  int count = 0;
+  int selected = LB_ERR;
+  int top = 0;
+  int itemHeight = kFontHeight;
+};
+
+// List views only support the owner-data report mode: the items are asked
+// from the parent with LVN_GETDISPINFOW when painted.
+struct ListViewState {
+  std::vector<int> columnWidths;
+  int count = 0;
+  int selected = -1;
+  int top = 0;
+  DWORD extendedStyle = 0;
+  // The last range announced with LVN_ODCACHEHINT.
+  int cacheFrom = -1;
+  int cacheTo = -1;
+};
+
+struct EditState {
+  size_t selStart = 0;
+  size_t selEnd = 0;
+  size_t limit = 30000;
+  int firstLine = 0;
+  // Number of lines, or -1 if it has to be counted again.
+  int lineCount = -1;
+};
+
+struct HWND__ {
+  const WindowClass *wndClass;
+  WNDPROC proc;
+  HWND parent;
+  std::vector<HWND> children;
+  DWORD style;
+  DWORD exStyle;
+  LONG_PTR id;
+  LONG_PTR userData;
+  // Relative to the client area of the parent, or the screen.
+  RECT rect;
+  std::wstring text;
+  HFONT font;
+  bool redraw;
+  bool erase;
+  RECT update;
+  ListBoxState listBox;
+  ListViewState listView;
+  EditState edit;
+};
+
+static std::unordered_set<HWND> g_windows;
+// Windows with non-empty update region, which get WM_PAINT.
+static std::unordered_set<HWND> g_dirtyWindows;
+
+struct PostedState {
+  std::deque<MSG> messages;
+  bool quit = false;
+  int exitCode = 0;
+};
+
+enum class ObjectKind { Event, Timer };
+
+struct KernelObject {
+  ObjectKind kind;
+  bool manualReset;
+  bool signaled;
+  // Timers only.
+  bool armed;
+  Clock::time_point due;
+  Clock::duration period;
+};
+
+struct WindowTimer {
+  HWND hWnd;
+  UINT_PTR id;
+  Clock::duration period;
+  Clock::time_point due;
+};
+
+static std::mutex g_mutex;
+// Notified when a message is posted or a kernel object changes.
+static std::condition_variable g_condition;
+static PostedState g_posted;
+static std::unordered_set<KernelObject *> g_objects;
+static std::vector<WindowTimer> g_windowTimers;
+
+ApiCallCounts operator-(const ApiCallCounts &lhs, const ApiCallCounts &rhs) {
+  ApiCallCounts res;
+  res.createWindow = lhs.createWindow - rhs.createWindow;
+  res.destroyWindow = lhs.destroyWindow - rhs.destroyWindow;
+  res.sendMessage = lhs.sendMessage - rhs.sendMessage;
+  res.postMessage = lhs.postMessage - rhs.postMessage;
+  res.moveWindow = lhs.moveWindow - rhs.moveWindow;
+  res.deferWindowPos = lhs.deferWindowPos - rhs.deferWindowPos;
+  res.invalidate = lhs.invalidate - rhs.invalidate;
+  res.windowText = lhs.windowText - rhs.windowText;
+  res.total = lhs.total - rhs.total;
+  return res;
+}
+
+ApiCallCounts GetApiCallCounts() {
+  ApiCallCounts res;
+  res.createWindow = g_calls.createWindow;
+  res.destroyWindow = g_calls.destroyWindow;
+  res.sendMessage = g_calls.sendMessage;
+  res.postMessage = g_calls.postMessage;
+  res.moveWindow = g_calls.moveWindow;
+  res.deferWindowPos = g_calls.deferWindowPos;
+  res.invalidate = g_calls.invalidate;
+  res.windowText = g_calls.windowText;
+  res.total = g_calls.total;
+  return res;
+}
+
+void ResetApiCallCounts() {
+  for (std::atomic<size_t> *counter :
+       {&g_calls.createWindow, &g_calls.destroyWindow, &g_calls.sendMessage,
+        &g_calls.postMessage, &g_calls.moveWindow, &g_calls.deferWindowPos,
+        &g_calls.invalidate, &g_calls.windowText, &g_calls.total}) {
+    *counter = 0;
+  }
+}
+
+static bool IsValidWindow(HWND hWnd) {
+  return hWnd != nullptr && g_windows.count(hWnd) != 0;
+}
+
+// Delivers a message without counting it as an API call.
+static LRESULT Deliver(HWND hWnd, UINT message, WPARAM wParam,
+                       LPARAM lParam) {
+  WNDPROC proc = hWnd->proc != nullptr ? hWnd->proc : DefWindowProcW;
+  return proc(hWnd, message, wParam, lParam);
+}
+
+static bool IsShown(HWND hWnd) {
+  for (; hWnd != nullptr; hWnd = hWnd->parent) {
+    if (!(hWnd->style & WS_VISIBLE)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static RECT ClientRect(HWND hWnd) {
+  return {0, 0, hWnd->rect.right - hWnd->rect.left,
+          hWnd->rect.bottom - hWnd->rect.top};
+}
+
+static POINT ScreenOrigin(HWND hWnd) {
+  POINT res = {0, 0};
+  for (; hWnd != nullptr; hWnd = hWnd->parent) {
+    res.x += hWnd->rect.left;
+    res.y += hWnd->rect.top;
+  }
+  return res;
+}
+
+static void Invalidate(HWND hWnd, const RECT *rect, bool erase) {
+  if (!hWnd->redraw || !IsShown(hWnd)) {
+    return;
+  }
+  RECT client = ClientRect(hWnd);
+  RECT area = rect != nullptr ? Intersect(*rect, client) : client;
+  if (IsRectEmpty(&area)) {
+    return;
+  }
+  hWnd->update = Union(hWnd->update, area);
+  hWnd->erase = hWnd->erase || erase;
+  g_dirtyWindows.insert(hWnd);
+}
+
+static void InvalidateTree(HWND hWnd) {
+  Invalidate(hWnd, nullptr, true);
+  for (HWND child : hWnd->children) {
+    InvalidateTree(child);
+  }
+}
+
+static void Validate(HWND hWnd) {
+  hWnd->update = {0, 0, 0, 0};
+  hWnd->erase = false;
+  g_dirtyWindows.erase(hWnd);
+}
+
+static void PaintNow(HWND hWnd, bool children) {
+  if (!IsRectEmpty(&hWnd->update)) {
+    Deliver(hWnd, WM_PAINT, 0, 0);
+  }
+  if (children) {
+    std::vector<HWND> list = hWnd->children;
+    for (HWND child : list) {
+      if (IsValidWindow(child)) {
+        PaintNow(child, true);
+      }
+    }
+  }
+}
+
+static void SetGeometry(HWND hWnd, int x, int y, int width, int height,
+                        UINT flags) {
+  RECT old = hWnd->rect;
+  LONG oldWidth = old.right - old.left;
+  LONG oldHeight = old.bottom - old.top;
+  if (flags & SWP_NOMOVE) {
+    x = old.left;
+    y = old.top;
+  }
+  if (flags & SWP_NOSIZE) {
+    width = oldWidth;
+    height = oldHeight;
+  }
+  width = std::max(width, 0);
+  height = std::max(height, 0);
+  hWnd->rect = {x, y, x + width, y + height};
+  bool moved = x != old.left || y != old.top;
+  bool resized = width != oldWidth || height != oldHeight;
+  if (resized && !(flags & SWP_NOREDRAW)) {
+    // Without CS_HREDRAW and CS_VREDRAW only the exposed area is repainted.
+    RECT right = {oldWidth, 0, width, height};
+    RECT bottom = {0, oldHeight, width, height};
+    RECT exposed = Union(IsRectEmpty(&right) ? RECT{0, 0, 0, 0} : right,
+                         IsRectEmpty(&bottom) ? RECT{0, 0, 0, 0} : bottom);
+    Invalidate(hWnd, &exposed, true);
+  }
+  if (moved) {
+    Deliver(hWnd, WM_MOVE, 0, MAKELPARAM(x, y));
+  }
+  if (resized) {
+    Deliver(hWnd, WM_SIZE, 0, MAKELPARAM(width, height));
+  }
+}
+
+static void Show(HWND hWnd, bool show) {
+  bool visible = (hWnd->style & WS_VISIBLE) != 0;
+  if (visible == show) {
+    return;
+  }
+  if (show) {
+    hWnd->style |= WS_VISIBLE;
+  } else {
+    hWnd->style &= ~WS_VISIBLE;
+  }
+  Deliver(hWnd, WM_SHOWWINDOW, show, 0);
+  if (show) {
+    InvalidateTree(hWnd);
+  } else if (hWnd->parent != nullptr) {
+    Invalidate(hWnd->parent, &hWnd->rect, true);
+  }
+}
+
+static void DestroyTree(HWND hWnd) {
+  Deliver(hWnd, WM_DESTROY, 0, 0);
+  // The handlers may destroy some children themselves.
+  std::vector<HWND> children = hWnd->children;
+  for (HWND child : children) {
+    if (IsValidWindow(child)) {
+      DestroyTree(child);
+    }
+  }
+  Deliver(hWnd, WM_NCDESTROY, 0, 0);
+  if (hWnd->parent != nullptr) {
+    std::vector<HWND> &siblings = hWnd->parent->children;
+    siblings.erase(std::find(siblings.begin(), siblings.end(), hWnd));
+  }
+  g_windows.erase(hWnd);
+  g_dirtyWindows.erase(hWnd);
+  {
+    // Messages posted to the window and its timers are dropped.
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::deque<MSG> &messages = g_posted.messages;
+    messages.erase(std::remove_if(messages.begin(), messages.end(),
+                                  [hWnd](const MSG &msg) {
+                                    return msg.hwnd == hWnd;
+                                  }),
+                   messages.end());
+    g_windowTimers.erase(
+        std::remove_if(g_windowTimers.begin(), g_windowTimers.end(),
+                       [hWnd](const WindowTimer &timer) {
+                         return timer.hWnd == hWnd;
+                       }),
+        g_windowTimers.end());
+  }
+  delete hWnd;
+}
+
+static COLORREF SysColor(int index);
+static GdiObject *SysColorBrush(int index);
+static HDC StartPaint(HWND hWnd, PAINTSTRUCT *paint);
+static int FillWithBrush(HDC dc, const RECT *rect, HBRUSH brush);
+
+// Built-in control classes.
+
+static LRESULT ControlProc(HWND hWnd, UINT message, WPARAM wParam,
+                           LPARAM lParam) {
+  switch (message) {
+    case WM_SETFONT: {
+      hWnd->font = reinterpret_cast<HFONT>(wParam);
+      if (LOWORD(lParam)) {
+        Invalidate(hWnd, nullptr, true);
+      }
+      return 0;
+    }
+    case WM_GETFONT: {
+      return reinterpret_cast<LRESULT>(hWnd->font);
+    }
+    case WM_SETTEXT: {
+      LRESULT res = DefWindowProcW(hWnd, message, wParam, lParam);
+      Invalidate(hWnd, nullptr, true);
+      return res;
+    }
+  }
+  return DefWindowProcW(hWnd, message, wParam, lParam);
+}
+
+static LRESULT CALLBACK StaticProc(HWND hWnd, UINT message, WPARAM wParam,
+                                   LPARAM lParam) {
+  return ControlProc(hWnd, message, wParam, lParam);
+}
+
+static LRESULT CALLBACK ButtonProc(HWND hWnd, UINT message, WPARAM wParam,
+                                   LPARAM lParam) {
+  if (message == BM_CLICK) {
+    if (hWnd->parent != nullptr && !(hWnd->style & WS_DISABLED)) {
+      Deliver(hWnd->parent, WM_COMMAND, MAKEWPARAM(hWnd->id, BN_CLICKED),
+              reinterpret_cast<LPARAM>(hWnd));
+    }
+    return 0;
+  }
+  return ControlProc(hWnd, message, wParam, lParam);
+}
+
+// Edit controls keep the text in the window title. Lines of multiline
+// controls are separated with "\r\n"; there is no word wrapping.
+
+static size_t LineStart(const std::wstring &text, size_t pos) {
+  size_t res = text.rfind(L'\n', pos == 0 ? 0 : pos - 1);
+  return res == std::wstring::npos || pos == 0 ? 0 : res + 1;
+}
+
+static size_t LineEnd(const std::wstring &text, size_t pos) {
+  size_t res = text.find(L'\n', pos);
+  if (res == std::wstring::npos) {
+    return text.size();
+  }
+  return res > 0 && text[res - 1] == L'\r' ? res - 1 : res;
+}
+
+static int LineFromChar(const std::wstring &text, size_t pos) {
+  pos = std::min(pos, text.size());
+  return static_cast<int>(std::count(text.begin(), text.begin() + pos, L'\n'));
+}
+
+// Real edit controls keep the line starts, so the line count is cached
+// too, and updated on replacing the selection.
+static int LineCount(HWND hWnd) {
+  EditState &edit = hWnd->edit;
+  if (edit.lineCount == -1) {
+    edit.lineCount = LineFromChar(hWnd->text, hWnd->text.size()) + 1;
+  }
+  return edit.lineCount;
+}
+
+static LRESULT CALLBACK EditProc(HWND hWnd, UINT message, WPARAM wParam,
+                                 LPARAM lParam) {
+  EditState &edit = hWnd->edit;
+  std::wstring &text = hWnd->text;
+  switch (message) {
+    case WM_SETTEXT: {
+      edit.selStart = edit.selEnd = 0;
+      edit.firstLine = 0;
+      edit.lineCount = -1;
+      break;
+    }
+    case EM_GETSEL: {
+      if (wParam != 0) {
+        *reinterpret_cast<DWORD *>(wParam) = static_cast<DWORD>(edit.selStart);
+      }
+      if (lParam != 0) {
+        *reinterpret_cast<DWORD *>(lParam) = static_cast<DWORD>(edit.selEnd);
+      }
+      return MAKELONG(std::min<size_t>(edit.selStart, 0xffff),
+                      std::min<size_t>(edit.selEnd, 0xffff));
+    }
+    case EM_SETSEL: {
+      intptr_t start = static_cast<intptr_t>(wParam);
+      intptr_t end = lParam;
+      if (start == -1) {
+        edit.selStart = edit.selEnd;
+        return 0;
+      }
+      size_t length = text.size();
+      size_t from = std::min(static_cast<size_t>(start), length);
+      size_t to = end < 0 ? length : std::min(static_cast<size_t>(end), length);
+      edit.selStart = std::min(from, to);
+      edit.selEnd = std::max(from, to);
+      return 0;
+    }
+    case EM_REPLACESEL: {
+      const wchar_t *str = reinterpret_cast<const wchar_t *>(lParam);
+      size_t length = std::wcslen(str);
+      size_t kept = text.size() - (edit.selEnd - edit.selStart);
+      length = std::min(length, edit.limit > kept ? edit.limit - kept : 0);
+      if (edit.lineCount != -1) {
+        edit.lineCount +=
+            static_cast<int>(std::count(str, str + length, L'\n') -
+                             std::count(text.begin() + edit.selStart,
+                                        text.begin() + edit.selEnd, L'\n'));
+      }
+      text.replace(edit.selStart, edit.selEnd - edit.selStart, str, length);
+      edit.selStart = edit.selEnd = edit.selStart + length;
+      Invalidate(hWnd, nullptr, true);
+      return 0;
+    }
+    case EM_SETLIMITTEXT: {
+      edit.limit = wParam == 0 ? 0x7FFFFFFE : wParam;
+      return 0;
+    }
+    case EM_GETLIMITTEXT: {
+      return static_cast<LRESULT>(edit.limit);
+    }
+    case EM_GETLINECOUNT: {
+      return LineCount(hWnd);
+    }
+    case EM_LINEINDEX: {
+      intptr_t line = static_cast<intptr_t>(wParam);
+      if (line < 0) {
+        return static_cast<LRESULT>(LineStart(text, edit.selEnd));
+      }
+      size_t pos = 0;
+      for (intptr_t i = 0; i < line; ++i) {
+        pos = text.find(L'\n', pos);
+        if (pos == std::wstring::npos) {
+          return -1;
+        }
+        ++pos;
+      }
+      return static_cast<LRESULT>(pos);
+    }
+    case EM_LINELENGTH: {
+      intptr_t index = static_cast<intptr_t>(wParam);
+      size_t pos = index < 0 ? edit.selEnd
+                             : std::min(static_cast<size_t>(index),
+                                        text.size());
+      return static_cast<LRESULT>(LineEnd(text, pos) - LineStart(text, pos));
+    }
+    case EM_LINEFROMCHAR: {
+      intptr_t index = static_cast<intptr_t>(wParam);
+      return LineFromChar(text, index < 0 ? edit.selEnd : index);
+    }
+    case EM_GETFIRSTVISIBLELINE: {
+      return edit.firstLine;
+    }
+    case EM_LINESCROLL: {
+      int lines = LineCount(hWnd);
+      edit.firstLine = std::max(
+          0, std::min(edit.firstLine + static_cast<int>(lParam), lines - 1));
+      Invalidate(hWnd, nullptr, true);
+      return TRUE;
+    }
+    case EM_SCROLLCARET: {
+      int line = LineFromChar(text, edit.selEnd);
+      int visible = std::max<LONG>(1, ClientRect(hWnd).bottom / kFontHeight);
+      if (line < edit.firstLine) {
+        edit.firstLine = line;
+      } else if (line >= edit.firstLine + visible) {
+        edit.firstLine = line - visible + 1;
+      }
+      return TRUE;
+    }
+    case EM_SETREADONLY: {
+      if (wParam) {
+        hWnd->style |= ES_READONLY;
+      } else {
+        hWnd->style &= ~ES_READONLY;
+      }
+      return TRUE;
+    }
+  }
+  return ControlProc(hWnd, message, wParam, lParam);
+}
+
+static int ListBoxCount(HWND hWnd) {
+  const ListBoxState &listBox = hWnd->listBox;
+  return (hWnd->style & LBS_NODATA) ? listBox.count
+                                    : static_cast<int>(listBox.items.size());
+}
+
+// Owner-drawn list boxes ask the parent to draw the visible items.
+static void PaintListBox(HWND hWnd) {
+  PAINTSTRUCT ps;
+  HDC dc = StartPaint(hWnd, &ps);
+  ListBoxState &listBox = hWnd->listBox;
+  int count = ListBoxCount(hWnd);
+  LONG height = ClientRect(hWnd).bottom;
+  LONG width = ClientRect(hWnd).right;
+  for (int i = listBox.top; i < count; ++i) {
+    LONG top = (i - listBox.top) * listBox.itemHeight;
+    if (top >= height) {
+      break;
+    }
+    DRAWITEMSTRUCT item = {};
+    item.CtlType = ODT_LISTBOX;
+    item.CtlID = static_cast<UINT>(hWnd->id);
+    item.itemID = i;
+    item.itemAction = ODA_DRAWENTIRE;
+    item.itemState = i == listBox.selected ? ODS_SELECTED : 0u;
+    item.hwndItem = hWnd;
+    item.hDC = dc;
+    item.rcItem = {0, top, width, top + listBox.itemHeight};
+    RECT visible = Intersect(item.rcItem, ps.rcPaint);
+    if (!IsRectEmpty(&visible) && hWnd->parent != nullptr) {
+      Deliver(hWnd->parent, WM_DRAWITEM, hWnd->id,
+              reinterpret_cast<LPARAM>(&item));
+    }
+  }
+  delete ToContext(dc);
+}
+
+static LRESULT CALLBACK ListBoxProc(HWND hWnd, UINT message, WPARAM wParam,
+                                    LPARAM lParam) {
+  ListBoxState &listBox = hWnd->listBox;
+  std::vector<std::wstring> &items = listBox.items;
+  bool noData = (hWnd->style & LBS_NODATA) != 0;
+  int count = ListBoxCount(hWnd);
+  int index = static_cast<int>(wParam);
+  switch (message) {
+    case LB_ADDSTRING: {
+      if (noData) {
+        return LB_ERR;
+      }
+      items.emplace_back(reinterpret_cast<const wchar_t *>(lParam));
+      Invalidate(hWnd, nullptr, true);
+      return count;
+    }
+    case LB_INSERTSTRING: {
+      if (noData || index > count) {
+        return LB_ERR;
+      }
+      if (index < 0) {
+        index = count;
+      }
+      items.emplace(items.begin() + index,
+                    reinterpret_cast<const wchar_t *>(lParam));
+      if (listBox.selected >= index) {
+        ++listBox.selected;
+      }
+      Invalidate(hWnd, nullptr, true);
+      return index;
+    }
+    case LB_DELETESTRING: {
+      if (noData || index < 0 || index >= count) {
+        return LB_ERR;
+      }
+      items.erase(items.begin() + index);
+      if (listBox.selected == index) {
+        listBox.selected = LB_ERR;
+      } else if (listBox.selected > index) {
+        --listBox.selected;
+      }
+      Invalidate(hWnd, nullptr, true);
+      return count - 1;
+    }
+    case LB_RESETCONTENT: {
+      items.clear();
+      listBox.count = 0;
+      listBox.selected = LB_ERR;
+      listBox.top = 0;
+      Invalidate(hWnd, nullptr, true);
+      return 0;
+    }
+    case LB_SETCURSEL: {
+      listBox.selected = index >= 0 && index < count ? index : LB_ERR;
+      Invalidate(hWnd, nullptr, true);
+      return index < count ? index : LB_ERR;
+    }
+    case LB_GETCURSEL: {
+      return listBox.selected;
+    }
+    case LB_GETTEXT:
+    case LB_GETTEXTLEN: {
+      if (noData || index < 0 || index >= count) {
+        return LB_ERR;
+      }
+      const std::wstring &item = items[index];
+      if (message == LB_GETTEXT) {
+        wchar_t *buffer = reinterpret_cast<wchar_t *>(lParam);
+        std::copy(item.begin(), item.end(), buffer);
+        buffer[item.size()] = 0;
+      }
+      return static_cast<LRESULT>(item.size());
+    }
+    case LB_GETCOUNT: {
+      return count;
+    }
+    case LB_SETCOUNT: {
+      if (!noData) {
+        return LB_ERR;
+      }
+      listBox.count = index;
+      if (listBox.selected >= index) {
+        listBox.selected = LB_ERR;
+      }
+      listBox.top = std::max(0, std::min(listBox.top, index - 1));
+      Invalidate(hWnd, nullptr, true);
+      return 0;
+    }
+    case LB_INITSTORAGE: {
+      if (!noData) {
+        items.reserve(items.size() + index);
+      }
+      return static_cast<LRESULT>(count + index);
+    }
+    case LB_SETITEMHEIGHT: {
+      if (LOWORD(lParam) == 0 || LOWORD(lParam) > 255) {
+        return LB_ERR;
+      }
+      listBox.itemHeight = LOWORD(lParam);
+      Invalidate(hWnd, nullptr, true);
+      return 0;
+    }
+    case LB_GETITEMHEIGHT: {
+      return listBox.itemHeight;
+    }
+    case LB_GETTOPINDEX: {
+      return listBox.top;
+    }
+    case LB_SETTOPINDEX: {
+      if (index < 0 || index >= std::max(count, 1)) {
+        return LB_ERR;
+      }
+      listBox.top = index;
+      Invalidate(hWnd, nullptr, true);
+      return 0;
+    }
+    case WM_PAINT: {
+      if (hWnd->style & LBS_OWNERDRAWFIXED) {
+        PaintListBox(hWnd);
+        return 0;
+      }
+      break;
+    }
+  }
+  return ControlProc(hWnd, message, wParam, lParam);
+}
+
+static const LONG kListViewHeaderHeight = kFontHeight + 4;
+static const LONG kListViewItemHeight = kFontHeight + 2;
+
+static int ListViewCountPerPage(HWND hWnd) {
+  LONG height = ClientRect(hWnd).bottom - kListViewHeaderHeight;
+  return std::max<LONG>(0, height) / kListViewItemHeight;
+}
+
+static RECT ListViewItemRect(HWND hWnd, int index) {
+  LONG top = kListViewHeaderHeight +
+             (index - hWnd->listView.top) * kListViewItemHeight;
+  return {0, top, ClientRect(hWnd).right, top + kListViewItemHeight};
+}
+
+static void SetListViewTop(HWND hWnd, int top) {
+  ListViewState &listView = hWnd->listView;
+  int maxTop = std::max(0, listView.count - ListViewCountPerPage(hWnd));
+  top = std::max(0, std::min(top, maxTop));
+  if (top != listView.top) {
+    listView.top = top;
+    Invalidate(hWnd, nullptr, true);
+  }
+}
+
+static LRESULT NotifyParent(HWND hWnd, NMHDR &header, UINT code) {
+  header.hwndFrom = hWnd;
+  header.idFrom = static_cast<UINT_PTR>(hWnd->id);
+  header.code = code;
+  if (hWnd->parent == nullptr) {
+    return 0;
+  }
+  return Deliver(hWnd->parent, WM_NOTIFY, hWnd->id,
+                 reinterpret_cast<LPARAM>(&header));
+}
+
+// The parent is told which items are about to be painted, then asked for the
+// text of each visible cell. The text itself isn't drawn.
+static void PaintListView(HWND hWnd) {
+  PAINTSTRUCT ps;
+  HDC dc = StartPaint(hWnd, &ps);
+  ListViewState &listView = hWnd->listView;
+  LONG rowsTop = std::max(ps.rcPaint.top, kListViewHeaderHeight);
+  int first = listView.top + (rowsTop - kListViewHeaderHeight) /
+                                 kListViewItemHeight;
+  int last = listView.top + (ps.rcPaint.bottom - kListViewHeaderHeight - 1) /
+                                kListViewItemHeight;
+  last = std::min(last, listView.count - 1);
+  if (ps.rcPaint.bottom > rowsTop && first <= last) {
+    if (first < listView.cacheFrom || last > listView.cacheTo) {
+      NMLVCACHEHINT hint = {};
+      hint.iFrom = first;
+      hint.iTo = last;
+      NotifyParent(hWnd, hint.hdr, LVN_ODCACHEHINT);
+      listView.cacheFrom = first;
+      listView.cacheTo = last;
+    }
+    wchar_t buffer[260];
+    for (int i = first; i <= last; ++i) {
+      if (i == listView.selected) {
+        RECT rect = Intersect(ListViewItemRect(hWnd, i), ps.rcPaint);
+        FillWithBrush(dc, &rect,
+                      FromObject<HBRUSH>(SysColorBrush(COLOR_HIGHLIGHT)));
+      }
+      for (size_t column = 0; column < listView.columnWidths.size();
+           ++column) {
+        NMLVDISPINFOW info = {};
+        info.item.mask = LVIF_TEXT;
+        info.item.iItem = i;
+        info.item.iSubItem = static_cast<int>(column);
+        info.item.pszText = buffer;
+        info.item.cchTextMax = static_cast<int>(std::size(buffer));
+        buffer[0] = 0;
+        NotifyParent(hWnd, info.hdr, LVN_GETDISPINFOW);
+      }
+    }
+  }
+  delete ToContext(dc);
+}
+
+static LRESULT CALLBACK ListViewProc(HWND hWnd, UINT message, WPARAM wParam,
+                                     LPARAM lParam) {
+  ListViewState &listView = hWnd->listView;
+  int index = static_cast<int>(wParam);
+  switch (message) {
+    case LVM_INSERTCOLUMNW: {
+      const LVCOLUMNW *column = reinterpret_cast<const LVCOLUMNW *>(lParam);
+      std::vector<int> &widths = listView.columnWidths;
+      index = std::max(0, std::min(index, static_cast<int>(widths.size())));
+      widths.insert(widths.begin() + index,
+                    (column->mask & LVCF_WIDTH) ? column->cx : 50);
+      Invalidate(hWnd, nullptr, true);
+      return index;
+    }
+    case LVM_DELETECOLUMN: {
+      std::vector<int> &widths = listView.columnWidths;
+      if (index < 0 || index >= static_cast<int>(widths.size())) {
+        return FALSE;
+      }
+      widths.erase(widths.begin() + index);
+      Invalidate(hWnd, nullptr, true);
+      return TRUE;
+    }
+    case LVM_SETEXTENDEDLISTVIEWSTYLE: {
+      DWORD old = listView.extendedStyle;
+      DWORD mask = wParam == 0 ? 0xFFFFFFFF : static_cast<DWORD>(wParam);
+      listView.extendedStyle =
+          (old & ~mask) | (static_cast<DWORD>(lParam) & mask);
+      return old;
+    }
+    case LVM_SETITEMCOUNT: {
+      if (!(hWnd->style & LVS_OWNERDATA) || index < 0) {
+        return FALSE;
+      }
+      listView.count = index;
+      if (listView.selected >= index) {
+        listView.selected = -1;
+      }
+      listView.cacheFrom = listView.cacheTo = -1;
+      if (!(lParam & LVSICF_NOSCROLL)) {
+        listView.top = 0;
+      }
+      SetListViewTop(hWnd, listView.top);
+      Invalidate(hWnd, nullptr, true);
+      return TRUE;
+    }
+    case LVM_GETITEMCOUNT: {
+      return listView.count;
+    }
+    case LVM_GETNEXTITEM: {
+      UINT flags = static_cast<UINT>(lParam);
+      if (flags & (LVNI_SELECTED | LVNI_FOCUSED)) {
+        return listView.selected > index ? listView.selected : -1;
+      }
+      return index + 1 < listView.count ? index + 1 : -1;
+    }
+    case LVM_SETITEMSTATE: {
+      const LVITEMW *item = reinterpret_cast<const LVITEMW *>(lParam);
+      if (!(item->stateMask & LVIS_SELECTED) || index >= listView.count) {
+        return TRUE;
+      }
+      int old = listView.selected;
+      if (item->state & LVIS_SELECTED) {
+        listView.selected = index;
+      } else if (index == -1 || index == listView.selected) {
+        listView.selected = -1;
+      }
+      if (old != listView.selected) {
+        Invalidate(hWnd, nullptr, true);
+        NMLISTVIEW change = {};
+        change.iItem = listView.selected;
+        change.uNewState = LVIS_SELECTED;
+        change.uChanged = LVIF_STATE;
+        NotifyParent(hWnd, change.hdr, LVN_ITEMCHANGED);
+      }
+      return TRUE;
+    }
+    case LVM_ENSUREVISIBLE: {
+      if (index < 0 || index >= listView.count) {
+        return FALSE;
+      }
+      int perPage = std::max(1, ListViewCountPerPage(hWnd));
+      if (index < listView.top) {
+        SetListViewTop(hWnd, index);
+      } else if (index >= listView.top + perPage) {
+        SetListViewTop(hWnd, index - perPage + 1);
+      }
+      return TRUE;
+    }
+    case LVM_SCROLL: {
+      SetListViewTop(hWnd, listView.top +
+                               static_cast<int>(lParam) / kListViewItemHeight);
+      return TRUE;
+    }
+    case LVM_REDRAWITEMS: {
+      int last = static_cast<int>(lParam);
+      for (int i = std::max(index, listView.top); i <= last; ++i) {
+        RECT rect = ListViewItemRect(hWnd, i);
+        if (rect.top >= ClientRect(hWnd).bottom) {
+          break;
+        }
+        Invalidate(hWnd, &rect, true);
+      }
+      return TRUE;
+    }
+    case LVM_GETTOPINDEX: {
+      return listView.top;
+    }
+    case LVM_GETCOUNTPERPAGE: {
+      return ListViewCountPerPage(hWnd);
+    }
+    case WM_LBUTTONDOWN: {
+      LONG x = static_cast<int16_t>(LOWORD(lParam));
+      LONG y = static_cast<int16_t>(HIWORD(lParam));
+      if (y < kListViewHeaderHeight) {
+        // A click on the header.
+        const std::vector<int> &widths = listView.columnWidths;
+        LONG left = 0;
+        for (size_t column = 0; column < widths.size(); ++column) {
+          if (x >= left && x < left + widths[column]) {
+            NMLISTVIEW click = {};
+            click.iItem = -1;
+            click.iSubItem = static_cast<int>(column);
+            NotifyParent(hWnd, click.hdr, LVN_COLUMNCLICK);
+            break;
+          }
+          left += widths[column];
+        }
+        return 0;
+      }
+      int item = listView.top + (y - kListViewHeaderHeight) /
+                                    kListViewItemHeight;
+      if (item < listView.count) {
+        LVITEMW state = {};
+        state.state = state.stateMask = LVIS_SELECTED;
+        ListViewProc(hWnd, LVM_SETITEMSTATE, item,
+                     reinterpret_cast<LPARAM>(&state));
+      }
+      return 0;
+    }
+    case WM_PAINT: {
+      PaintListView(hWnd);
+      return 0;
+    }
+  }
+  return ControlProc(hWnd, message, wParam, lParam);
+}
+
+static std::vector<std::unique_ptr<WindowClass>> &WindowClasses() {
+  static std::vector<std::unique_ptr<WindowClass>> classes = []() {
+    std::vector<std::unique_ptr<WindowClass>> res;
+    res.emplace_back(new WindowClass{L"Static", StaticProc, nullptr});
+    res.emplace_back(new WindowClass{L"Button", ButtonProc, nullptr});
+    res.emplace_back(new WindowClass{L"Edit", EditProc, nullptr});
+    res.emplace_back(new WindowClass{L"ListBox", ListBoxProc, nullptr});
+    res.emplace_back(
+        new WindowClass{WC_LISTVIEWW, ListViewProc, nullptr});
+    return res;
+  }();
+  return classes;
+}
+
+// Class names are case-insensitive.
+static const WindowClass *FindWindowClass(LPCWSTR name) {
+  for (const std::unique_ptr<WindowClass> &wndClass : WindowClasses()) {
+    const std::wstring &other = wndClass->name;
+    size_t length = std::wcslen(name);
+    if (length == other.size() &&
+        std::equal(other.begin(), other.end(), name,
+                   [](wchar_t a, wchar_t b) {
+                     return std::towlower(a) == std::towlower(b);
+                   })) {
+      return wndClass.get();
+    }
+  }
+  return nullptr;
+}
+
+ATOM RegisterClassExW(const WNDCLASSEXW *wndClass) {
+  CountCall();
+  if (wndClass == nullptr || wndClass->lpszClassName == nullptr ||
+      FindWindowClass(wndClass->lpszClassName) != nullptr) {
+    return 0;
+  }
+  std::vector<std::unique_ptr<WindowClass>> &classes = WindowClasses();
+  classes.emplace_back(new WindowClass{
+      wndClass->lpszClassName, wndClass->lpfnWndProc,
+      wndClass->hbrBackground});
+  return static_cast<ATOM>(0xC000 + classes.size());
+}
+
+HWND CreateWindowExW(DWORD exStyle, LPCWSTR className, LPCWSTR windowName,
+                     DWORD style, int x, int y, int width, int height,
+                     HWND parent, HMENU menu, HINSTANCE, LPVOID) {
+  CountCall(&g_calls.createWindow);
+  const WindowClass *wndClass = FindWindowClass(className);
+  if (wndClass == nullptr) {
+    return nullptr;
+  }
+  // Message-only windows don't have a parent in this backend.
+  if (parent == HWND_MESSAGE) {
+    parent = nullptr;
+  } else if (parent != nullptr && !IsValidWindow(parent)) {
+    return nullptr;
+  }
+  if ((style & WS_CHILD) && parent == nullptr) {
+    return nullptr;
+  }
+  HWND hWnd = new HWND__();
+  hWnd->wndClass = wndClass;
+  hWnd->proc = wndClass->proc;
+  hWnd->parent = parent;
+  hWnd->style = style;
+  hWnd->exStyle = exStyle;
+  hWnd->id = (style & WS_CHILD) ? reinterpret_cast<LONG_PTR>(menu) : 0;
+  hWnd->userData = 0;
+  hWnd->rect = {x, y, x + std::max(width, 0), y + std::max(height, 0)};
+  hWnd->text = windowName != nullptr ? windowName : L"";
+  hWnd->font = nullptr;
+  hWnd->redraw = true;
+  hWnd->erase = false;
+  hWnd->update = {0, 0, 0, 0};
+  g_windows.insert(hWnd);
+  if (parent != nullptr) {
+    parent->children.push_back(hWnd);
+  }
+  if (!Deliver(hWnd, WM_NCCREATE, 0, 0) ||
+      Deliver(hWnd, WM_CREATE, 0, 0) == -1) {
+    DestroyTree(hWnd);
+    return nullptr;
+  }
+  Deliver(hWnd, WM_SIZE, 0, MAKELPARAM(width, height));
+  Deliver(hWnd, WM_MOVE, 0, MAKELPARAM(x, y));
+  if (style & WS_VISIBLE) {
+    Deliver(hWnd, WM_SHOWWINDOW, TRUE, 0);
+    Invalidate(hWnd, nullptr, true);
+  }
+  return hWnd;
+}
+
+BOOL DestroyWindow(HWND hWnd) {
+  CountCall(&g_calls.destroyWindow);
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  HWND parent = hWnd->parent;
+  RECT rect = hWnd->rect;
+  bool shown = IsShown(hWnd);
+  DestroyTree(hWnd);
+  if (parent != nullptr && shown) {
+    Invalidate(parent, &rect, true);
+  }
+  return TRUE;
+}
+
+BOOL IsWindow(HWND hWnd) {
+  CountCall();
+  return IsValidWindow(hWnd);
+}
+
+HWND GetParent(HWND hWnd) {
+  CountCall();
+  return IsValidWindow(hWnd) ? hWnd->parent : nullptr;
+}
+
+HWND GetDesktopWindow() {
+  CountCall();
+  static HWND desktop = []() {
+    HWND hWnd = new HWND__();
+    hWnd->style = WS_VISIBLE;
+    hWnd->rect = {0, 0, 1920, 1080};
+    hWnd->redraw = false;
+    g_windows.insert(hWnd);
+    return hWnd;
+  }();
+  return desktop;
+}
+
+HWND GetActiveWindow() {
+  CountCall();
+  return nullptr;
+}
+
+LRESULT DefWindowProcW(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
+  switch (message) {
+    case WM_NCCREATE: {
+      return TRUE;
+    }
+    case WM_SETTEXT: {
+      const wchar_t *text = reinterpret_cast<const wchar_t *>(lParam);
+      hWnd->text = text != nullptr ? text : L"";
+      return TRUE;
+    }
+    case WM_GETTEXT: {
+      if (wParam == 0) {
+        return 0;
+      }
+      wchar_t *buffer = reinterpret_cast<wchar_t *>(lParam);
+      size_t length = std::min(hWnd->text.size(), wParam - 1);
+      std::copy_n(hWnd->text.data(), length, buffer);
+      buffer[length] = 0;
+      return static_cast<LRESULT>(length);
+    }
+    case WM_GETTEXTLENGTH: {
+      return static_cast<LRESULT>(hWnd->text.size());
+    }
+    case WM_SETREDRAW: {
+      hWnd->redraw = wParam != 0;
+      return 0;
+    }
+    case WM_PAINT: {
+      PAINTSTRUCT ps;
+      delete ToContext(StartPaint(hWnd, &ps));
+      return 0;
+    }
+    case WM_ERASEBKGND: {
+      HBRUSH brush =
+          hWnd->wndClass != nullptr ? hWnd->wndClass->background : nullptr;
+      if (brush == nullptr) {
+        return 0;
+      }
+      RECT client = ClientRect(hWnd);
+      FillWithBrush(reinterpret_cast<HDC>(wParam), &client, brush);
+      return 1;
+    }
+    case WM_CLOSE: {
+      DestroyWindow(hWnd);
+      return 0;
+    }
+  }
+  return 0;
+}
+
+LRESULT CallWindowProcW(WNDPROC proc, HWND hWnd, UINT message, WPARAM wParam,
+                        LPARAM lParam) {
+  CountCall();
+  return proc != nullptr ? proc(hWnd, message, wParam, lParam) : 0;
+}
+
+LRESULT SendMessageW(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
+  CountCall(&g_calls.sendMessage);
+  if (!IsValidWindow(hWnd)) {
+    return 0;
+  }
+  return Deliver(hWnd, message, wParam, lParam);
+}
+
+BOOL PostMessageW(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
+  CountCall(&g_calls.postMessage);
+  MSG msg = {hWnd, message, wParam, lParam, TickCount(), {0, 0}};
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_posted.messages.push_back(msg);
+  }
+  g_condition.notify_all();
+  return TRUE;
+}
+
+void PostQuitMessage(int exitCode) {
+  CountCall();
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_posted.quit = true;
+    g_posted.exitCode = exitCode;
+  }
+  g_condition.notify_all();
+}
+
+static bool MatchesFilter(const MSG &msg, HWND hWnd, UINT filterMin,
+                          UINT filterMax) {
+  if (hWnd != nullptr && msg.hwnd != hWnd) {
+    return false;
+  }
+  return (filterMin == 0 && filterMax == 0) ||
+         (msg.message >= filterMin && msg.message <= filterMax);
+}
+
+// Posted messages come first, then WM_QUIT, then WM_PAINT, then WM_TIMER, as
+// in Win32 API.
+static bool TakeMessage(MSG *msg, HWND hWnd, UINT filterMin, UINT filterMax,
+                        bool remove) {
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::deque<MSG> &messages = g_posted.messages;
+    for (auto iter = messages.begin(); iter != messages.end(); ++iter) {
+      if (MatchesFilter(*iter, hWnd, filterMin, filterMax)) {
+        *msg = *iter;
+        if (remove) {
+          messages.erase(iter);
+        }
+        return true;
+      }
+    }
+    MSG quit = {nullptr, WM_QUIT, static_cast<WPARAM>(g_posted.exitCode), 0,
+                TickCount(), {0, 0}};
+    if (g_posted.quit && MatchesFilter(quit, nullptr, filterMin, filterMax)) {
+      *msg = quit;
+      if (remove) {
+        g_posted.quit = false;
+      }
+      return true;
+    }
+  }
+  for (HWND dirty : g_dirtyWindows) {
+    MSG paint = {dirty, WM_PAINT, 0, 0, TickCount(), {0, 0}};
+    if (MatchesFilter(paint, hWnd, filterMin, filterMax)) {
+      // WM_PAINT stays in the queue until the window is validated.
+      *msg = paint;
+      return true;
+    }
+  }
+  std::lock_guard<std::mutex> lock(g_mutex);
+  Clock::time_point now = Clock::now();
+  for (WindowTimer &timer : g_windowTimers) {
+    MSG tick = {timer.hWnd, WM_TIMER, timer.id, 0, TickCount(), {0, 0}};
+    if (timer.due <= now && MatchesFilter(tick, hWnd, filterMin, filterMax)) {
+      *msg = tick;
+      if (remove) {
+        timer.due = now + timer.period;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Called with g_mutex locked, like HasInput().
+static Clock::time_point NextWindowTimer() {
+  Clock::time_point due = Clock::time_point::max();
+  for (const WindowTimer &timer : g_windowTimers) {
+    due = std::min(due, timer.due);
+  }
+  return due;
+}
+
+// Called with g_mutex locked.
+static bool HasInput() {
+  return !g_posted.messages.empty() || g_posted.quit ||
+         !g_dirtyWindows.empty() || NextWindowTimer() <= Clock::now();
+}
+
+BOOL PeekMessageW(MSG *msg, HWND hWnd, UINT filterMin, UINT filterMax,
+                  UINT removeMsg) {
+  CountCall();
+  return TakeMessage(msg, hWnd, filterMin, filterMax, removeMsg & PM_REMOVE);
+}
+
+BOOL GetMessageW(MSG *msg, HWND hWnd, UINT filterMin, UINT filterMax) {
+  CountCall();
+  while (!TakeMessage(msg, hWnd, filterMin, filterMax, true)) {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    Clock::time_point wakeup = NextWindowTimer();
+    if (wakeup == Clock::time_point::max()) {
+      g_condition.wait(lock, []() { return HasInput(); });
+    } else {
+      g_condition.wait_until(lock, wakeup, []() { return HasInput(); });
+    }
+  }
+  return msg->message != WM_QUIT;
+}
+
+BOOL TranslateMessage(const MSG *) {
+  CountCall();
+  return FALSE;
+}
+
+LRESULT DispatchMessageW(const MSG *msg) {
+  CountCall();
+  if (!IsValidWindow(msg->hwnd)) {
+    return 0;
+  }
+  return Deliver(msg->hwnd, msg->message, msg->wParam, msg->lParam);
+}
+
+BOOL IsDialogMessageW(HWND, MSG *) {
+  CountCall();
+  return FALSE;
+}
+
+UINT_PTR SetTimer(HWND hWnd, UINT_PTR id, UINT elapse, TIMERPROC proc) {
+  CountCall();
+  if (!IsValidWindow(hWnd) || proc != nullptr) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(g_mutex);
+  Clock::duration period = std::chrono::milliseconds(elapse);
+  Clock::time_point due = Clock::now() + period;
+  for (WindowTimer &timer : g_windowTimers) {
+    if (timer.hWnd == hWnd && timer.id == id) {
+      timer.period = period;
+      timer.due = due;
+      return id;
+    }
+  }
+  g_windowTimers.push_back(WindowTimer{hWnd, id, period, due});
+  g_condition.notify_all();
+  return id;
+}
+
+BOOL KillTimer(HWND hWnd, UINT_PTR id) {
+  CountCall();
+  std::lock_guard<std::mutex> lock(g_mutex);
+  auto iter = std::find_if(g_windowTimers.begin(), g_windowTimers.end(),
+                           [&](const WindowTimer &timer) {
+                             return timer.hWnd == hWnd && timer.id == id;
+                           });
+  if (iter == g_windowTimers.end()) {
+    return FALSE;
+  }
+  g_windowTimers.erase(iter);
+  return TRUE;
+}
+
+LONG_PTR GetWindowLongPtrW(HWND hWnd, int index) {
+  CountCall();
+  if (!IsValidWindow(hWnd)) {
+    return 0;
+  }
+  switch (index) {
+    case GWLP_WNDPROC: {
+      return reinterpret_cast<LONG_PTR>(hWnd->proc);
+    }
+    case GWLP_ID: {
+      return hWnd->id;
+    }
+    case GWL_STYLE: {
+      return hWnd->style;
+    }
+    case GWL_EXSTYLE: {
+      return hWnd->exStyle;
+    }
+    case GWLP_USERDATA: {
+      return hWnd->userData;
+    }
+  }
+  return 0;
+}
+
+LONG_PTR SetWindowLongPtrW(HWND hWnd, int index, LONG_PTR value) {
+  CountCall();
+  if (!IsValidWindow(hWnd)) {
+    return 0;
+  }
+  LONG_PTR old = 0;
+  switch (index) {
+    case GWLP_WNDPROC: {
+      old = reinterpret_cast<LONG_PTR>(hWnd->proc);
+      hWnd->proc = reinterpret_cast<WNDPROC>(value);
+      break;
+    }
+    case GWLP_ID: {
+      old = hWnd->id;
+      hWnd->id = value;
+      break;
+    }
+    case GWL_STYLE: {
+      old = hWnd->style;
+      hWnd->style = static_cast<DWORD>(value);
+      break;
+    }
+    case GWL_EXSTYLE: {
+      old = hWnd->exStyle;
+      hWnd->exStyle = static_cast<DWORD>(value);
+      break;
+    }
+    case GWLP_USERDATA: {
+      old = hWnd->userData;
+      hWnd->userData = value;
+      break;
+    }
+  }
+  return old;
+}
+
+int GetWindowTextW(HWND hWnd, LPWSTR buffer, int size) {
+  CountCall(&g_calls.windowText);
+  if (!IsValidWindow(hWnd) || size <= 0) {
+    return 0;
+  }
+  return static_cast<int>(Deliver(hWnd, WM_GETTEXT, size,
+                                  reinterpret_cast<LPARAM>(buffer)));
+}
+
+int GetWindowTextLengthW(HWND hWnd) {
+  CountCall(&g_calls.windowText);
+  if (!IsValidWindow(hWnd)) {
+    return 0;
+  }
+  return static_cast<int>(Deliver(hWnd, WM_GETTEXTLENGTH, 0, 0));
+}
+
+BOOL SetWindowTextW(HWND hWnd, LPCWSTR text) {
+  CountCall(&g_calls.windowText);
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  return static_cast<BOOL>(
+      Deliver(hWnd, WM_SETTEXT, 0, reinterpret_cast<LPARAM>(text)));
+}
+
+BOOL ShowWindow(HWND hWnd, int command) {
+  CountCall();
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  bool visible = (hWnd->style & WS_VISIBLE) != 0;
+  Show(hWnd, command != SW_HIDE);
+  return visible;
+}
+
+BOOL IsWindowVisible(HWND hWnd) {
+  CountCall();
+  return IsValidWindow(hWnd) && IsShown(hWnd);
+}
+
+BOOL EnableWindow(HWND hWnd, BOOL enable) {
+  CountCall();
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  bool disabled = (hWnd->style & WS_DISABLED) != 0;
+  if (disabled == !enable) {
+    return disabled;
+  }
+  if (enable) {
+    hWnd->style &= ~WS_DISABLED;
+  } else {
+    hWnd->style |= WS_DISABLED;
+  }
+  Deliver(hWnd, WM_ENABLE, enable, 0);
+  Invalidate(hWnd, nullptr, true);
+  return disabled;
+}
+
+BOOL GetWindowRect(HWND hWnd, RECT *rect) {
+  CountCall();
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  POINT origin = ScreenOrigin(hWnd->parent);
+  *rect = hWnd->rect;
+  rect->left += origin.x;
+  rect->right += origin.x;
+  rect->top += origin.y;
+  rect->bottom += origin.y;
+  return TRUE;
+}
+
+BOOL GetClientRect(HWND hWnd, RECT *rect) {
+  CountCall();
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  *rect = ClientRect(hWnd);
+  return TRUE;
+}
+
+BOOL ScreenToClient(HWND hWnd, POINT *point) {
+  CountCall();
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  POINT origin = ScreenOrigin(hWnd);
+  point->x -= origin.x;
+  point->y -= origin.y;
+  return TRUE;
+}
+
+BOOL MoveWindow(HWND hWnd, int x, int y, int width, int height,
+                BOOL repaint) {
+  CountCall(&g_calls.moveWindow);
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  SetGeometry(hWnd, x, y, width, height, repaint ? 0u : SWP_NOREDRAW);
+  return TRUE;
+}
+
+BOOL SetWindowPos(HWND hWnd, HWND, int x, int y, int width, int height,
+                  UINT flags) {
+  CountCall(&g_calls.moveWindow);
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  SetGeometry(hWnd, x, y, width, height, flags);
+  if (flags & SWP_SHOWWINDOW) {
+    Show(hWnd, true);
+  } else if (flags & SWP_HIDEWINDOW) {
+    Show(hWnd, false);
+  }
+  return TRUE;
+}
+
+struct DeferredMove {
+  HWND hWnd;
+  RECT rect;
+  UINT flags;
+};
+
+HDWP BeginDeferWindowPos(int count) {
+  CountCall();
+  if (count < 0) {
+    return nullptr;
+  }
+  std::vector<DeferredMove> *moves = new std::vector<DeferredMove>();
+  moves->reserve(count);
+  return moves;
+}
+
+HDWP DeferWindowPos(HDWP hDwp, HWND hWnd, HWND, int x, int y, int width,
+                    int height, UINT flags) {
+  CountCall();
+  std::vector<DeferredMove> *moves =
+      static_cast<std::vector<DeferredMove> *>(hDwp);
+  if (!IsValidWindow(hWnd)) {
+    // The whole batch is dropped, as in Win32 API.
+    delete moves;
+    return nullptr;
+  }
+  moves->push_back({hWnd, {x, y, x + width, y + height}, flags});
+  return hDwp;
+}
+
+BOOL EndDeferWindowPos(HDWP hDwp) {
+  CountCall(&g_calls.deferWindowPos);
+  std::unique_ptr<std::vector<DeferredMove>> moves(
+      static_cast<std::vector<DeferredMove> *>(hDwp));
+  for (const DeferredMove &move : *moves) {
+    if (IsValidWindow(move.hWnd)) {
+      const RECT &rect = move.rect;
+      SetGeometry(move.hWnd, rect.left, rect.top, rect.right - rect.left,
+                  rect.bottom - rect.top, move.flags);
+    }
+  }
+  return TRUE;
+}
+
+HCURSOR LoadCursorW(HINSTANCE, LPCWSTR) {
+  CountCall();
+  static int cursor;
+  return reinterpret_cast<HCURSOR>(&cursor);
+}
+
+HMODULE GetModuleHandleW(LPCWSTR) {
+  CountCall();
+  static int module;
+  return reinterpret_cast<HMODULE>(&module);
+}
+
+BOOL InitCommonControlsEx(const INITCOMMONCONTROLSEX *controls) {
+  CountCall();
+  return controls != nullptr &&
+         controls->dwSize == sizeof(INITCOMMONCONTROLSEX);
+}
+
+BOOL InvalidateRect(HWND hWnd, const RECT *rect, BOOL erase) {
+  CountCall(&g_calls.invalidate);
+  if (hWnd == nullptr) {
+    for (HWND window : g_windows) {
+      Invalidate(window, nullptr, erase);
+    }
+    return TRUE;
+  }
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  Invalidate(hWnd, rect, erase);
+  return TRUE;
+}
+
+static void RedrawTree(HWND hWnd, const RECT *rect, UINT flags) {
+  if (flags & RDW_INVALIDATE) {
+    Invalidate(hWnd, rect, flags & RDW_ERASE);
+  } else if (flags & RDW_VALIDATE) {
+    Validate(hWnd);
+  }
+  if (flags & RDW_ALLCHILDREN) {
+    for (HWND child : hWnd->children) {
+      RedrawTree(child, nullptr, flags);
+    }
+  }
+}
+
+BOOL RedrawWindow(HWND hWnd, const RECT *rect, HRGN, UINT flags) {
+  CountCall(&g_calls.invalidate);
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  RedrawTree(hWnd, rect, flags);
+  if (flags & RDW_UPDATENOW) {
+    PaintNow(hWnd, flags & RDW_ALLCHILDREN);
+  }
+  return TRUE;
+}
+
+BOOL UpdateWindow(HWND hWnd) {
+  CountCall();
+  if (!IsValidWindow(hWnd)) {
+    return FALSE;
+  }
+  PaintNow(hWnd, false);
+  return TRUE;
+}
+
+int ScrollWindowEx(HWND hWnd, int dx, int dy, const RECT *scroll,
+                   const RECT *clip, HRGN, RECT *update, UINT flags) {
+  CountCall(&g_calls.invalidate);
+  if (!IsValidWindow(hWnd)) {
+    return ERROR;
+  }
+  RECT area = ClientRect(hWnd);
+  if (scroll != nullptr) {
+    area = Intersect(area, *scroll);
+  }
+  if (clip != nullptr) {
+    area = Intersect(area, *clip);
+  }
+  // The pending update region moves along with the contents.
+  if (!IsRectEmpty(&hWnd->update)) {
+    RECT &region = hWnd->update;
+    region = {region.left + dx, region.top + dy, region.right + dx,
+              region.bottom + dy};
+    region = Intersect(region, ClientRect(hWnd));
+    if (IsRectEmpty(&region)) {
+      Validate(hWnd);
+    }
+  }
+  RECT exposed = {0, 0, 0, 0};
+  if (dx < 0) {
+    exposed = Union(exposed, {area.right + dx, area.top, area.right,
+                              area.bottom});
+  } else if (dx > 0) {
+    exposed = Union(exposed, {area.left, area.top, area.left + dx,
+                              area.bottom});
+  }
+  if (dy < 0) {
+    exposed = Union(exposed, {area.left, area.bottom + dy, area.right,
+                              area.bottom});
+  } else if (dy > 0) {
+    exposed = Union(exposed, {area.left, area.top, area.right,
+                              area.top + dy});
+  }
+  exposed = Intersect(exposed, area);
+  if (flags & SW_INVALIDATE) {
+    Invalidate(hWnd, &exposed, flags & SW_ERASE);
+  }
+  if (update != nullptr) {
+    *update = exposed;
+  }
+  return IsRectEmpty(&exposed) ? NULLREGION : SIMPLEREGION;
+}
+
+static GdiObject *DefaultFont() {
+  static GdiObject *font = MakeStockObject(GdiKind::Font);
+  return font;
+}
+
+static GdiObject *DefaultBitmap() {
+  static GdiObject *bitmap = MakeStockObject(GdiKind::Bitmap);
+  return bitmap;
+}
+
+static DeviceContext *MakeContext(HWND hWnd) {
+  DeviceContext *context = new DeviceContext();
+  context->window = hWnd;
+  context->state = {DefaultFont(),
+                    SysColorBrush(COLOR_WINDOW),
+                    DefaultBitmap(),
+                    0,
+                    0xFFFFFF,
+                    OPAQUE,
+                    {-kUnclipped, -kUnclipped, kUnclipped, kUnclipped}};
+  return context;
+}
+
+static HDC StartPaint(HWND hWnd, PAINTSTRUCT *paint) {
+  DeviceContext *context = MakeContext(hWnd);
+  context->state.clip = hWnd->update;
+  *paint = {};
+  paint->hdc = FromContext(context);
+  paint->rcPaint = hWnd->update;
+  bool erase = hWnd->erase;
+  Validate(hWnd);
+  if (erase) {
+    paint->fErase = !Deliver(hWnd, WM_ERASEBKGND,
+                             reinterpret_cast<WPARAM>(paint->hdc), 0);
+  }
+  return paint->hdc;
+}
+
+HDC BeginPaint(HWND hWnd, PAINTSTRUCT *paint) {
+  CountCall();
+  if (!IsValidWindow(hWnd)) {
+    return nullptr;
+  }
+  return StartPaint(hWnd, paint);
+}
+
+BOOL EndPaint(HWND, const PAINTSTRUCT *paint) {
+  CountCall();
+  delete ToContext(paint->hdc);
+  return TRUE;
+}
+
+BOOL IsRectEmpty(const RECT *rect) {
+  return rect == nullptr || rect->right <= rect->left ||
+         rect->bottom <= rect->top;
+}
+
+HGDIOBJ GetStockObject(int object) {
+  CountCall();
+  return object == DEFAULT_GUI_FONT ? DefaultFont() : nullptr;
+}
+
+static const int kColorCount = 31;
+
+static COLORREF SysColor(int index) {
+  switch (index) {
+    case COLOR_WINDOW:
+    case COLOR_HIGHLIGHTTEXT: {
+      return RGB(255, 255, 255);
+    }
+    case COLOR_HIGHLIGHT: {
+      return RGB(0, 120, 215);
+    }
+    case COLOR_3DFACE: {
+      return RGB(240, 240, 240);
+    }
+    case COLOR_GRAYTEXT: {
+      return RGB(109, 109, 109);
+    }
+  }
+  return RGB(0, 0, 0);
+}
+
+static GdiObject *SysColorBrush(int index) {
+  static GdiObject *brushes[kColorCount] = {};
+  if (index < 0 || index >= kColorCount) {
+    return nullptr;
+  }
+  if (brushes[index] == nullptr) {
+    brushes[index] = MakeStockObject(GdiKind::Brush, SysColor(index));
+  }
+  return brushes[index];
+}
+
+DWORD GetSysColor(int index) {
+  CountCall();
+  return SysColor(index);
+}
+
+HBRUSH GetSysColorBrush(int index) {
+  CountCall();
+  return FromObject<HBRUSH>(SysColorBrush(index));
+}
+
+HDC GetDC(HWND hWnd) {
+  CountCall();
+  if (hWnd != nullptr && !IsValidWindow(hWnd)) {
+    return nullptr;
+  }
+  return FromContext(MakeContext(hWnd));
+}
+
+int ReleaseDC(HWND, HDC dc) {
+  CountCall();
+  delete ToContext(dc);
+  return 1;
+}
+
+HDC CreateCompatibleDC(HDC) {
+  CountCall();
+  return FromContext(MakeContext(nullptr));
+}
+
+BOOL DeleteDC(HDC dc) {
+  CountCall();
+  delete ToContext(dc);
+  return TRUE;
+}
+
+HGDIOBJ SelectObject(HDC dc, HGDIOBJ handle) {
+  CountCall();
+  if (dc == nullptr || handle == nullptr) {
+    return nullptr;
+  }
+  DeviceContext::State &state = ToContext(dc)->state;
+  GdiObject *object = ToObject(handle);
+  GdiObject **slot = nullptr;
+  switch (object->kind) {
+    case GdiKind::Font: {
+      slot = &state.font;
+      break;
+    }
+    case GdiKind::Brush: {
+      slot = &state.brush;
+      break;
+    }
+    case GdiKind::Bitmap: {
+      slot = &state.bitmap;
+      break;
+    }
+  }
+  GdiObject *old = *slot;
+  *slot = object;
+  return old;
+}
+
+BOOL DeleteObject(HGDIOBJ handle) {
+  CountCall();
+  if (handle == nullptr) {
+    return FALSE;
+  }
+  GdiObject *object = ToObject(handle);
+  if (!object->stock) {
+    delete object;
+  }
+  return TRUE;
+}
+
+HBITMAP CreateDIBSection(HDC, const BITMAPINFO *info, UINT, void **bits,
+                         HANDLE, DWORD) {
+  CountCall();
+  const BITMAPINFOHEADER &header = info->bmiHeader;
+  if (header.biBitCount != 32 || header.biCompression != BI_RGB ||
+      header.biWidth <= 0 || header.biHeight == 0) {
+    return nullptr;
+  }
+  LONG width = header.biWidth;
+  LONG height = std::abs(header.biHeight);
+  GdiObject *bitmap =
+      new GdiObject{GdiKind::Bitmap, false, 0, width, height,
+                    header.biHeight > 0, {}};
+  bitmap->pixels.resize(static_cast<size_t>(width) * height);
+  if (bits != nullptr) {
+    *bits = bitmap->pixels.data();
+  }
+  return FromObject<HBITMAP>(bitmap);
+}
+
+int SaveDC(HDC dc) {
+  CountCall();
+  DeviceContext *context = ToContext(dc);
+  context->saved.push_back(context->state);
+  return static_cast<int>(context->saved.size());
+}
+
+BOOL RestoreDC(HDC dc, int savedDc) {
+  CountCall();
+  DeviceContext *context = ToContext(dc);
+  int count = static_cast<int>(context->saved.size());
+  int index = savedDc < 0 ? count + savedDc : savedDc - 1;
+  if (index < 0 || index >= count) {
+    return FALSE;
+  }
+  context->state = context->saved[index];
+  context->saved.resize(index);
+  return TRUE;
+}
+
+int IntersectClipRect(HDC dc, int left, int top, int right, int bottom) {
+  CountCall();
+  RECT &clip = ToContext(dc)->state.clip;
+  clip = Intersect(clip, {left, top, right, bottom});
+  return IsRectEmpty(&clip) ? NULLREGION : SIMPLEREGION;
+}
+
+static uint32_t ToPixel(COLORREF color) {
+  return ((color & 0xFF) << 16) | (color & 0xFF00) | ((color >> 16) & 0xFF);
+}
+
+// Draws on the selected bitmap, if the context has one.
+static void Fill(DeviceContext *context, const RECT &rect, COLORREF color) {
+  GdiObject *bitmap = context->state.bitmap;
+  if (bitmap->pixels.empty()) {
+    return;
+  }
+  RECT area = Intersect(Intersect(rect, context->state.clip),
+                        {0, 0, bitmap->width, bitmap->height});
+  uint32_t pixel = ToPixel(color);
+  for (LONG y = area.top; y < area.bottom; ++y) {
+    LONG row = bitmap->bottomUp ? bitmap->height - 1 - y : y;
+    uint32_t *line = &bitmap->pixels[static_cast<size_t>(row) * bitmap->width];
+    std::fill(line + area.left, line + area.right, pixel);
+  }
+}
+
+static int FillWithBrush(HDC dc, const RECT *rect, HBRUSH brush) {
+  if (dc == nullptr || brush == nullptr) {
+    return 0;
+  }
+  // A system color index plus one may be used instead of a brush.
+  uintptr_t value = reinterpret_cast<uintptr_t>(brush);
+  COLORREF color = value <= kColorCount
+                       ? SysColor(static_cast<int>(value - 1))
+                       : ToObject(brush)->color;
+  Fill(ToContext(dc), *rect, color);
+  return 1;
+}
+
+int FillRect(HDC dc, const RECT *rect, HBRUSH brush) {
+  CountCall();
+  return FillWithBrush(dc, rect, brush);
+}
+
+BOOL BitBlt(HDC dc, int x, int y, int width, int height, HDC source,
+            int srcX, int srcY, DWORD) {
+  CountCall();
+  if (dc == nullptr || source == nullptr) {
+    return FALSE;
+  }
+  GdiObject *dst = ToContext(dc)->state.bitmap;
+  GdiObject *src = ToContext(source)->state.bitmap;
+  if (dst->pixels.empty() || src->pixels.empty()) {
+    return TRUE;
+  }
+  RECT area = Intersect({x, y, x + width, y + height},
+                        {0, 0, dst->width, dst->height});
+  area = Intersect(area, ToContext(dc)->state.clip);
+  for (LONG row = area.top; row < area.bottom; ++row) {
+    LONG from = row - y + srcY;
+    if (from < 0 || from >= src->height) {
+      continue;
+    }
+    for (LONG column = area.left; column < area.right; ++column) {
+      LONG fromColumn = column - x + srcX;
+      if (fromColumn < 0 || fromColumn >= src->width) {
+        continue;
+      }
+      LONG srcRow = src->bottomUp ? src->height - 1 - from : from;
+      LONG dstRow = dst->bottomUp ? dst->height - 1 - row : row;
+      dst->pixels[static_cast<size_t>(dstRow) * dst->width + column] =
+          src->pixels[static_cast<size_t>(srcRow) * src->width + fromColumn];
+    }
+  }
+  return TRUE;
+}
+
+COLORREF SetTextColor(HDC dc, COLORREF color) {
+  CountCall();
+  COLORREF old = ToContext(dc)->state.textColor;
+  ToContext(dc)->state.textColor = color;
+  return old;
+}
+
+COLORREF SetBkColor(HDC dc, COLORREF color) {
+  CountCall();
+  COLORREF old = ToContext(dc)->state.bkColor;
+  ToContext(dc)->state.bkColor = color;
+  return old;
+}
+
+int SetBkMode(HDC dc, int mode) {
+  CountCall();
+  int old = ToContext(dc)->state.bkMode;
+  ToContext(dc)->state.bkMode = mode;
+  return old;
+}
+
+// Text itself isn't rendered, only the opaque background.
+BOOL ExtTextOutW(HDC dc, int, int, UINT options, const RECT *rect, LPCWSTR,
+                 UINT, const int *) {
+  CountCall();
+  if ((options & ETO_OPAQUE) && rect != nullptr) {
+    Fill(ToContext(dc), *rect, ToContext(dc)->state.bkColor);
+  }
+  return TRUE;
+}
+
+BOOL DrawFocusRect(HDC, const RECT *) {
+  CountCall();
+  return TRUE;
+}
+
+BOOL GetTextMetricsW(HDC, TEXTMETRICW *metrics) {
+  CountCall();
+  *metrics = {};
+  metrics->tmHeight = kFontHeight;
+  metrics->tmAscent = kFontAscent;
+  metrics->tmDescent = kFontHeight - kFontAscent;
+  metrics->tmAveCharWidth = kCharWidth;
+  metrics->tmMaxCharWidth = 2 * kCharWidth;
+  metrics->tmWeight = 400;
+  metrics->tmLastChar = 0xFFFF;
+  metrics->tmDefaultChar = L'?';
+  metrics->tmBreakChar = L' ';
+  return TRUE;
+}
+
+BOOL GetTextExtentPoint32W(HDC, LPCWSTR text, int length, SIZE *size) {
+  CountCall();
+  LONG width = 0;
+  for (int i = 0; i < length; ++i) {
+    width += CharWidth(text[i]);
+  }
+  *size = {width, kFontHeight};
+  return TRUE;
+}
+
+BOOL GetCharWidth32W(HDC, UINT first, UINT last, int *widths) {
+  CountCall();
+  for (UINT c = first; c <= last; ++c) {
+    *widths++ = CharWidth(c);
+  }
+  return TRUE;
+}
+
+static KernelObject *ToKernelObject(HANDLE handle) {
+  KernelObject *object = static_cast<KernelObject *>(handle);
+  return g_objects.count(object) != 0 ? object : nullptr;
+}
+
+static HANDLE MakeKernelObject(ObjectKind kind, bool manualReset,
+                               bool signaled) {
+  KernelObject *object =
+      new KernelObject{kind, manualReset, signaled, false, {}, {}};
+  std::lock_guard<std::mutex> lock(g_mutex);
+  g_objects.insert(object);
+  return object;
+}
+
+HANDLE CreateEventW(void *, BOOL manualReset, BOOL initialState, LPCWSTR) {
+  CountCall();
+  return MakeKernelObject(ObjectKind::Event, manualReset, initialState);
+}
+
+static BOOL SetEventState(HANDLE event, bool signaled) {
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    KernelObject *object = ToKernelObject(event);
+    if (object == nullptr || object->kind != ObjectKind::Event) {
+      return FALSE;
+    }
+    object->signaled = signaled;
+  }
+  g_condition.notify_all();
+  return TRUE;
+}
+
+BOOL SetEvent(HANDLE event) {
+  CountCall();
+  return SetEventState(event, true);
+}
+
+BOOL ResetEvent(HANDLE event) {
+  CountCall();
+  return SetEventState(event, false);
+}
+
+HANDLE CreateWaitableTimerW(void *, BOOL manualReset, LPCWSTR) {
+  CountCall();
+  return MakeKernelObject(ObjectKind::Timer, manualReset, false);
+}
+
+HANDLE CreateWaitableTimerExW(void *, LPCWSTR, DWORD flags, DWORD) {
+  CountCall();
+  return MakeKernelObject(ObjectKind::Timer,
+                          flags & CREATE_WAITABLE_TIMER_MANUAL_RESET, false);
+}
+
+// Due times are in 100 ns units: relative if negative, or absolute, counted
+// from 1601-01-01.
+BOOL SetWaitableTimer(HANDLE timer, const LARGE_INTEGER *dueTime, LONG period,
+                      void *, void *, BOOL) {
+  CountCall();
+  using Ticks = std::chrono::duration<LONGLONG, std::ratio<1, 10000000>>;
+  const LONGLONG kUnixEpoch = 116444736000000000LL;
+  Clock::time_point now = Clock::now();
+  Clock::time_point due;
+  if (dueTime->QuadPart < 0) {
+    due = now + std::chrono::duration_cast<Clock::duration>(
+                    Ticks(-dueTime->QuadPart));
+  } else {
+    auto absolute = std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            Ticks(dueTime->QuadPart - kUnixEpoch)));
+    due = now + std::chrono::duration_cast<Clock::duration>(
+                    absolute - std::chrono::system_clock::now());
+  }
+  {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    KernelObject *object = ToKernelObject(timer);
+    if (object == nullptr || object->kind != ObjectKind::Timer) {
+      return FALSE;
+    }
+    object->signaled = false;
+    object->armed = true;
+    object->due = due;
+    object->period = std::chrono::milliseconds(std::max<LONG>(period, 0));
+  }
+  g_condition.notify_all();
+  return TRUE;
+}
+
+BOOL CancelWaitableTimer(HANDLE timer) {
+  CountCall();
+  std::lock_guard<std::mutex> lock(g_mutex);
+  KernelObject *object = ToKernelObject(timer);
+  if (object == nullptr || object->kind != ObjectKind::Timer) {
+    return FALSE;
+  }
+  object->armed = false;
+  return TRUE;
+}
+
+BOOL CloseHandle(HANDLE handle) {
+  CountCall();
+  std::lock_guard<std::mutex> lock(g_mutex);
+  KernelObject *object = ToKernelObject(handle);
+  if (object == nullptr) {
+    return FALSE;
+  }
+  g_objects.erase(object);
+  delete object;
+  return TRUE;
+}
+
+// The functions below are called with g_mutex locked.
+
+static void UpdateTimer(KernelObject *object, Clock::time_point now) {
+  if (object->kind != ObjectKind::Timer || !object->armed ||
+      now < object->due) {
+    return;
+  }
+  object->signaled = true;
+  if (object->period == Clock::duration::zero()) {
+    object->armed = false;
+    return;
+  }
+  // Missed periods signal the timer only once.
+  auto missed = (now - object->due) / object->period;
+  object->due += (missed + 1) * object->period;
+}
+
+// Checks the object and takes it, if it's signaled.
+static bool Acquire(KernelObject *object, Clock::time_point now) {
+  UpdateTimer(object, now);
+  if (!object->signaled) {
+    return false;
+  }
+  if (!object->manualReset) {
+    object->signaled = false;
+  }
+  return true;
+}
+
+static DWORD Wait(DWORD count, const HANDLE *handles, DWORD milliseconds,
+                  bool input) {
+  std::unique_lock<std::mutex> lock(g_mutex);
+  for (DWORD i = 0; i < count; ++i) {
+    if (ToKernelObject(handles[i]) == nullptr) {
+      return WAIT_FAILED;
+    }
+  }
+  Clock::time_point deadline = Clock::time_point::max();
+  if (milliseconds != INFINITE) {
+    deadline = Clock::now() + std::chrono::milliseconds(milliseconds);
+  }
+  while (true) {
+    Clock::time_point now = Clock::now();
+    Clock::time_point wakeup = deadline;
+    for (DWORD i = 0; i < count; ++i) {
+      KernelObject *object = static_cast<KernelObject *>(handles[i]);
+      if (Acquire(object, now)) {
+        return WAIT_OBJECT_0 + i;
+      }
+      if (object->kind == ObjectKind::Timer && object->armed) {
+        wakeup = std::min(wakeup, object->due);
+      }
+    }
+    if (input && HasInput()) {
+      return WAIT_OBJECT_0 + count;
+    }
+    if (input) {
+      wakeup = std::min(wakeup, NextWindowTimer());
+    }
+    if (now >= deadline) {
+      return WAIT_TIMEOUT;
+    }
+    if (wakeup == Clock::time_point::max()) {
+      g_condition.wait(lock);
+    } else {
+      g_condition.wait_until(lock, wakeup);
+    }
+  }
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds) {
+  CountCall();
+  return Wait(1, &handle, milliseconds, false);
+}
+
+// Any queued input ends the wait, as with MWMO_INPUTAVAILABLE.
+DWORD MsgWaitForMultipleObjectsEx(DWORD count, const HANDLE *handles,
+                                  DWORD milliseconds, DWORD, DWORD) {
+  CountCall();
+  if (count >= MAXIMUM_WAIT_OBJECTS) {
+    return WAIT_FAILED;
+  }
+  return Wait(count, handles, milliseconds, true);
+}
+
+DWORD GetCurrentThreadId() {
+  CountCall();
+  static std::atomic<DWORD> nextId(1);
+  static thread_local DWORD id = nextId++;
+  return id;
+}
+
+DWORD GetTickCount() {
+  CountCall();
+  return TickCount();
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *counter) {
+  CountCall();
+  counter->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          Clock::now().time_since_epoch())
+                          .count();
+  return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency) {
+  CountCall();
+  frequency->QuadPart = 1000000000;
+  return TRUE;
+}
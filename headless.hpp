@@ -0,0 +1,661 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef HEADLESS_H_INCLUDED
+#define HEADLESS_H_INCLUDED
+
+// Headless backend: the subset of Win32 API used by the library, implemented
+// in memory, so the widgets can be built and run with any C++ compiler. The
+// declarations mirror <windows.h>, so the rest of the code doesn't know which
+// backend it uses. Windows have geometry, styles, text and an update region,
+// but nothing is drawn on the screen. Built-in control classes (Static,
+// Button, Edit, ListBox, and SysListView32 in owner-data report mode) keep
+// their contents, so the widgets work as usual.
+//
+// Every call to the backend is counted, so tests and benchmarks can check
+// how many system calls an operation costs.
+
+#include <cstddef>
+#include <cstdint>
+
+#define WINAPI
+#define CALLBACK
+#define APIENTRY
+
+#define DECLARE_HANDLE(name) \
+  struct name##__;           \
+  typedef name##__ *name
+
+typedef int BOOL;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef WORD ATOM;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef unsigned int UINT;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef intptr_t LONG_PTR;
+typedef uintptr_t ULONG_PTR;
+typedef uintptr_t UINT_PTR;
+typedef uintptr_t DWORD_PTR;
+typedef UINT_PTR WPARAM;
+typedef LONG_PTR LPARAM;
+typedef LONG_PTR LRESULT;
+typedef DWORD COLORREF;
+typedef wchar_t WCHAR;
+typedef const wchar_t *LPCWSTR;
+typedef wchar_t *LPWSTR;
+typedef void *LPVOID;
+typedef void *HANDLE;
+typedef void *HGDIOBJ;
+typedef HANDLE HDWP;
+
+DECLARE_HANDLE(HWND);
+DECLARE_HANDLE(HMENU);
+DECLARE_HANDLE(HINSTANCE);
+DECLARE_HANDLE(HDC);
+DECLARE_HANDLE(HBRUSH);
+DECLARE_HANDLE(HFONT);
+DECLARE_HANDLE(HBITMAP);
+DECLARE_HANDLE(HRGN);
+DECLARE_HANDLE(HICON);
+typedef HICON HCURSOR;
+typedef HINSTANCE HMODULE;
+
+#define TRUE 1
+#define FALSE 0
+#define INFINITE 0xFFFFFFFF
+#define UNREFERENCED_PARAMETER(x) (void)(x)
+
+#define LOWORD(l) ((WORD)(((DWORD_PTR)(l)) & 0xffff))
+#define HIWORD(l) ((WORD)((((DWORD_PTR)(l)) >> 16) & 0xffff))
+#define MAKELONG(a, b)                            \
+  ((LONG)(((WORD)(((DWORD_PTR)(a)) & 0xffff)) |  \
+          ((DWORD)((WORD)(((DWORD_PTR)(b)) & 0xffff))) << 16))
+#define MAKEWPARAM(l, h) ((WPARAM)(DWORD)MAKELONG(l, h))
+#define MAKELPARAM(l, h) ((LPARAM)(DWORD)MAKELONG(l, h))
+#define MAKEINTRESOURCEW(i) ((LPWSTR)((ULONG_PTR)((WORD)(i))))
+#define RGB(r, g, b)                                 \
+  ((COLORREF)(((BYTE)(r) | ((WORD)((BYTE)(g)) << 8)) | \
+              (((DWORD)(BYTE)(b)) << 16)))
+
+union LARGE_INTEGER {
+  struct {
+    DWORD LowPart;
+    LONG HighPart;
+  };
+  LONGLONG QuadPart;
+};
+
+struct POINT {
+  LONG x;
+  LONG y;
+};
+
+struct SIZE {
+  LONG cx;
+  LONG cy;
+};
+
+struct RECT {
+  LONG left;
+  LONG top;
+  LONG right;
+  LONG bottom;
+};
+
+struct MSG {
+  HWND hwnd;
+  UINT message;
+  WPARAM wParam;
+  LPARAM lParam;
+  DWORD time;
+  POINT pt;
+};
+
+typedef LRESULT (*WNDPROC)(HWND, UINT, WPARAM, LPARAM);
+typedef void (*TIMERPROC)(HWND, UINT, UINT_PTR, DWORD);
+
+struct WNDCLASSEXW {
+  UINT cbSize;
+  UINT style;
+  WNDPROC lpfnWndProc;
+  int cbClsExtra;
+  int cbWndExtra;
+  HINSTANCE hInstance;
+  HICON hIcon;
+  HCURSOR hCursor;
+  HBRUSH hbrBackground;
+  LPCWSTR lpszMenuName;
+  LPCWSTR lpszClassName;
+  HICON hIconSm;
+};
+
+struct PAINTSTRUCT {
+  HDC hdc;
+  BOOL fErase;
+  RECT rcPaint;
+  BOOL fRestore;
+  BOOL fIncUpdate;
+  BYTE rgbReserved[32];
+};
+
+struct DRAWITEMSTRUCT {
+  UINT CtlType;
+  UINT CtlID;
+  UINT itemID;
+  UINT itemAction;
+  UINT itemState;
+  HWND hwndItem;
+  HDC hDC;
+  RECT rcItem;
+  ULONG_PTR itemData;
+};
+
+struct TEXTMETRICW {
+  LONG tmHeight;
+  LONG tmAscent;
+  LONG tmDescent;
+  LONG tmInternalLeading;
+  LONG tmExternalLeading;
+  LONG tmAveCharWidth;
+  LONG tmMaxCharWidth;
+  LONG tmWeight;
+  LONG tmOverhang;
+  LONG tmDigitizedAspectX;
+  LONG tmDigitizedAspectY;
+  WCHAR tmFirstChar;
+  WCHAR tmLastChar;
+  WCHAR tmDefaultChar;
+  WCHAR tmBreakChar;
+  BYTE tmItalic;
+  BYTE tmUnderlined;
+  BYTE tmStruckOut;
+  BYTE tmPitchAndFamily;
+  BYTE tmCharSet;
+};
+
+struct BITMAPINFOHEADER {
+  DWORD biSize;
+  LONG biWidth;
+  LONG biHeight;
+  WORD biPlanes;
+  WORD biBitCount;
+  DWORD biCompression;
+  DWORD biSizeImage;
+  LONG biXPelsPerMeter;
+  LONG biYPelsPerMeter;
+  DWORD biClrUsed;
+  DWORD biClrImportant;
+};
+
+struct RGBQUAD {
+  BYTE rgbBlue;
+  BYTE rgbGreen;
+  BYTE rgbRed;
+  BYTE rgbReserved;
+};
+
+struct BITMAPINFO {
+  BITMAPINFOHEADER bmiHeader;
+  RGBQUAD bmiColors[1];
+};
+
+struct NMHDR {
+  HWND hwndFrom;
+  UINT_PTR idFrom;
+  UINT code;
+};
+
+struct LVCOLUMNW {
+  UINT mask;
+  int fmt;
+  int cx;
+  LPWSTR pszText;
+  int cchTextMax;
+  int iSubItem;
+  int iImage;
+  int iOrder;
+};
+
+struct LVITEMW {
+  UINT mask;
+  int iItem;
+  int iSubItem;
+  UINT state;
+  UINT stateMask;
+  LPWSTR pszText;
+  int cchTextMax;
+  int iImage;
+  LPARAM lParam;
+  int iIndent;
+};
+
+struct NMLVDISPINFOW {
+  NMHDR hdr;
+  LVITEMW item;
+};
+
+struct NMLVCACHEHINT {
+  NMHDR hdr;
+  int iFrom;
+  int iTo;
+};
+
+struct NMLISTVIEW {
+  NMHDR hdr;
+  int iItem;
+  int iSubItem;
+  UINT uNewState;
+  UINT uOldState;
+  UINT uChanged;
+  POINT ptAction;
+  LPARAM lParam;
+};
+
+struct INITCOMMONCONTROLSEX {
+  DWORD dwSize;
+  DWORD dwICC;
+};
+
+#define HWND_MESSAGE ((HWND)(LONG_PTR)-3)
+#define WC_LISTVIEWW L"SysListView32"
+#define IDC_ARROW MAKEINTRESOURCEW(32512)
+
+// Window messages.
+enum : UINT {
+  WM_NULL = 0x0000,
+  WM_CREATE = 0x0001,
+  WM_DESTROY = 0x0002,
+  WM_MOVE = 0x0003,
+  WM_SIZE = 0x0005,
+  WM_SETFOCUS = 0x0007,
+  WM_ENABLE = 0x000A,
+  WM_SETREDRAW = 0x000B,
+  WM_SETTEXT = 0x000C,
+  WM_GETTEXT = 0x000D,
+  WM_GETTEXTLENGTH = 0x000E,
+  WM_PAINT = 0x000F,
+  WM_CLOSE = 0x0010,
+  WM_QUIT = 0x0012,
+  WM_ERASEBKGND = 0x0014,
+  WM_SHOWWINDOW = 0x0018,
+  WM_DRAWITEM = 0x002B,
+  WM_MEASUREITEM = 0x002C,
+  WM_SETFONT = 0x0030,
+  WM_GETFONT = 0x0031,
+  WM_NOTIFY = 0x004E,
+  WM_NCCREATE = 0x0081,
+  WM_NCDESTROY = 0x0082,
+  WM_KEYFIRST = 0x0100,
+  WM_KEYDOWN = 0x0100,
+  WM_KEYUP = 0x0101,
+  WM_CHAR = 0x0102,
+  WM_KEYLAST = 0x0109,
+  WM_COMMAND = 0x0111,
+  WM_TIMER = 0x0113,
+  WM_HSCROLL = 0x0114,
+  WM_VSCROLL = 0x0115,
+  WM_MOUSEMOVE = 0x0200,
+  WM_LBUTTONDOWN = 0x0201,
+  WM_LBUTTONUP = 0x0202,
+  WM_ENTERSIZEMOVE = 0x0231,
+  WM_EXITSIZEMOVE = 0x0232,
+  WM_USER = 0x0400,
+  WM_APP = 0x8000,
+};
+
+// Control messages and notifications.
+enum : UINT {
+  BM_CLICK = 0x00F5,
+  BN_CLICKED = 0,
+  EM_GETSEL = 0x00B0,
+  EM_SETSEL = 0x00B1,
+  EM_LINESCROLL = 0x00B6,
+  EM_SCROLLCARET = 0x00B7,
+  EM_GETLINECOUNT = 0x00BA,
+  EM_LINEINDEX = 0x00BB,
+  EM_LINELENGTH = 0x00C1,
+  EM_REPLACESEL = 0x00C2,
+  EM_SETLIMITTEXT = 0x00C5,
+  EM_LINEFROMCHAR = 0x00C9,
+  EM_GETFIRSTVISIBLELINE = 0x00CE,
+  EM_SETREADONLY = 0x00CF,
+  EM_GETLIMITTEXT = 0x00D5,
+  LB_ADDSTRING = 0x0180,
+  LB_INSERTSTRING = 0x0181,
+  LB_DELETESTRING = 0x0182,
+  LB_RESETCONTENT = 0x0184,
+  LB_SETCURSEL = 0x0186,
+  LB_GETCURSEL = 0x0188,
+  LB_GETTEXT = 0x0189,
+  LB_GETTEXTLEN = 0x018A,
+  LB_GETCOUNT = 0x018B,
+  LB_GETTOPINDEX = 0x018E,
+  LB_SETTOPINDEX = 0x0197,
+  LB_SETITEMHEIGHT = 0x01A0,
+  LB_GETITEMHEIGHT = 0x01A1,
+  LB_SETCOUNT = 0x01A7,
+  LB_INITSTORAGE = 0x01A8,
+  LVM_FIRST = 0x1000,
+  LVM_GETITEMCOUNT = LVM_FIRST + 4,
+  LVM_GETNEXTITEM = LVM_FIRST + 12,
+  LVM_ENSUREVISIBLE = LVM_FIRST + 19,
+  LVM_SCROLL = LVM_FIRST + 20,
+  LVM_REDRAWITEMS = LVM_FIRST + 21,
+  LVM_DELETECOLUMN = LVM_FIRST + 28,
+  LVM_GETTOPINDEX = LVM_FIRST + 39,
+  LVM_GETCOUNTPERPAGE = LVM_FIRST + 40,
+  LVM_SETITEMSTATE = LVM_FIRST + 43,
+  LVM_SETITEMCOUNT = LVM_FIRST + 47,
+  LVM_SETEXTENDEDLISTVIEWSTYLE = LVM_FIRST + 54,
+  LVM_INSERTCOLUMNW = LVM_FIRST + 97,
+  LVN_FIRST = 0u - 100u,
+  LVN_ITEMCHANGED = LVN_FIRST - 1,
+  LVN_COLUMNCLICK = LVN_FIRST - 8,
+  LVN_ODCACHEHINT = LVN_FIRST - 13,
+  LVN_GETDISPINFOW = LVN_FIRST - 77,
+};
+
+enum : int { LB_OKAY = 0, LB_ERR = -1, LB_ERRSPACE = -2 };
+
+// Window styles.
+enum : DWORD {
+  WS_OVERLAPPED = 0x00000000,
+  WS_POPUP = 0x80000000,
+  WS_CHILD = 0x40000000,
+  WS_VISIBLE = 0x10000000,
+  WS_DISABLED = 0x08000000,
+  WS_CLIPSIBLINGS = 0x04000000,
+  WS_CLIPCHILDREN = 0x02000000,
+  WS_CAPTION = 0x00C00000,
+  WS_BORDER = 0x00800000,
+  WS_VSCROLL = 0x00200000,
+  WS_HSCROLL = 0x00100000,
+  WS_SYSMENU = 0x00080000,
+  WS_THICKFRAME = 0x00040000,
+  WS_GROUP = 0x00020000,
+  WS_TABSTOP = 0x00010000,
+  WS_MINIMIZEBOX = 0x00020000,
+  WS_MAXIMIZEBOX = 0x00010000,
+  WS_OVERLAPPEDWINDOW = 0x00CF0000,
+  WS_EX_STATICEDGE = 0x00020000,
+  WS_EX_CONTROLPARENT = 0x00010000,
+  WS_EX_CLIENTEDGE = 0x00000200,
+  WS_EX_COMPOSITED = 0x02000000,
+};
+
+// Control styles.
+enum : DWORD {
+  BS_GROUPBOX = 0x0007,
+  ES_MULTILINE = 0x0004,
+  ES_AUTOVSCROLL = 0x0040,
+  ES_AUTOHSCROLL = 0x0080,
+  ES_READONLY = 0x0800,
+  LBS_NOTIFY = 0x0001,
+  LBS_OWNERDRAWFIXED = 0x0010,
+  LBS_HASSTRINGS = 0x0040,
+  LBS_NOINTEGRALHEIGHT = 0x0100,
+  LBS_NODATA = 0x2000,
+  LVS_REPORT = 0x0001,
+  LVS_SINGLESEL = 0x0004,
+  LVS_SHOWSELALWAYS = 0x0008,
+  LVS_OWNERDATA = 0x1000,
+  LVS_EX_FULLROWSELECT = 0x00000020,
+  LVS_EX_DOUBLEBUFFER = 0x00010000,
+};
+
+// List view columns and items.
+enum : UINT {
+  LVCF_FMT = 0x0001,
+  LVCF_WIDTH = 0x0002,
+  LVCF_TEXT = 0x0004,
+  LVCF_SUBITEM = 0x0008,
+  LVIF_TEXT = 0x0001,
+  LVIF_STATE = 0x0008,
+  LVIS_FOCUSED = 0x0001,
+  LVIS_SELECTED = 0x0002,
+  LVNI_ALL = 0x0000,
+  LVNI_FOCUSED = 0x0001,
+  LVNI_SELECTED = 0x0002,
+  LVSICF_NOINVALIDATEALL = 0x0001,
+  LVSICF_NOSCROLL = 0x0002,
+  ICC_LISTVIEW_CLASSES = 0x0001,
+};
+
+enum : UINT { CS_VREDRAW = 0x0001, CS_HREDRAW = 0x0002 };
+
+enum : int {
+  GWLP_WNDPROC = -4,
+  GWLP_HINSTANCE = -6,
+  GWLP_ID = -12,
+  GWL_STYLE = -16,
+  GWL_EXSTYLE = -20,
+  GWLP_USERDATA = -21,
+};
+
+// ShowWindow() commands.
+enum : int { SW_HIDE = 0, SW_SHOWNORMAL = 1, SW_SHOW = 5, SW_SHOWNA = 8 };
+
+// ScrollWindowEx() flags.
+enum : UINT { SW_SCROLLCHILDREN = 0x0001, SW_INVALIDATE = 0x0002,
+              SW_ERASE = 0x0004 };
+
+enum : UINT {
+  SWP_NOSIZE = 0x0001,
+  SWP_NOMOVE = 0x0002,
+  SWP_NOZORDER = 0x0004,
+  SWP_NOREDRAW = 0x0008,
+  SWP_NOACTIVATE = 0x0010,
+  SWP_FRAMECHANGED = 0x0020,
+  SWP_SHOWWINDOW = 0x0040,
+  SWP_HIDEWINDOW = 0x0080,
+  SWP_NOCOPYBITS = 0x0100,
+  SWP_NOOWNERZORDER = 0x0200,
+};
+
+enum : UINT {
+  RDW_INVALIDATE = 0x0001,
+  RDW_ERASE = 0x0004,
+  RDW_VALIDATE = 0x0008,
+  RDW_ALLCHILDREN = 0x0080,
+  RDW_UPDATENOW = 0x0100,
+  RDW_FRAME = 0x0400,
+};
+
+enum : UINT {
+  ODT_LISTBOX = 2,
+  ODA_DRAWENTIRE = 0x0001,
+  ODA_SELECT = 0x0002,
+  ODA_FOCUS = 0x0004,
+  ODS_SELECTED = 0x0001,
+  ODS_DISABLED = 0x0004,
+  ODS_FOCUS = 0x0010,
+};
+
+enum : int {
+  COLOR_WINDOW = 5,
+  COLOR_WINDOWTEXT = 8,
+  COLOR_HIGHLIGHT = 13,
+  COLOR_HIGHLIGHTTEXT = 14,
+  COLOR_3DFACE = 15,
+  COLOR_BTNFACE = 15,
+  COLOR_GRAYTEXT = 17,
+};
+
+// GDI constants. Region types are returned by the clipping and scrolling
+// functions.
+enum : int {
+  ERROR = 0,
+  NULLREGION = 1,
+  SIMPLEREGION = 2,
+  TRANSPARENT = 1,
+  OPAQUE = 2,
+  DEFAULT_GUI_FONT = 17,
+  BI_RGB = 0,
+  DIB_RGB_COLORS = 0,
+};
+
+enum : UINT { ETO_OPAQUE = 0x0002, ETO_CLIPPED = 0x0004 };
+enum : DWORD { SRCCOPY = 0x00CC0020 };
+
+enum : DWORD {
+  WAIT_OBJECT_0 = 0x00000000,
+  WAIT_ABANDONED_0 = 0x00000080,
+  WAIT_IO_COMPLETION = 0x000000C0,
+  WAIT_TIMEOUT = 0x00000102,
+  WAIT_FAILED = 0xFFFFFFFF,
+  MAXIMUM_WAIT_OBJECTS = 64,
+  QS_ALLINPUT = 0x04FF,
+  MWMO_WAITALL = 0x0001,
+  MWMO_ALERTABLE = 0x0002,
+  MWMO_INPUTAVAILABLE = 0x0004,
+  PM_NOREMOVE = 0x0000,
+  PM_REMOVE = 0x0001,
+  CREATE_WAITABLE_TIMER_MANUAL_RESET = 0x00000001,
+  CREATE_WAITABLE_TIMER_HIGH_RESOLUTION = 0x00000002,
+  TIMER_ALL_ACCESS = 0x001F0003,
+};
+
+// ANSI names used by the library, which resolve to the wide functions.
+#define SendMessage SendMessageW
+#define LoadCursor LoadCursorW
+
+// Windows and messages.
+ATOM RegisterClassExW(const WNDCLASSEXW *wndClass);
+HWND CreateWindowExW(DWORD exStyle, LPCWSTR className, LPCWSTR windowName,
+                     DWORD style, int x, int y, int width, int height,
+                     HWND parent, HMENU menu, HINSTANCE instance,
+                     LPVOID param);
+BOOL DestroyWindow(HWND hWnd);
+BOOL IsWindow(HWND hWnd);
+HWND GetParent(HWND hWnd);
+HWND GetDesktopWindow();
+HWND GetActiveWindow();
+LRESULT DefWindowProcW(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+LRESULT CallWindowProcW(WNDPROC proc, HWND hWnd, UINT message, WPARAM wParam,
+                        LPARAM lParam);
+LRESULT SendMessageW(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+BOOL PostMessageW(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+void PostQuitMessage(int exitCode);
+BOOL PeekMessageW(MSG *msg, HWND hWnd, UINT filterMin, UINT filterMax,
+                  UINT removeMsg);
+BOOL GetMessageW(MSG *msg, HWND hWnd, UINT filterMin, UINT filterMax);
+BOOL TranslateMessage(const MSG *msg);
+LRESULT DispatchMessageW(const MSG *msg);
+BOOL IsDialogMessageW(HWND hDlg, MSG *msg);
+// Window timers post WM_TIMER, timer procedures are not supported.
+UINT_PTR SetTimer(HWND hWnd, UINT_PTR id, UINT elapse, TIMERPROC proc);
+BOOL KillTimer(HWND hWnd, UINT_PTR id);
+LONG_PTR GetWindowLongPtrW(HWND hWnd, int index);
+LONG_PTR SetWindowLongPtrW(HWND hWnd, int index, LONG_PTR value);
+int GetWindowTextW(HWND hWnd, LPWSTR buffer, int size);
+int GetWindowTextLengthW(HWND hWnd);
+BOOL SetWindowTextW(HWND hWnd, LPCWSTR text);
+BOOL ShowWindow(HWND hWnd, int command);
+BOOL IsWindowVisible(HWND hWnd);
+BOOL EnableWindow(HWND hWnd, BOOL enable);
+BOOL GetWindowRect(HWND hWnd, RECT *rect);
+BOOL GetClientRect(HWND hWnd, RECT *rect);
+BOOL ScreenToClient(HWND hWnd, POINT *point);
+BOOL MoveWindow(HWND hWnd, int x, int y, int width, int height, BOOL repaint);
+BOOL SetWindowPos(HWND hWnd, HWND insertAfter, int x, int y, int width,
+                  int height, UINT flags);
+HDWP BeginDeferWindowPos(int count);
+HDWP DeferWindowPos(HDWP hDwp, HWND hWnd, HWND insertAfter, int x, int y,
+                    int width, int height, UINT flags);
+BOOL EndDeferWindowPos(HDWP hDwp);
+HCURSOR LoadCursorW(HINSTANCE instance, LPCWSTR name);
+HMODULE GetModuleHandleW(LPCWSTR moduleName);
+BOOL InitCommonControlsEx(const INITCOMMONCONTROLSEX *controls);
+
+// Painting.
+BOOL InvalidateRect(HWND hWnd, const RECT *rect, BOOL erase);
+BOOL RedrawWindow(HWND hWnd, const RECT *rect, HRGN region, UINT flags);
+BOOL UpdateWindow(HWND hWnd);
+int ScrollWindowEx(HWND hWnd, int dx, int dy, const RECT *scroll,
+                   const RECT *clip, HRGN updateRegion, RECT *update,
+                   UINT flags);
+HDC BeginPaint(HWND hWnd, PAINTSTRUCT *paint);
+BOOL EndPaint(HWND hWnd, const PAINTSTRUCT *paint);
+BOOL IsRectEmpty(const RECT *rect);
+
+// GDI.
+HGDIOBJ GetStockObject(int object);
+DWORD GetSysColor(int index);
+HBRUSH GetSysColorBrush(int index);
+HDC GetDC(HWND hWnd);
+int ReleaseDC(HWND hWnd, HDC dc);
+HDC CreateCompatibleDC(HDC dc);
+BOOL DeleteDC(HDC dc);
+HGDIOBJ SelectObject(HDC dc, HGDIOBJ object);
+BOOL DeleteObject(HGDIOBJ object);
+HBITMAP CreateDIBSection(HDC dc, const BITMAPINFO *info, UINT usage,
+                         void **bits, HANDLE section, DWORD offset);
+int SaveDC(HDC dc);
+BOOL RestoreDC(HDC dc, int savedDc);
+int IntersectClipRect(HDC dc, int left, int top, int right, int bottom);
+int FillRect(HDC dc, const RECT *rect, HBRUSH brush);
+BOOL BitBlt(HDC dc, int x, int y, int width, int height, HDC source, int srcX,
+            int srcY, DWORD rop);
+COLORREF SetTextColor(HDC dc, COLORREF color);
+COLORREF SetBkColor(HDC dc, COLORREF color);
+int SetBkMode(HDC dc, int mode);
+BOOL ExtTextOutW(HDC dc, int x, int y, UINT options, const RECT *rect,
+                 LPCWSTR text, UINT length, const int *dx);
+BOOL DrawFocusRect(HDC dc, const RECT *rect);
+BOOL GetTextMetricsW(HDC dc, TEXTMETRICW *metrics);
+BOOL GetTextExtentPoint32W(HDC dc, LPCWSTR text, int length, SIZE *size);
+BOOL GetCharWidth32W(HDC dc, UINT first, UINT last, int *widths);
+
+// Kernel objects and time.
+HANDLE CreateEventW(void *attributes, BOOL manualReset, BOOL initialState,
+                    LPCWSTR name);
+BOOL SetEvent(HANDLE event);
+BOOL ResetEvent(HANDLE event);
+HANDLE CreateWaitableTimerW(void *attributes, BOOL manualReset, LPCWSTR name);
+HANDLE CreateWaitableTimerExW(void *attributes, LPCWSTR name, DWORD flags,
+                              DWORD access);
+BOOL SetWaitableTimer(HANDLE timer, const LARGE_INTEGER *dueTime, LONG period,
+                      void *completion, void *arg, BOOL resume);
+BOOL CancelWaitableTimer(HANDLE timer);
+BOOL CloseHandle(HANDLE handle);
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+DWORD MsgWaitForMultipleObjectsEx(DWORD count, const HANDLE *handles,
+                                  DWORD milliseconds, DWORD wakeMask,
+                                  DWORD flags);
+DWORD GetCurrentThreadId();
+DWORD GetTickCount();
+BOOL QueryPerformanceCounter(LARGE_INTEGER *counter);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency);
+
+// Number of calls made to the backend since the last reset. Messages which
+// the backend sends by itself (e.g. WM_SIZE from SetWindowPos) are not
+// counted.
+struct ApiCallCounts {
+  size_t createWindow = 0;
+  size_t destroyWindow = 0;
+  size_t sendMessage = 0;
+  size_t postMessage = 0;
+  // MoveWindow and SetWindowPos.
+  size_t moveWindow = 0;
+  // EndDeferWindowPos, that is, batches of moves.
+  size_t deferWindowPos = 0;
+  // InvalidateRect, RedrawWindow and ScrollWindowEx.
+  size_t invalidate = 0;
+  // GetWindowText, GetWindowTextLength and SetWindowText.
+  size_t windowText = 0;
+  // All the calls, including the ones of other kinds.
+  size_t total = 0;
+};
+
+ApiCallCounts operator-(const ApiCallCounts &lhs, const ApiCallCounts &rhs);
+
+ApiCallCounts GetApiCallCounts();
+void ResetApiCallCounts();
+
+#endif  // HEADLESS_H_INCLUDED
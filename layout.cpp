@@ -0,0 +1,201 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "layout.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+static bool SameRect(const RECT &a, const RECT &b) {
+  return a.left == b.left && a.top == b.top && a.right == b.right &&
+         a.bottom == b.bottom;
+}
+
+Layout::Layout() : margins_(0), spacing_(0) {}
+
+Layout::~Layout() {}
+
+void Layout::SetMargins(int margins) { margins_ = margins; }
+
+void Layout::SetSpacing(int spacing) { spacing_ = spacing; }
+
+void Layout::Attach(CustomWindow &window, CoalescePolicy policy) {
+  CustomWindow *target = &window;
+  auto arrange = [this, target]() {
+    // Deferred windows are arranged when they are created.
+    if (!target->IsRealized()) {
+      return;
+    }
+    RECT client;
+    GetClientRect(target->Handle(), &client);
+    Arrange(client);
+  };
+  window.OnResize.AddEvent(arrange, policy, this);
+  arrange();
+}
+
+void Layout::Arrange(const RECT &area) {
+  GeometryBatch batch(CountWidgets());
+  Place(area, batch);
+}
+
+void Layout::Place(const RECT &area, GeometryBatch &batch) {
+  RECT inner = {area.left + margins_, area.top + margins_,
+                area.right - margins_, area.bottom - margins_};
+  inner.right = std::max(inner.left, inner.right);
+  inner.bottom = std::max(inner.top, inner.bottom);
+  PlaceItems(inner, batch);
+}
+
+int Layout::CountWidgets() const {
+  int count = 0;
+  for (const Item &item : items_) {
+    if (item.widget != nullptr) {
+      ++count;
+    } else if (item.layout != nullptr) {
+      count += item.layout->CountWidgets();
+    }
+  }
+  return count;
+}
+
+void Layout::AddItem(Widget *widget, Layout *layout) {
+  items_.push_back(Item{widget, layout, RECT{0, 0, 0, 0}, false});
+}
+
+void Layout::DistributeSpace(int start, int length,
+                             const std::vector<Track> &tracks,
+                             std::vector<int> &starts,
+                             std::vector<int> &sizes) {
+  size_t count = tracks.size();
+  starts.resize(count);
+  sizes.resize(count);
+  if (count == 0) {
+    return;
+  }
+  int freeSpace = length - spacing_ * static_cast<int>(count - 1);
+  int totalStretch = 0;
+  for (const Track &track : tracks) {
+    freeSpace -= track.size;
+    totalStretch += track.stretch;
+  }
+  freeSpace = std::max(freeSpace, 0);
+  int stretchLeft = totalStretch;
+  int position = start;
+  for (size_t i = 0; i < count; ++i) {
+    int size = tracks[i].size;
+    if (tracks[i].stretch > 0) {
+      // Give the rounding error to the last stretchable track, so the layout
+      // is filled exactly.
+      int share = static_cast<int>(static_cast<int64_t>(freeSpace) *
+                                   tracks[i].stretch / stretchLeft);
+      size += share;
+      freeSpace -= share;
+      stretchLeft -= tracks[i].stretch;
+    }
+    starts[i] = position;
+    sizes[i] = size;
+    position += size + spacing_;
+  }
+}
+
+void Layout::PlaceItem(size_t index, const RECT &rect, GeometryBatch &batch) {
+  Item &item = items_[index];
+  if (item.widget != nullptr) {
+    if (!item.placed || !SameRect(item.bounds, rect)) {
+      batch.Move(*item.widget, rect);
+      item.bounds = rect;
+      item.placed = true;
+    }
+  } else if (item.layout != nullptr) {
+    item.layout->Place(rect, batch);
+  }
+}
+
+BoxLayout::BoxLayout(Orientation orientation) : orientation_(orientation) {}
+
+void BoxLayout::Add(Widget *widget, int size, int stretch) {
+  if (size < 0) {
+    SIZE current = widget->GetSize();
+    size = orientation_ == Orientation::Horizontal ? current.cx : current.cy;
+  }
+  AddItem(widget, nullptr);
+  tracks_.push_back({size, stretch});
+}
+
+void BoxLayout::Add(Layout *layout, int size, int stretch) {
+  AddItem(nullptr, layout);
+  tracks_.push_back({size, stretch});
+}
+
+void BoxLayout::AddStretch(int stretch) {
+  AddItem(nullptr, nullptr);
+  tracks_.push_back({0, stretch});
+}
+
+void BoxLayout::PlaceItems(const RECT &area, GeometryBatch &batch) {
+  bool horizontal = orientation_ == Orientation::Horizontal;
+  if (horizontal) {
+    DistributeSpace(area.left, area.right - area.left, tracks_, starts_,
+                    sizes_);
+  } else {
+    DistributeSpace(area.top, area.bottom - area.top, tracks_, starts_, sizes_);
+  }
+  for (size_t i = 0; i < items_.size(); ++i) {
+    RECT rect = area;
+    if (horizontal) {
+      rect.left = starts_[i];
+      rect.right = starts_[i] + sizes_[i];
+    } else {
+      rect.top = starts_[i];
+      rect.bottom = starts_[i] + sizes_[i];
+    }
+    PlaceItem(i, rect, batch);
+  }
+}
+
+GridLayout::GridLayout(int rows, int columns)
+    : rows_(rows, Track{0, 1}), columns_(columns, Track{0, 1}) {}
+
+void GridLayout::SetRow(int row, int size, int stretch) {
+  rows_.at(row) = Track{size, stretch};
+}
+
+void GridLayout::SetColumn(int column, int size, int stretch) {
+  columns_.at(column) = Track{size, stretch};
+}
+
+void GridLayout::Add(Widget *widget, int row, int column, int rowSpan,
+                     int columnSpan) {
+  assert(row + rowSpan <= static_cast<int>(rows_.size()));
+  assert(column + columnSpan <= static_cast<int>(columns_.size()));
+  AddItem(widget, nullptr);
+  cells_.push_back({row, column, rowSpan, columnSpan});
+}
+
+void GridLayout::Add(Layout *layout, int row, int column, int rowSpan,
+                     int columnSpan) {
+  assert(row + rowSpan <= static_cast<int>(rows_.size()));
+  assert(column + columnSpan <= static_cast<int>(columns_.size()));
+  AddItem(nullptr, layout);
+  cells_.push_back({row, column, rowSpan, columnSpan});
+}
+
+void GridLayout::PlaceItems(const RECT &area, GeometryBatch &batch) {
+  DistributeSpace(area.left, area.right - area.left, columns_, columnStarts_,
+                  columnSizes_);
+  DistributeSpace(area.top, area.bottom - area.top, rows_, rowStarts_,
+                  rowSizes_);
+  for (size_t i = 0; i < items_.size(); ++i) {
+    const Cell &cell = cells_[i];
+    int lastRow = cell.row + cell.rowSpan - 1;
+    int lastColumn = cell.column + cell.columnSpan - 1;
+    RECT rect = {columnStarts_[cell.column], rowStarts_[cell.row],
+                 columnStarts_[lastColumn] + columnSizes_[lastColumn],
+                 rowStarts_[lastRow] + rowSizes_[lastRow]};
+    PlaceItem(i, rect, batch);
+  }
+}
@@ -0,0 +1,128 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef LAYOUT_H_INCLUDED
+#define LAYOUT_H_INCLUDED
+
+#include "win32api.hpp"
+#include <vector>
+#include "eventhandler.hpp"
+#include "winutil.hpp"
+
+// Layouts arrange widgets sharing the same parent inside a rectangle of its
+// client area. The geometry is computed in memory and applied in a single
+// GeometryBatch. Only the widgets whose rectangles changed since the previous
+// pass are moved, so the other ones are not repainted. Layouts don't own the
+// widgets and nested layouts added to them, which must outlive the layout.
+class Layout : public EventOwner {
+ public:
+  Layout();
+  ~Layout() override;
+
+  void SetMargins(int margins);
+  void SetSpacing(int spacing);
+
+  // Arrange the widgets in the client area of the window now and each time
+  // it's resized. With CoalescePolicy::LatestPerFrame(), a drag-resize
+  // arranges them once per frame instead of once per WM_SIZE.
+  void Attach(CustomWindow &window, CoalescePolicy policy = CoalescePolicy());
+
+  void Arrange(const RECT &area);
+
+ protected:
+  struct Item {
+    Widget *widget;
+    Layout *layout;
+    RECT bounds;
+    bool placed;
+  };
+
+  // Size of a row or a column: the fixed part plus a share of the free space
+  // proportional to stretch.
+  struct Track {
+    int size;
+    int stretch;
+  };
+
+  void AddItem(Widget *widget, Layout *layout);
+
+  // Split the segment of the given length between the tracks, writing their
+  // starts and sizes.
+  void DistributeSpace(int start, int length, const std::vector<Track> &tracks,
+                       std::vector<int> &starts, std::vector<int> &sizes);
+
+  void PlaceItem(size_t index, const RECT &rect, GeometryBatch &batch);
+  virtual void PlaceItems(const RECT &area, GeometryBatch &batch) = 0;
+
+  std::vector<Item> items_;
+  int margins_;
+  int spacing_;
+
+ private:
+  void Place(const RECT &area, GeometryBatch &batch);
+  int CountWidgets() const;
+};
+
+enum class Orientation { Horizontal, Vertical };
+
+// Puts the items in a row or a column, filling the layout in the other
+// direction.
+class BoxLayout : public Layout {
+ public:
+  explicit BoxLayout(Orientation orientation);
+
+  // The size is measured along the layout direction, -1 means the current
+  // widget size. Items with non-zero stretch also get a share of the free
+  // space.
+  void Add(Widget *widget, int size = -1, int stretch = 0);
+  void Add(Layout *layout, int size = 0, int stretch = 1);
+  void AddStretch(int stretch = 1);
+
+ protected:
+  void PlaceItems(const RECT &area, GeometryBatch &batch) override;
+
+ private:
+  Orientation orientation_;
+  std::vector<Track> tracks_;
+  std::vector<int> starts_;
+  std::vector<int> sizes_;
+};
+
+// Puts the items into the cells of a grid. By default, all the rows and
+// columns stretch equally.
+class GridLayout : public Layout {
+ public:
+  GridLayout(int rows, int columns);
+
+  void SetRow(int row, int size, int stretch);
+  void SetColumn(int column, int size, int stretch);
+
+  void Add(Widget *widget, int row, int column, int rowSpan = 1,
+           int columnSpan = 1);
+  void Add(Layout *layout, int row, int column, int rowSpan = 1,
+           int columnSpan = 1);
+
+ protected:
+  void PlaceItems(const RECT &area, GeometryBatch &batch) override;
+
+ private:
+  struct Cell {
+    int row;
+    int column;
+    int rowSpan;
+    int columnSpan;
+  };
+
+  std::vector<Track> rows_;
+  std::vector<Track> columns_;
+  std::vector<Cell> cells_;
+  std::vector<int> rowStarts_;
+  std::vector<int> rowSizes_;
+  std::vector<int> columnStarts_;
+  std::vector<int> columnSizes_;
+};
+
+#endif  // LAYOUT_H_INCLUDED
@@ -0,0 +1,187 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "listfilter.hpp"
+#include <algorithm>
+#include <cwctype>
+#include <numeric>
+
+ListBoxFilter::ListBoxFilter(ListBox &listBox, std::vector<std::wstring> items)
+    : listBox_(listBox), items_(std::move(items)) {
+  foldedItems_.reserve(items_.size());
+  std::vector<uint64_t> trigrams;
+  for (size_t item = 0; item < items_.size(); ++item) {
+    foldedItems_.push_back(Fold(items_[item]));
+    const std::wstring &folded = foldedItems_.back();
+    trigrams.clear();
+    for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+      trigrams.push_back(Trigram(&folded[i]));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                   trigrams.end());
+    for (uint64_t trigram : trigrams) {
+      index_[trigram].push_back(static_cast<int>(item));
+    }
+  }
+  matches_.resize(items_.size());
+  std::iota(matches_.begin(), matches_.end(), 0);
+  Show();
+}
+
+void ListBoxFilter::SetQuery(const std::wstring &query) {
+  std::wstring folded = Fold(query);
+  query_ = query;
+  if (folded == foldedQuery_) {
+    return;
+  }
+  Match(folded);
+  foldedQuery_ = std::move(folded);
+  Show();
+}
+
+int ListBoxFilter::GetSelectedItem() {
+  int position = listBox_.GetSelectedItem();
+  return position == -1 ? -1 : shown_[position];
+}
+
+void ListBoxFilter::Match(const std::wstring &folded) {
+  matches_.clear();
+  while (!results_.empty() &&
+         folded.compare(0, results_.back().query.size(),
+                        results_.back().query) != 0) {
+    results_.pop_back();
+  }
+  if (folded.empty()) {
+    matches_.resize(items_.size());
+    std::iota(matches_.begin(), matches_.end(), 0);
+    return;
+  }
+  if (!results_.empty() && results_.back().query == folded) {
+    matches_ = results_.back().items;
+    return;
+  }
+  // Check the smallest of the known sets containing all the matches: the
+  // items matching a prefix of the query or the previous query, if it's a
+  // part of the new one, and the items having each trigram of the query.
+  const std::vector<int> *candidates = nullptr;
+  if (!results_.empty()) {
+    candidates = &results_.back().items;
+  }
+  if (!foldedQuery_.empty() &&
+      folded.find(foldedQuery_) != std::wstring::npos &&
+      (candidates == nullptr || shown_.size() < candidates->size())) {
+    candidates = &shown_;
+  }
+  const std::vector<int> none;
+  for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+    auto it = index_.find(Trigram(&folded[i]));
+    if (it == index_.end()) {
+      candidates = &none;
+      break;
+    }
+    if (candidates == nullptr || it->second.size() < candidates->size()) {
+      candidates = &it->second;
+    }
+  }
+  if (candidates == nullptr) {
+    for (size_t item = 0; item < foldedItems_.size(); ++item) {
+      if (foldedItems_[item].find(folded) != std::wstring::npos) {
+        matches_.push_back(static_cast<int>(item));
+      }
+    }
+  } else {
+    for (int item : *candidates) {
+      if (foldedItems_[item].find(folded) != std::wstring::npos) {
+        matches_.push_back(item);
+      }
+    }
+  }
+  results_.push_back({folded, matches_});
+}
+
+void ListBoxFilter::Show() {
+  size_t common = 0;
+  for (size_t i = 0, j = 0; i < shown_.size() && j < matches_.size();) {
+    if (shown_[i] < matches_[j]) {
+      ++i;
+    } else if (shown_[i] > matches_[j]) {
+      ++j;
+    } else {
+      ++common;
+      ++i;
+      ++j;
+    }
+  }
+  size_t removed = shown_.size() - common;
+  size_t added = matches_.size() - common;
+  if (removed == 0 && added == 0) {
+    return;
+  }
+
+  // Each delete or insert moves the lines after it, which is a few hundred
+  // times cheaper than adding a line. If the list changes a lot, filling it
+  // again is cheaper than changing it in place.
+  const size_t kMovesPerLine = 256;
+  size_t changed = removed + added;
+  UpdateTransaction transaction(listBox_);
+  if (changed * (kMovesPerLine + matches_.size()) >=
+      matches_.size() * kMovesPerLine) {
+    int selected = GetSelectedItem();
+    listBox_.Clear();
+    size_t textLength = 0;
+    for (int item : matches_) {
+      textLength += items_[item].size();
+    }
+    listBox_.Reserve(static_cast<int>(matches_.size()), textLength);
+    for (int item : matches_) {
+      listBox_.AddLine(items_[item]);
+    }
+    auto it = std::lower_bound(matches_.begin(), matches_.end(), selected);
+    if (selected != -1 && it != matches_.end() && *it == selected) {
+      SendMessageW(listBox_.Handle(), LB_SETCURSEL, it - matches_.begin(), 0);
+    }
+  } else {
+    // Delete the lines from the last one, so the positions of the lines
+    // before it don't change. Then insert the new lines in the order they
+    // are shown, each one goes after the lines which are already in place.
+    size_t j = matches_.size();
+    for (size_t i = shown_.size(); i-- > 0;) {
+      while (j > 0 && matches_[j - 1] > shown_[i]) {
+        --j;
+      }
+      if (j == 0 || matches_[j - 1] != shown_[i]) {
+        listBox_.RemoveLine(static_cast<int>(i));
+      }
+    }
+    size_t i = 0;
+    for (size_t position = 0; position < matches_.size(); ++position) {
+      while (i < shown_.size() && shown_[i] < matches_[position]) {
+        ++i;
+      }
+      if (i == shown_.size() || shown_[i] != matches_[position]) {
+        listBox_.InsertLine(static_cast<int>(position),
+                            items_[matches_[position]]);
+      }
+    }
+  }
+  shown_.swap(matches_);
+}
+
+std::wstring ListBoxFilter::Fold(const std::wstring &text) {
+  std::wstring res(text.size(), 0);
+  std::transform(text.begin(), text.end(), res.begin(),
+                 [](wchar_t c) { return std::towlower(c); });
+  return res;
+}
+
+uint64_t ListBoxFilter::Trigram(const wchar_t *text) {
+  // Code points fit in 21 bits.
+  const uint64_t kMask = (1 << 21) - 1;
+  return (static_cast<uint64_t>(text[0]) & kMask) << 42 |
+         (static_cast<uint64_t>(text[1]) & kMask) << 21 |
+         (static_cast<uint64_t>(text[2]) & kMask);
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef LISTFILTER_H_INCLUDED
+#define LISTFILTER_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "winutil.hpp"
+
+// Type-ahead filter for a list box with many items. The list box shows the
+// items containing the query, case-insensitively, in their original order.
+//
+// The items are indexed by their trigrams, so a query of three or more
+// characters only checks the items having its rarest trigram. When the query
+// grows, only the items shown for the previous one are checked, and the
+// results for its prefixes are kept, so erasing it doesn't check anything.
+// The list box is updated in place with the deletes and inserts which turn
+// the previous result into the new one, unless refilling it is cheaper. The
+// filter owns the list box contents, they must not be changed elsewhere.
+class ListBoxFilter {
+ public:
+  ListBoxFilter(ListBox &listBox, std::vector<std::wstring> items);
+
+  void SetQuery(const std::wstring &query);
+  inline const std::wstring &GetQuery() const { return query_; }
+
+  // Number of the items shown.
+  inline int GetCount() const { return static_cast<int>(shown_.size()); }
+  // Item shown at the given position.
+  inline int GetItem(int position) const { return shown_[position]; }
+  inline const std::wstring &GetItemText(int item) const {
+    return items_[item];
+  }
+  // Item shown in the selected line, or -1 if there is none.
+  int GetSelectedItem();
+
+ private:
+  struct Result {
+    std::wstring query;
+    std::vector<int> items;
+  };
+
+  // Find the items matching folded into matches_.
+  void Match(const std::wstring &folded);
+  // Update the list box to show matches_ instead of shown_.
+  void Show();
+
+  static std::wstring Fold(const std::wstring &text);
+  static uint64_t Trigram(const wchar_t *text);
+
+  ListBox &listBox_;
+  std::vector<std::wstring> items_;
+  std::vector<std::wstring> foldedItems_;
+  // Items having each trigram, in ascending order.
+  std::unordered_map<uint64_t, std::vector<int>> index_;
+  std::wstring query_;
+  // Folded prefixes of the query with their matches, the longest one last.
+  std::vector<Result> results_;
+  std::wstring foldedQuery_;
+  // Items shown, in ascending order.
+  std::vector<int> shown_;
+  std::vector<int> matches_;
+};
+
+#endif  // LISTFILTER_H_INCLUDED
@@ -0,0 +1,191 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "mainloop.hpp"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "coalescing.hpp"
+#include "dispatcher.hpp"
+#include "profiler.hpp"
+#include "winutil.hpp"
+
+static LONGLONG GetPerformanceCounter() {
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return counter.QuadPart;
+}
+
+static LONGLONG GetPerformanceFrequency() {
+  static const LONGLONG frequency = []() {
+    LARGE_INTEGER res;
+    QueryPerformanceFrequency(&res);
+    return res.QuadPart;
+  }();
+  return frequency;
+}
+
+MainLoop::MainLoop()
+    : nextIdleTask_(0),
+      idleBudget_(0),
+      dialogNavigation_(true),
+      running_(false) {
+  SetIdleBudget(5000);
+}
+
+void MainLoop::RegisterWaitableHandle(HANDLE handle,
+                                      SmallFunction<void()> callback) {
+  size_t count = 0;
+  for (const std::vector<WaitEntry> *waits : {&waits_, &addedWaits_}) {
+    for (const WaitEntry &entry : *waits) {
+      count += entry.active;
+    }
+  }
+  if (count >= kMaxHandles) {
+    throw std::length_error("too many waitable handles");
+  }
+  std::vector<WaitEntry> &waits = running_ ? addedWaits_ : waits_;
+  waits.push_back(WaitEntry{handle, std::move(callback), true});
+  if (!running_) {
+    handles_.push_back(handle);
+  }
+}
+
+void MainLoop::UnregisterWaitableHandle(HANDLE handle) {
+  for (std::vector<WaitEntry> *waits : {&waits_, &addedWaits_}) {
+    for (WaitEntry &entry : *waits) {
+      if (entry.handle == handle) {
+        entry.active = false;
+      }
+    }
+  }
+  if (!running_) {
+    Compact();
+  }
+}
+
+void MainLoop::AddIdleTask(SmallFunction<bool()> task) {
+  std::vector<IdleEntry> &tasks = running_ ? addedIdleTasks_ : idleTasks_;
+  tasks.push_back(IdleEntry{std::move(task), true});
+}
+
+void MainLoop::SetIdleBudget(int microseconds) {
+  idleBudget_ = GetPerformanceFrequency() * microseconds / 1000000;
+}
+
+void MainLoop::SetDialogNavigation(bool enabled) {
+  dialogNavigation_ = enabled;
+}
+
+void MainLoop::Compact() {
+  auto inactive = [](const auto &entry) { return !entry.active; };
+  waits_.erase(std::remove_if(waits_.begin(), waits_.end(), inactive),
+               waits_.end());
+  std::move(addedWaits_.begin(), addedWaits_.end(), std::back_inserter(waits_));
+  addedWaits_.clear();
+  handles_.clear();
+  for (const WaitEntry &entry : waits_) {
+    handles_.push_back(entry.handle);
+  }
+  auto removed = std::remove_if(idleTasks_.begin(), idleTasks_.end(), inactive);
+  if (removed != idleTasks_.end()) {
+    idleTasks_.erase(removed, idleTasks_.end());
+    nextIdleTask_ = 0;
+  }
+  std::move(addedIdleTasks_.begin(), addedIdleTasks_.end(),
+            std::back_inserter(idleTasks_));
+  addedIdleTasks_.clear();
+}
+
+bool MainLoop::ProcessMessages(int &exitCode) {
+  MSG msg;
+  while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+    if (msg.message == WM_QUIT) {
+      exitCode = static_cast<int>(msg.wParam);
+      return false;
+    }
+    bool isKey = msg.message >= WM_KEYFIRST && msg.message <= WM_KEYLAST;
+    if (dialogNavigation_ && isKey &&
+        IsDialogMessageW(GetActiveWindow(), &msg)) {
+      continue;
+    }
+    if (IsProfilingEnabled()) {
+      BeginProfiledDispatch(msg);
+      TranslateMessage(&msg);
+      DispatchMessageW(&msg);
+      EndProfiledDispatch();
+    } else {
+      TranslateMessage(&msg);
+      DispatchMessageW(&msg);
+    }
+    GetDispatcher().RethrowError();
+  }
+  return true;
+}
+
+void MainLoop::Signal(size_t index) {
+  RunningGuard guard(*this);
+  // Handles after the signaled one are checked too, so the ones at the start
+  // of the list can't starve the others.
+  for (size_t i = index; i < waits_.size(); ++i) {
+    if (!waits_[i].active) {
+      continue;
+    }
+    if (i == index || WaitForSingleObject(handles_[i], 0) == WAIT_OBJECT_0) {
+      waits_[i].callback();
+    }
+  }
+}
+
+bool MainLoop::RunIdleTasks() {
+  if (idleTasks_.empty()) {
+    return false;
+  }
+  {
+    RunningGuard guard(*this);
+    LONGLONG start = GetPerformanceCounter();
+    size_t count = idleTasks_.size();
+    for (size_t i = 0; i < count; ++i) {
+      IdleEntry &entry = idleTasks_[nextIdleTask_];
+      nextIdleTask_ = (nextIdleTask_ + 1) % count;
+      if (!entry.task()) {
+        entry.active = false;
+      }
+      if (GetPerformanceCounter() - start >= idleBudget_) {
+        break;
+      }
+    }
+  }
+  return !idleTasks_.empty();
+}
+
+int MainLoop::Run() {
+  int exitCode = 0;
+  while (ProcessMessages(exitCode)) {
+    RunCoalescedCalls();
+    // Don't block while there is idle work left, but still return as soon as
+    // new input arrives.
+    DWORD timeout = RunIdleTasks() ? 0 : GetCoalescedCallDelay();
+    DWORD res = MsgWaitForMultipleObjectsEx(
+        static_cast<DWORD>(handles_.size()), handles_.data(), timeout,
+        QS_ALLINPUT, MWMO_ALERTABLE | MWMO_INPUTAVAILABLE);
+    if (res == WAIT_FAILED) {
+      throw WindowsError("could not wait for messages");
+    }
+    if (res - WAIT_OBJECT_0 < handles_.size()) {
+      Signal(res - WAIT_OBJECT_0);
+    } else if (res - WAIT_ABANDONED_0 < handles_.size()) {
+      // The callback of an abandoned mutex learns about it by waiting.
+      Signal(res - WAIT_ABANDONED_0);
+    }
+  }
+  return exitCode;
+}
+
+MainLoop &GetMainLoop() {
+  static MainLoop mainLoop;
+  return mainLoop;
+}
@@ -0,0 +1,103 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef MAINLOOP_H_INCLUDED
+#define MAINLOOP_H_INCLUDED
+
+#include "win32api.hpp"
+#include <vector>
+#include "eventhandler.hpp"
+
+// The message loop of the UI thread. Besides window messages, it waits for
+// the registered kernel objects and runs their callbacks on the UI thread, and
+// runs idle tasks when there are no messages to process. The wait is
+// alertable, so completion routines of overlapped I/O are run here too. The
+// calls of coalesced event subscribers are run once the messages are
+// processed, see CoalescePolicy.
+class MainLoop {
+ public:
+  // At most this many handles can be waited for.
+  static constexpr size_t kMaxHandles = MAXIMUM_WAIT_OBJECTS - 1;
+
+  MainLoop();
+  MainLoop(const MainLoop &) = delete;
+  MainLoop(MainLoop &&) = delete;
+  MainLoop &operator=(const MainLoop &) = delete;
+  MainLoop &operator=(MainLoop &&) = delete;
+
+  // Call the callback each time the handle is signaled. Manual-reset events
+  // must be reset by the callback, otherwise it's called continuously.
+  void RegisterWaitableHandle(HANDLE handle, SmallFunction<void()> callback);
+  void UnregisterWaitableHandle(HANDLE handle);
+
+  // Run the task when the message queue is empty, until it returns false.
+  // Each idle pass runs the tasks in turn until the budget is spent, and the
+  // messages are processed again before the next pass.
+  void AddIdleTask(SmallFunction<bool()> task);
+  void SetIdleBudget(int microseconds);
+
+  // Whether keyboard messages go through IsDialogMessage() for tab and arrow
+  // key navigation. It's enabled by default. Other messages never do.
+  void SetDialogNavigation(bool enabled);
+
+  // Run until WM_QUIT is received and return its exit code.
+  int Run();
+
+ private:
+  struct WaitEntry {
+    HANDLE handle;
+    SmallFunction<void()> callback;
+    bool active;
+  };
+
+  struct IdleEntry {
+    SmallFunction<bool()> task;
+    bool active;
+  };
+
+  // Marks the callbacks as running and compacts the lists once they return,
+  // even if one of them throws.
+  class RunningGuard {
+   public:
+    explicit RunningGuard(MainLoop &loop)
+        : loop_(loop), wasRunning_(loop.running_) {
+      loop_.running_ = true;
+    }
+    RunningGuard(const RunningGuard &) = delete;
+    RunningGuard &operator=(const RunningGuard &) = delete;
+    ~RunningGuard() {
+      loop_.running_ = wasRunning_;
+      if (!wasRunning_) {
+        loop_.Compact();
+      }
+    }
+
+   private:
+    MainLoop &loop_;
+    bool wasRunning_;
+  };
+
+  bool ProcessMessages(int &exitCode);
+  void Signal(size_t index);
+  bool RunIdleTasks();
+  void Compact();
+
+  // Handles registered while running the callbacks are kept aside, so the
+  // ones being run are not moved.
+  std::vector<WaitEntry> waits_;
+  std::vector<WaitEntry> addedWaits_;
+  std::vector<HANDLE> handles_;
+  std::vector<IdleEntry> idleTasks_;
+  std::vector<IdleEntry> addedIdleTasks_;
+  size_t nextIdleTask_;
+  LONGLONG idleBudget_;
+  bool dialogNavigation_;
+  bool running_;
+};
+
+MainLoop &GetMainLoop();
+
+#endif  // MAINLOOP_H_INCLUDED
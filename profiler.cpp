@@ -0,0 +1,249 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif
+
+std::atomic<bool> g_profilingEnabled(false);
+
+enum HistogramState { kEmpty, kClaimed, kReady };
+
+struct Histogram {
+  std::atomic<int> state;
+  ProfileCategory category;
+  UINT message;
+  const char *name;
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> totalNs;
+  std::atomic<uint64_t> maxNs;
+  std::atomic<uint64_t> buckets[ProfileStats::kBucketCount];
+};
+
+struct PendingDispatch {
+  bool pending;
+  HWND hWnd;
+  UINT message;
+  uint64_t latencyNs;
+};
+
+// Open addressing hash table, whose slots are claimed with a CAS and never
+// freed. Samples with no free slot left are dropped.
+static constexpr size_t kHistogramCount = 1024;
+static Histogram g_histograms[kHistogramCount];
+static std::atomic<uint64_t> g_droppedSamples(0);
+
+static thread_local PendingDispatch g_pendingDispatch;
+
+static int64_t GetProfilerFrequency() {
+  static const int64_t frequency = []() {
+    LARGE_INTEGER res;
+    QueryPerformanceFrequency(&res);
+    return res.QuadPart;
+  }();
+  return frequency;
+}
+
+static Histogram *FindHistogram(ProfileCategory category, UINT message,
+                                const char *name) {
+  uint64_t hash = static_cast<uint64_t>(category) * 0x9e3779b97f4a7c15ull ^
+                  message * 0xc2b2ae3d27d4eb4full ^
+                  reinterpret_cast<uintptr_t>(name) * 0x165667b19e3779f9ull;
+  hash ^= hash >> 29;
+  for (size_t probe = 0; probe < kHistogramCount; ++probe) {
+    Histogram &histogram = g_histograms[(hash + probe) % kHistogramCount];
+    int state = histogram.state.load(std::memory_order_acquire);
+    if (state == kEmpty &&
+        histogram.state.compare_exchange_strong(state, kClaimed,
+                                                std::memory_order_acquire)) {
+      histogram.category = category;
+      histogram.message = message;
+      histogram.name = name;
+      histogram.state.store(kReady, std::memory_order_release);
+      return &histogram;
+    }
+    // Another thread is filling the slot in, which takes a few instructions.
+    while (state == kClaimed) {
+      state = histogram.state.load(std::memory_order_acquire);
+    }
+    if (histogram.category == category && histogram.message == message &&
+        histogram.name == name) {
+      return &histogram;
+    }
+  }
+  return nullptr;
+}
+
+static int BucketOf(uint64_t ns) {
+  int bucket = 0;
+  while (ns > 1 && bucket < ProfileStats::kBucketCount - 1) {
+    ns >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+static void RecordNs(ProfileCategory category, UINT message, const char *name,
+                     uint64_t ns) {
+  Histogram *histogram = FindHistogram(category, message, name);
+  if (histogram == nullptr) {
+    g_droppedSamples.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  histogram->count.fetch_add(1, std::memory_order_relaxed);
+  histogram->totalNs.fetch_add(ns, std::memory_order_relaxed);
+  histogram->buckets[BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+  uint64_t max = histogram->maxNs.load(std::memory_order_relaxed);
+  while (ns > max && !histogram->maxNs.compare_exchange_weak(
+                         max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+void SetProfilingEnabled(bool enabled) {
+  g_profilingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void RecordProfile(ProfileCategory category, UINT message, const char *name,
+                   int64_t ticks) {
+  int64_t frequency = GetProfilerFrequency();
+  uint64_t ns = ticks / frequency * 1000000000 +
+                ticks % frequency * 1000000000 / frequency;
+  RecordNs(category, message, name, ns);
+}
+
+void BeginProfiledDispatch(const MSG &msg) {
+  // Message times come from GetTickCount() and wrap around together with it.
+  DWORD latencyMs = GetTickCount() - msg.time;
+  g_pendingDispatch = {true, msg.hwnd, msg.message, latencyMs * 1000000ull};
+}
+
+void EndProfiledDispatch() {
+  // No widget has received the message, so its class is unknown.
+  if (g_pendingDispatch.pending) {
+    g_pendingDispatch.pending = false;
+    RecordNs(ProfileCategory::QueueLatency, g_pendingDispatch.message, nullptr,
+             g_pendingDispatch.latencyNs);
+  }
+}
+
+void ProfileDispatchReceived(HWND hWnd, UINT message, const char *name) {
+  PendingDispatch &dispatch = g_pendingDispatch;
+  if (dispatch.pending && dispatch.hWnd == hWnd &&
+      dispatch.message == message) {
+    dispatch.pending = false;
+    RecordNs(ProfileCategory::QueueLatency, message, name, dispatch.latencyNs);
+  }
+}
+
+uint64_t ProfileStats::PercentileNs(double fraction) const {
+  uint64_t target = static_cast<uint64_t>(fraction * count);
+  uint64_t seen = 0;
+  for (int i = 0; i < kBucketCount; ++i) {
+    seen += buckets[i];
+    if (seen > target) {
+      return std::min(uint64_t(2) << i, maxNs);
+    }
+  }
+  return maxNs;
+}
+
+static std::string Demangle(const char *name) {
+  if (name == nullptr) {
+    return std::string();
+  }
+#if defined(__GNUC__)
+  int status = 0;
+  char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+  if (demangled != nullptr) {
+    std::string res = demangled;
+    std::free(demangled);
+    return res;
+  }
+#endif
+  return name;
+}
+
+std::vector<ProfileStats> GetProfileStats() {
+  std::vector<ProfileStats> res;
+  for (Histogram &histogram : g_histograms) {
+    if (histogram.state.load(std::memory_order_acquire) != kReady ||
+        histogram.count.load(std::memory_order_relaxed) == 0) {
+      continue;
+    }
+    ProfileStats stats;
+    stats.category = histogram.category;
+    stats.message = histogram.message;
+    stats.name = Demangle(histogram.name);
+    stats.count = histogram.count.load(std::memory_order_relaxed);
+    stats.totalNs = histogram.totalNs.load(std::memory_order_relaxed);
+    stats.maxNs = histogram.maxNs.load(std::memory_order_relaxed);
+    for (int i = 0; i < ProfileStats::kBucketCount; ++i) {
+      stats.buckets[i] = histogram.buckets[i].load(std::memory_order_relaxed);
+    }
+    res.push_back(std::move(stats));
+  }
+  return res;
+}
+
+void ResetProfile() {
+  for (Histogram &histogram : g_histograms) {
+    histogram.count.store(0, std::memory_order_relaxed);
+    histogram.totalNs.store(0, std::memory_order_relaxed);
+    histogram.maxNs.store(0, std::memory_order_relaxed);
+    for (std::atomic<uint64_t> &bucket : histogram.buckets) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+  }
+  g_droppedSamples.store(0, std::memory_order_relaxed);
+}
+
+static const char *GetCategoryName(ProfileCategory category) {
+  switch (category) {
+    case ProfileCategory::QueueLatency: {
+      return "latency";
+    }
+    case ProfileCategory::Handler: {
+      return "handler";
+    }
+    case ProfileCategory::DefaultProc: {
+      return "default";
+    }
+    case ProfileCategory::Subscriber: {
+      return "subscriber";
+    }
+  }
+  return "unknown";
+}
+
+void DumpProfile(const std::string &fileName) {
+  std::FILE *file = std::fopen(fileName.c_str(), "w");
+  if (file == nullptr) {
+    throw std::runtime_error("could not open " + fileName);
+  }
+  std::fprintf(file, "%-10s %-8s %10s %10s %10s %10s %10s  %s\n", "category",
+               "message", "count", "mean_us", "p50_us", "p99_us", "max_us",
+               "name");
+  for (const ProfileStats &stats : GetProfileStats()) {
+    std::fprintf(file, "%-10s %#-8x %10llu %10.1f %10.1f %10.1f %10.1f  %s\n",
+                 GetCategoryName(stats.category), stats.message,
+                 static_cast<unsigned long long>(stats.count),
+                 stats.totalNs / 1e3 / stats.count,
+                 stats.PercentileNs(0.5) / 1e3, stats.PercentileNs(0.99) / 1e3,
+                 stats.maxNs / 1e3,
+                 stats.name.empty() ? "-" : stats.name.c_str());
+  }
+  std::fprintf(file, "dropped %llu\n",
+               static_cast<unsigned long long>(
+                   g_droppedSamples.load(std::memory_order_relaxed)));
+  if (std::fclose(file) != 0) {
+    throw std::runtime_error("could not write " + fileName);
+  }
+}
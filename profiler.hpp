@@ -0,0 +1,88 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include "win32api.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Built-in instrumentation of message dispatch. When enabled, it measures the
+// time messages wait in the queue, the time spent in the widget handlers, in
+// the default window procedures and in each event subscriber. Samples are
+// kept in lock-free log2 histograms, keyed by the message and the widget
+// class, or by the type of the subscriber. When disabled, each instrumented
+// call only checks a flag.
+
+enum class ProfileCategory {
+  // From posting the message to dispatching it, with GetTickCount()
+  // resolution.
+  QueueLatency,
+  // Time spent in the message map handlers, including the nested messages.
+  Handler,
+  // Time spent in DefWindowProc() or in the original procedure of a
+  // subclassed control.
+  DefaultProc,
+  // Time spent in one subscriber of an event, keyed by its type.
+  Subscriber
+};
+
+struct ProfileStats {
+  // Bucket i counts the samples in [2^i, 2^(i+1)) nanoseconds.
+  static constexpr int kBucketCount = 40;
+
+  ProfileCategory category;
+  // Zero for subscribers.
+  UINT message;
+  // Widget class or subscriber type, empty if unknown.
+  std::string name;
+  uint64_t count;
+  uint64_t totalNs;
+  uint64_t maxNs;
+  std::array<uint64_t, kBucketCount> buckets;
+
+  // Upper bound of the given fraction of the samples, e.g. 0.99.
+  uint64_t PercentileNs(double fraction) const;
+};
+
+extern std::atomic<bool> g_profilingEnabled;
+
+inline bool IsProfilingEnabled() {
+  return g_profilingEnabled.load(std::memory_order_relaxed);
+}
+
+void SetProfilingEnabled(bool enabled);
+
+inline int64_t ProfilerClock() {
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return counter.QuadPart;
+}
+
+// Add a sample measured with ProfilerClock(). The name must be a string with
+// static storage duration, such as the result of typeid().name().
+void RecordProfile(ProfileCategory category, UINT message, const char *name,
+                   int64_t ticks);
+
+// Called by the main loop around dispatching a message, so the window
+// procedure can attribute the queue latency to the widget class.
+void BeginProfiledDispatch(const MSG &msg);
+void EndProfiledDispatch();
+// Called by the window procedure. Records the queue latency if the message
+// is the one being dispatched by the main loop.
+void ProfileDispatchReceived(HWND hWnd, UINT message, const char *name);
+
+std::vector<ProfileStats> GetProfileStats();
+void ResetProfile();
+// Write the statistics as a text table. Throws std::runtime_error if the file
+// can't be written.
+void DumpProfile(const std::string &fileName);
+
+#endif  // PROFILER_H_INCLUDED
@@ -0,0 +1,65 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(size_t threadCount) : stopping_(false) {
+  threads_.reserve(threadCount);
+  for (size_t i = 0; i < threadCount; ++i) {
+    threads_.emplace_back([this]() { Run(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  // The dropped tasks are destroyed without holding the lock.
+  std::deque<SmallFunction<void()>> dropped;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    dropped.swap(tasks_);
+  }
+  condition_.notify_all();
+  for (std::thread &thread : threads_) {
+    thread.join();
+  }
+}
+
+size_t ThreadPool::DefaultThreadCount() {
+  size_t cores = std::thread::hardware_concurrency();
+  return cores > 1 ? cores - 1 : 1;
+}
+
+void ThreadPool::Submit(SmallFunction<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    tasks_.push_back(std::move(task));
+  }
+  condition_.notify_one();
+}
+
+void ThreadPool::Run() {
+  while (true) {
+    SmallFunction<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+ThreadPool &GetThreadPool() {
+  static ThreadPool pool;
+  return pool;
+}
@@ -0,0 +1,118 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "eventhandler.hpp"
+
+// Worker threads for background work, e.g. sorting of large grids. Tasks run
+// in the order they were submitted. They must not touch widgets, the results
+// are passed to the UI thread via the Dispatcher.
+class ThreadPool {
+ public:
+  // By default, one core is left for the UI thread.
+  explicit ThreadPool(size_t threadCount = DefaultThreadCount());
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ThreadPool &operator=(ThreadPool &&) = delete;
+  // Waits for the running tasks. The queued ones are dropped.
+  ~ThreadPool();
+
+  void Submit(SmallFunction<void()> task);
+
+  inline size_t GetThreadCount() const { return threads_.size(); }
+
+  // Call func(i) for each i in [0, count) on the pool and on the calling
+  // thread, and wait until all the calls are finished. The calling thread
+  // takes part in the work, so this can be used from the pool tasks too. If
+  // some calls throw, the first exception is rethrown.
+  template <typename Func>
+  void ParallelFor(size_t count, Func func);
+
+  static size_t DefaultThreadCount();
+
+ private:
+  template <typename Func>
+  struct ParallelForState {
+    Func *func;
+    size_t count;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+
+    // Run the calls until none are left. Return when the caller may go.
+    void Work();
+  };
+
+  void Run();
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::deque<SmallFunction<void()>> tasks_;
+  std::vector<std::thread> threads_;
+  bool stopping_;
+};
+
+ThreadPool &GetThreadPool();
+
+template <typename Func>
+void ThreadPool::ParallelForState<Func>::Work() {
+  size_t index;
+  while ((index = next++) < count) {
+    try {
+      (*func)(index);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+    if (++done == count) {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished.notify_all();
+    }
+  }
+}
+
+template <typename Func>
+void ThreadPool::ParallelFor(size_t count, Func func) {
+  if (count == 0) {
+    return;
+  }
+  // The helpers may start after all the work is done, so they share the
+  // state, but func is only called while the caller waits.
+  auto state = std::make_shared<ParallelForState<Func>>();
+  state->func = &func;
+  state->count = count;
+  size_t helpers = std::min(count - 1, threads_.size());
+  for (size_t i = 0; i < helpers; ++i) {
+    Submit([state]() { state->Work(); });
+  }
+  state->Work();
+  {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return state->done == count; });
+  }
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+#endif  // THREADPOOL_H_INCLUDED
@@ -0,0 +1,371 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "timer.hpp"
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include "mainloop.hpp"
+#include "winutil.hpp"
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+static const uint64_t kNever = std::numeric_limits<uint64_t>::max();
+
+static int LowestBit(uint64_t value) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(value);
+#else
+  int res = 0;
+  while (!(value & 1)) {
+    value >>= 1;
+    ++res;
+  }
+  return res;
+#endif
+}
+
+static int HighestBit(uint64_t value) {
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(value);
+#else
+  int res = 0;
+  while (value >>= 1) {
+    ++res;
+  }
+  return res;
+#endif
+}
+
+// The latest time in [deadline, deadline + tolerance] with the most trailing
+// zero bits. Timers with overlapping windows tend to get the same time.
+static uint64_t Coalesce(uint64_t deadline, DWORD tolerance) {
+  if (tolerance == 0) {
+    return deadline;
+  }
+  uint64_t latest = deadline + tolerance;
+  uint64_t mask = (uint64_t(2) << HighestBit((deadline - 1) ^ latest)) - 1;
+  return latest & ~(mask >> 1);
+}
+
+uint64_t TimerService::Now() {
+  static const LONGLONG frequency = []() {
+    LARGE_INTEGER res;
+    QueryPerformanceFrequency(&res);
+    return res.QuadPart;
+  }();
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  uint64_t ticks = counter.QuadPart;
+  return ticks / frequency * 1000 + ticks % frequency * 1000 / frequency;
+}
+
+TimerService::TimerService() : current_(Now()), armed_(kNever) {
+  std::fill(std::begin(slots_), std::end(slots_), -1);
+  std::fill(std::begin(occupied_), std::end(occupied_), 0);
+  timer_ = CreateWaitableTimerExW(nullptr, nullptr,
+                                  CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                  TIMER_ALL_ACCESS);
+  if (timer_ == nullptr) {
+    // High resolution timers need Windows 10 1803 or later.
+    timer_ = CreateWaitableTimerW(nullptr, false, nullptr);
+  }
+  if (timer_ == nullptr) {
+    throw WindowsError("could not create waitable timer");
+  }
+  GetMainLoop().RegisterWaitableHandle(timer_, [this]() {
+    armed_ = kNever;
+    try {
+      Advance(Now());
+    } catch (...) {
+      Arm();
+      throw;
+    }
+    Arm();
+  });
+}
+
+TimerService::~TimerService() {
+  GetMainLoop().UnregisterWaitableHandle(timer_);
+  CloseHandle(timer_);
+}
+
+TimerId TimerService::SetTimeout(DWORD delay, SmallFunction<void()> func,
+                                 EventOwner *owner, DWORD tolerance) {
+  return Add(delay, 0, tolerance, std::move(func), owner);
+}
+
+TimerId TimerService::SetInterval(DWORD period, SmallFunction<void()> func,
+                                  EventOwner *owner, DWORD tolerance) {
+  period = std::max<DWORD>(period, 1);
+  return Add(period, period, tolerance, std::move(func), owner);
+}
+
+TimerId TimerService::Add(DWORD delay, DWORD period, DWORD tolerance,
+                          SmallFunction<void()> func, EventOwner *owner) {
+  int32_t index;
+  if (!freeTimers_.empty()) {
+    index = freeTimers_.back();
+    freeTimers_.pop_back();
+  } else {
+    index = static_cast<int32_t>(timers_.size());
+    timers_.emplace_back();
+    timers_.back().generation = 0;
+  }
+  Timer &timer = timers_[index];
+  timer.active = true;
+  timer.firing = false;
+  timer.deadline = Now() + delay;
+  timer.period = period;
+  timer.tolerance = tolerance;
+  timer.func = std::move(func);
+  timer.owner = owner;
+  timer.slot = -1;
+  TimerId id;
+  id.id = uint64_t(timer.generation) << 32 | uint32_t(index);
+  if (owner != nullptr) {
+    timer.hook = owner->AddDestroyHook([this, id]() { Cancel(id); });
+  }
+  Schedule(index);
+  Arm();
+  return id;
+}
+
+void TimerService::Cancel(TimerId id) {
+  int32_t index = static_cast<int32_t>(id.id & 0xffffffff);
+  if (index < 0 || static_cast<size_t>(index) >= timers_.size()) {
+    return;
+  }
+  Timer &timer = timers_[index];
+  if (!timer.active || timer.generation != id.id >> 32) {
+    return;
+  }
+  timer.active = false;
+  if (timer.owner != nullptr) {
+    timer.owner->RemoveDestroyHook(timer.hook);
+    timer.owner = nullptr;
+  }
+  // A running timer is released when its function returns.
+  if (!timer.firing) {
+    Unlink(index);
+    Release(index);
+  }
+}
+
+void TimerService::Release(int32_t index) {
+  Timer &timer = timers_[index];
+  timer.func.Reset();
+  ++timer.generation;
+  freeTimers_.push_back(index);
+}
+
+void TimerService::Schedule(int32_t index) {
+  Timer &timer = timers_[index];
+  timer.expiry = std::max(Coalesce(timer.deadline, timer.tolerance), current_);
+  // A timer goes to the lowest level whose window around the current tick
+  // contains it, so its slot there is never behind the current one.
+  for (int level = 0; level < kLevelCount; ++level) {
+    int shift = kLevelBits * (level + 1);
+    if (timer.expiry >> shift == current_ >> shift) {
+      int slot = (timer.expiry >> (kLevelBits * level)) & (kSlotCount - 1);
+      Link(index, level * kSlotCount + slot);
+      return;
+    }
+  }
+  Link(index, kOverflowSlot);
+}
+
+void TimerService::Link(int32_t index, int32_t slot) {
+  Timer &timer = timers_[index];
+  timer.slot = slot;
+  timer.prev = -1;
+  timer.next = slots_[slot];
+  if (timer.next != -1) {
+    timers_[timer.next].prev = index;
+  }
+  slots_[slot] = index;
+  if (slot != kOverflowSlot) {
+    occupied_[slot / kSlotCount] |= uint64_t(1) << (slot % kSlotCount);
+  }
+}
+
+void TimerService::Unlink(int32_t index) {
+  Timer &timer = timers_[index];
+  int32_t slot = timer.slot;
+  if (slot == -1) {
+    return;
+  }
+  if (timer.prev != -1) {
+    timers_[timer.prev].next = timer.next;
+  } else {
+    slots_[slot] = timer.next;
+  }
+  if (timer.next != -1) {
+    timers_[timer.next].prev = timer.prev;
+  }
+  timer.slot = -1;
+  if (slots_[slot] == -1 && slot != kOverflowSlot) {
+    occupied_[slot / kSlotCount] &= ~(uint64_t(1) << (slot % kSlotCount));
+  }
+}
+
+int32_t TimerService::Detach(int32_t slot) {
+  int32_t head = slots_[slot];
+  slots_[slot] = -1;
+  if (slot != kOverflowSlot) {
+    occupied_[slot / kSlotCount] &= ~(uint64_t(1) << (slot % kSlotCount));
+  }
+  for (int32_t index = head; index != -1; index = timers_[index].next) {
+    timers_[index].slot = -1;
+  }
+  return head;
+}
+
+uint64_t TimerService::NextEventTime() const {
+  // Level 0 slots are the expiration times themselves. Higher level slots
+  // have to be cascaded down when the current tick reaches their start, so
+  // the current slot is still pending if the tick is exactly at its start.
+  // It goes first, as the lower levels may already have timers after it.
+  for (int level = 1; level < kLevelCount; ++level) {
+    int shift = kLevelBits * level;
+    if (current_ % (uint64_t(1) << shift) != 0) {
+      break;
+    }
+    int slot = (current_ >> shift) & (kSlotCount - 1);
+    if (occupied_[level] & uint64_t(1) << slot) {
+      return current_;
+    }
+  }
+  if (current_ % (uint64_t(1) << (kLevelBits * kLevelCount)) == 0 &&
+      slots_[kOverflowSlot] != -1) {
+    return current_;
+  }
+  for (int level = 0; level < kLevelCount; ++level) {
+    int shift = kLevelBits * level;
+    int slot = (current_ >> shift) & (kSlotCount - 1);
+    bool atStart = current_ % (uint64_t(1) << shift) == 0;
+    int first = atStart ? slot : slot + 1;
+    if (first == kSlotCount) {
+      continue;
+    }
+    uint64_t pending = occupied_[level] & (~uint64_t(0) << first);
+    if (pending != 0) {
+      int windowShift = shift + kLevelBits;
+      uint64_t window = current_ >> windowShift << windowShift;
+      return window | uint64_t(LowestBit(pending)) << shift;
+    }
+  }
+  if (slots_[kOverflowSlot] != -1) {
+    int shift = kLevelBits * kLevelCount;
+    uint64_t mask = (uint64_t(1) << shift) - 1;
+    return (current_ + mask) >> shift << shift;
+  }
+  return kNever;
+}
+
+void TimerService::Advance(uint64_t now) {
+  for (;;) {
+    uint64_t time = NextEventTime();
+    if (time > now) {
+      break;
+    }
+    current_ = time;
+    if (time % (uint64_t(1) << (kLevelBits * kLevelCount)) == 0) {
+      for (int32_t index = Detach(kOverflowSlot); index != -1;) {
+        int32_t next = timers_[index].next;
+        Schedule(index);
+        index = next;
+      }
+    }
+    for (int level = kLevelCount - 1; level > 0; --level) {
+      int shift = kLevelBits * level;
+      if (time % (uint64_t(1) << shift) != 0) {
+        continue;
+      }
+      int slot = (time >> shift) & (kSlotCount - 1);
+      for (int32_t index = Detach(level * kSlotCount + slot); index != -1;) {
+        int32_t next = timers_[index].next;
+        Schedule(index);
+        index = next;
+      }
+    }
+    // Timers added by the ones firing now start from the next tick. The ones
+    // about to fire are marked, so cancelling them doesn't release them.
+    int32_t index = Detach(time & (kSlotCount - 1));
+    current_ = time + 1;
+    for (int32_t i = index; i != -1; i = timers_[i].next) {
+      timers_[i].firing = true;
+    }
+    // The whole chain is fired even if some callbacks throw, otherwise the
+    // rest of it would stay marked and never be scheduled or released.
+    std::exception_ptr error;
+    while (index != -1) {
+      int32_t next = timers_[index].next;
+      try {
+        Fire(index);
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      index = next;
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  current_ = std::max(current_, now + 1);
+}
+
+void TimerService::Fire(int32_t index) {
+  std::exception_ptr error;
+  if (timers_[index].active) {
+    try {
+      timers_[index].func();
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+  Timer &timer = timers_[index];
+  timer.firing = false;
+  if (!timer.active) {
+    Release(index);
+  } else if (timer.period != 0) {
+    timer.deadline = std::max(timer.deadline + timer.period, current_);
+    Schedule(index);
+  } else {
+    timer.active = false;
+    if (timer.owner != nullptr) {
+      timer.owner->RemoveDestroyHook(timer.hook);
+    }
+    Release(index);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void TimerService::Arm() {
+  uint64_t time = NextEventTime();
+  if (time == armed_ || time == kNever) {
+    return;
+  }
+  armed_ = time;
+  // Negative due times are relative, in 100 ns units.
+  uint64_t now = Now();
+  LARGE_INTEGER due;
+  due.QuadPart = time > now ? -static_cast<LONGLONG>(time - now) * 10000 : -1;
+  if (!SetWaitableTimer(timer_, &due, 0, nullptr, nullptr, false)) {
+    throw WindowsError("could not set waitable timer");
+  }
+}
+
+TimerService &GetTimerService() {
+  static TimerService timerService;
+  return timerService;
+}
@@ -0,0 +1,104 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef TIMER_H_INCLUDED
+#define TIMER_H_INCLUDED
+
+#include "win32api.hpp"
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "eventhandler.hpp"
+
+class TimerId {
+ public:
+  TimerId() : id(0) {}
+
+ private:
+  uint64_t id;
+  friend class TimerService;
+};
+
+// Runs timers on the UI thread. All the timers are kept in a hierarchical
+// timer wheel with millisecond ticks, and the main loop waits for a single
+// high-resolution waitable timer set to the nearest expiration. A timer with
+// non-zero tolerance may fire up to that many milliseconds late, which lets
+// the timers expiring around the same time fire in a single wakeup. If a
+// callback throws, the other timers due at the same tick still fire, and then
+// the first exception is rethrown from the main loop.
+class TimerService {
+ public:
+  TimerService();
+  TimerService(const TimerService &) = delete;
+  TimerService(TimerService &&) = delete;
+  TimerService &operator=(const TimerService &) = delete;
+  TimerService &operator=(TimerService &&) = delete;
+  ~TimerService();
+
+  // Call the function once after the delay, in milliseconds. If the owner is
+  // destroyed first, the timer is cancelled.
+  TimerId SetTimeout(DWORD delay, SmallFunction<void()> func,
+                     EventOwner *owner = nullptr, DWORD tolerance = 0);
+  // Call the function every period milliseconds until cancelled.
+  TimerId SetInterval(DWORD period, SmallFunction<void()> func,
+                      EventOwner *owner = nullptr, DWORD tolerance = 0);
+  // Does nothing if the timer has already fired or has been cancelled.
+  void Cancel(TimerId id);
+
+  // Milliseconds on the clock used by the timers.
+  static uint64_t Now();
+
+ private:
+  static constexpr int kLevelBits = 6;
+  static constexpr int kSlotCount = 1 << kLevelBits;
+  static constexpr int kLevelCount = 4;
+  static constexpr int kOverflowSlot = kLevelCount * kSlotCount;
+
+  struct Timer {
+    uint32_t generation;
+    bool active;
+    bool firing;
+    uint64_t deadline;
+    uint64_t expiry;
+    DWORD period;
+    DWORD tolerance;
+    SmallFunction<void()> func;
+    EventOwner *owner;
+    EventId hook;
+    int32_t slot;
+    int32_t prev;
+    int32_t next;
+  };
+
+  TimerId Add(DWORD delay, DWORD period, DWORD tolerance,
+              SmallFunction<void()> func, EventOwner *owner);
+  void Release(int32_t index);
+  void Schedule(int32_t index);
+  void Link(int32_t index, int32_t slot);
+  void Unlink(int32_t index);
+  int32_t Detach(int32_t slot);
+  uint64_t NextEventTime() const;
+  void Advance(uint64_t now);
+  void Fire(int32_t index);
+  void Arm();
+
+  // Timers are addressed by index, and the deque doesn't move them when it
+  // grows, so a timer may add others while it's running.
+  std::deque<Timer> timers_;
+  std::vector<int32_t> freeTimers_;
+  // Heads of the slot lists, the wheel levels followed by the overflow list
+  // for timers beyond the top level.
+  int32_t slots_[kOverflowSlot + 1];
+  uint64_t occupied_[kLevelCount];
+  // The first tick not processed yet.
+  uint64_t current_;
+  uint64_t armed_;
+  HANDLE timer_;
+};
+
+TimerService &GetTimerService();
+
+#endif  // TIMER_H_INCLUDED
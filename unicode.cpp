@@ -0,0 +1,358 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "unicode.hpp"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UNICODE_USE_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+// AVX2 code is compiled with target attributes and is selected at runtime.
+#define UNICODE_USE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+// The SIMD kernels only convert runs of ASCII characters, which dominate most
+// of the text we display. Everything else goes through the scalar decoder.
+// Each kernel converts the longest ASCII prefix of its input and returns its
+// length.
+typedef size_t (*AsciiToWideKernel)(const unsigned char *str, size_t length,
+                                    wchar_t *out);
+typedef size_t (*AsciiToUtf8Kernel)(const wchar_t *str, size_t length,
+                                    unsigned char *out);
+
+static size_t AsciiToWideScalar(const unsigned char *str, size_t length,
+                                wchar_t *out) {
+  size_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t block;
+    std::memcpy(&block, str + i, sizeof(block));
+    if (block & 0x8080808080808080ULL) {
+      break;
+    }
+    for (size_t j = 0; j < 8; ++j) {
+      out[i + j] = str[i + j];
+    }
+  }
+  while (i < length && str[i] < 0x80) {
+    out[i] = str[i];
+    ++i;
+  }
+  return i;
+}
+
+static size_t AsciiToUtf8Scalar(const wchar_t *str, size_t length,
+                                unsigned char *out) {
+  size_t i = 0;
+  while (i < length && static_cast<uint32_t>(str[i]) < 0x80) {
+    out[i] = static_cast<unsigned char>(str[i]);
+    ++i;
+  }
+  return i;
+}
+
+#ifdef UNICODE_USE_SSE2
+
+static size_t AsciiToWideSse2(const unsigned char *str, size_t length,
+                              wchar_t *out) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+    if (_mm_movemask_epi8(bytes) != 0) {
+      break;
+    }
+    __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    __m128i *dst = reinterpret_cast<__m128i *>(out + i);
+    if (sizeof(wchar_t) == 2) {
+      _mm_storeu_si128(dst, lo);
+      _mm_storeu_si128(dst + 1, hi);
+    } else {
+      _mm_storeu_si128(dst, _mm_unpacklo_epi16(lo, zero));
+      _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, zero));
+      _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, zero));
+      _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, zero));
+    }
+  }
+  return i + AsciiToWideScalar(str + i, length - i, out + i);
+}
+
+static size_t AsciiToUtf8Sse2(const wchar_t *str, size_t length,
+                              unsigned char *out) {
+  const size_t kStep = 16;
+  const size_t kVectors = kStep * sizeof(wchar_t) / sizeof(__m128i);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i nonAscii = sizeof(wchar_t) == 2
+                               ? _mm_set1_epi16(static_cast<short>(0xff80))
+                               : _mm_set1_epi32(static_cast<int>(0xffffff80));
+  size_t i = 0;
+  for (; i + kStep <= length; i += kStep) {
+    const __m128i *src = reinterpret_cast<const __m128i *>(str + i);
+    __m128i units[kVectors];
+    __m128i any = zero;
+    for (size_t j = 0; j < kVectors; ++j) {
+      units[j] = _mm_loadu_si128(src + j);
+      any = _mm_or_si128(any, units[j]);
+    }
+    any = _mm_and_si128(any, nonAscii);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xffff) {
+      break;
+    }
+    __m128i bytes;
+    if (sizeof(wchar_t) == 2) {
+      bytes = _mm_packus_epi16(units[0], units[1]);
+    } else {
+      bytes = _mm_packus_epi16(_mm_packs_epi32(units[0], units[1]),
+                               _mm_packs_epi32(units[2], units[3]));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), bytes);
+  }
+  return i + AsciiToUtf8Scalar(str + i, length - i, out + i);
+}
+
+#endif  // UNICODE_USE_SSE2
+
+#ifdef UNICODE_USE_AVX2
+
+__attribute__((target("avx2"))) static size_t AsciiToWideAvx2(
+    const unsigned char *str, size_t length, wchar_t *out) {
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(str + i));
+    if (_mm256_movemask_epi8(bytes) != 0) {
+      break;
+    }
+    __m256i *dst = reinterpret_cast<__m256i *>(out + i);
+    if (sizeof(wchar_t) == 2) {
+      __m128i lo = _mm256_castsi256_si128(bytes);
+      __m128i hi = _mm256_extracti128_si256(bytes, 1);
+      _mm256_storeu_si256(dst, _mm256_cvtepu8_epi16(lo));
+      _mm256_storeu_si256(dst + 1, _mm256_cvtepu8_epi16(hi));
+    } else {
+      for (size_t j = 0; j < 4; ++j) {
+        __m128i part =
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(str + i + 8 * j));
+        _mm256_storeu_si256(dst + j, _mm256_cvtepu8_epi32(part));
+      }
+    }
+  }
+  return i + AsciiToWideSse2(str + i, length - i, out + i);
+}
+
+__attribute__((target("avx2"))) static size_t AsciiToUtf8Avx2(
+    const wchar_t *str, size_t length, unsigned char *out) {
+  const size_t kStep = 32;
+  const size_t kVectors = kStep * sizeof(wchar_t) / sizeof(__m256i);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i nonAscii =
+      sizeof(wchar_t) == 2
+          ? _mm256_set1_epi16(static_cast<short>(0xff80))
+          : _mm256_set1_epi32(static_cast<int>(0xffffff80));
+  size_t i = 0;
+  for (; i + kStep <= length; i += kStep) {
+    const __m256i *src = reinterpret_cast<const __m256i *>(str + i);
+    __m256i units[kVectors];
+    __m256i any = zero;
+    for (size_t j = 0; j < kVectors; ++j) {
+      units[j] = _mm256_loadu_si256(src + j);
+      any = _mm256_or_si256(any, units[j]);
+    }
+    if (!_mm256_testz_si256(any, nonAscii)) {
+      break;
+    }
+    // Packing works within 128-bit lanes, so the result has to be permuted
+    // back into the original order.
+    __m256i bytes;
+    if (sizeof(wchar_t) == 2) {
+      bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(units[0], units[1]),
+                                       0xd8);
+    } else {
+      bytes = _mm256_packus_epi16(_mm256_packs_epi32(units[0], units[1]),
+                                  _mm256_packs_epi32(units[2], units[3]));
+      bytes = _mm256_permutevar8x32_epi32(
+          bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), bytes);
+  }
+  return i + AsciiToUtf8Sse2(str + i, length - i, out + i);
+}
+
+#endif  // UNICODE_USE_AVX2
+
+struct AsciiKernels {
+  AsciiToWideKernel toWide;
+  AsciiToUtf8Kernel toUtf8;
+};
+
+static AsciiKernels SelectAsciiKernels() {
+#ifdef UNICODE_USE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {AsciiToWideAvx2, AsciiToUtf8Avx2};
+  }
+#endif
+#ifdef UNICODE_USE_SSE2
+  return {AsciiToWideSse2, AsciiToUtf8Sse2};
+#else
+  return {AsciiToWideScalar, AsciiToUtf8Scalar};
+#endif
+}
+
+static const AsciiKernels &GetAsciiKernels() {
+  static const AsciiKernels kernels = SelectAsciiKernels();
+  return kernels;
+}
+
+static void ThrowInvalidUtf8() {
+  throw std::range_error("invalid UTF-8 sequence");
+}
+
+static void ThrowInvalidWide() {
+  throw std::range_error("invalid wide character sequence");
+}
+
+static inline bool IsContinuation(unsigned char byte) {
+  return (byte & 0xc0) == 0x80;
+}
+
+size_t Utf8ToWide(const char *str, size_t length, wchar_t *out) {
+  AsciiToWideKernel asciiKernel = GetAsciiKernels().toWide;
+  const unsigned char *src = reinterpret_cast<const unsigned char *>(str);
+  const unsigned char *end = src + length;
+  wchar_t *dst = out;
+  while (src != end) {
+    unsigned char lead = *src;
+    if (lead < 0x80) {
+      size_t count = asciiKernel(src, end - src, dst);
+      src += count;
+      dst += count;
+      continue;
+    }
+    uint32_t codePoint;
+    if (lead < 0xc2) {
+      // Either a stray continuation byte or an overlong two-byte sequence.
+      ThrowInvalidUtf8();
+    }
+    if (lead < 0xe0) {
+      if (end - src < 2 || !IsContinuation(src[1])) {
+        ThrowInvalidUtf8();
+      }
+      codePoint = (uint32_t(lead & 0x1f) << 6) | (src[1] & 0x3f);
+      src += 2;
+    } else if (lead < 0xf0) {
+      if (end - src < 3 || !IsContinuation(src[1]) ||
+          !IsContinuation(src[2])) {
+        ThrowInvalidUtf8();
+      }
+      codePoint = (uint32_t(lead & 0x0f) << 12) |
+                  (uint32_t(src[1] & 0x3f) << 6) | (src[2] & 0x3f);
+      if (codePoint < 0x800 || (codePoint >= 0xd800 && codePoint < 0xe000)) {
+        ThrowInvalidUtf8();
+      }
+      src += 3;
+    } else if (lead < 0xf5) {
+      if (end - src < 4 || !IsContinuation(src[1]) ||
+          !IsContinuation(src[2]) || !IsContinuation(src[3])) {
+        ThrowInvalidUtf8();
+      }
+      codePoint = (uint32_t(lead & 0x07) << 18) |
+                  (uint32_t(src[1] & 0x3f) << 12) |
+                  (uint32_t(src[2] & 0x3f) << 6) | (src[3] & 0x3f);
+      if (codePoint < 0x10000 || codePoint > 0x10ffff) {
+        ThrowInvalidUtf8();
+      }
+      src += 4;
+    } else {
+      ThrowInvalidUtf8();
+    }
+    if (sizeof(wchar_t) == 2 && codePoint >= 0x10000) {
+      codePoint -= 0x10000;
+      *dst++ = static_cast<wchar_t>(0xd800 + (codePoint >> 10));
+      *dst++ = static_cast<wchar_t>(0xdc00 + (codePoint & 0x3ff));
+    } else {
+      *dst++ = static_cast<wchar_t>(codePoint);
+    }
+  }
+  return dst - out;
+}
+
+size_t WideToUtf8(const wchar_t *str, size_t length, char *out) {
+  AsciiToUtf8Kernel asciiKernel = GetAsciiKernels().toUtf8;
+  const wchar_t *src = str;
+  const wchar_t *end = str + length;
+  unsigned char *dst = reinterpret_cast<unsigned char *>(out);
+  while (src != end) {
+    uint32_t codePoint = static_cast<uint32_t>(*src);
+    if (sizeof(wchar_t) == 2) {
+      codePoint &= 0xffff;
+    }
+    if (codePoint < 0x80) {
+      size_t count = asciiKernel(src, end - src, dst);
+      src += count;
+      dst += count;
+      continue;
+    }
+    ++src;
+    if (codePoint < 0x800) {
+      *dst++ = static_cast<unsigned char>(0xc0 | (codePoint >> 6));
+      *dst++ = static_cast<unsigned char>(0x80 | (codePoint & 0x3f));
+      continue;
+    }
+    if (codePoint >= 0xd800 && codePoint < 0xe000) {
+      if (sizeof(wchar_t) != 2 || codePoint >= 0xdc00 || src == end) {
+        ThrowInvalidWide();
+      }
+      uint32_t low = static_cast<uint32_t>(*src) & 0xffff;
+      if (low < 0xdc00 || low >= 0xe000) {
+        ThrowInvalidWide();
+      }
+      ++src;
+      codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+    }
+    if (codePoint < 0x10000) {
+      *dst++ = static_cast<unsigned char>(0xe0 | (codePoint >> 12));
+      *dst++ = static_cast<unsigned char>(0x80 | ((codePoint >> 6) & 0x3f));
+      *dst++ = static_cast<unsigned char>(0x80 | (codePoint & 0x3f));
+    } else if (codePoint <= 0x10ffff) {
+      *dst++ = static_cast<unsigned char>(0xf0 | (codePoint >> 18));
+      *dst++ = static_cast<unsigned char>(0x80 | ((codePoint >> 12) & 0x3f));
+      *dst++ = static_cast<unsigned char>(0x80 | ((codePoint >> 6) & 0x3f));
+      *dst++ = static_cast<unsigned char>(0x80 | (codePoint & 0x3f));
+    } else {
+      ThrowInvalidWide();
+    }
+  }
+  return reinterpret_cast<char *>(dst) - out;
+}
+
+void Utf8ToWideString(const std::string &str, std::wstring &out) {
+  out.resize(MaxWideLength(str.size()));
+  out.resize(Utf8ToWide(str.data(), str.size(), &out[0]));
+}
+
+void WideStringToUtf8(const std::wstring &str, std::string &out) {
+  out.resize(MaxUtf8Length(str.size()));
+  out.resize(WideToUtf8(str.data(), str.size(), &out[0]));
+}
+
+std::string WideStringToUtf8(const std::wstring &str) {
+  std::string res;
+  WideStringToUtf8(str, res);
+  return res;
+}
+
+std::wstring Utf8ToWideString(const std::string &str) {
+  std::wstring res;
+  Utf8ToWideString(str, res);
+  return res;
+}
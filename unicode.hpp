@@ -0,0 +1,37 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef UNICODE_H_INCLUDED
+#define UNICODE_H_INCLUDED
+
+#include <cstddef>
+#include <string>
+
+// Conversions between UTF-8 and wide strings (UTF-16 where wchar_t is 16 bits
+// wide, UTF-32 otherwise). All the functions validate their input and throw
+// std::range_error if it's not well-formed. They don't use any shared state,
+// so they can be called from any thread.
+
+// Upper bounds of the converted string length, in code units.
+inline size_t MaxWideLength(size_t utf8Length) { return utf8Length; }
+inline size_t MaxUtf8Length(size_t wideLength) {
+  return wideLength * (sizeof(wchar_t) == 2 ? 3 : 4);
+}
+
+// Convert into a caller-supplied buffer, which must be able to hold
+// MaxWideLength(length) or MaxUtf8Length(length) code units. The result is not
+// null-terminated. Return the number of code units written.
+size_t Utf8ToWide(const char *str, size_t length, wchar_t *out);
+size_t WideToUtf8(const wchar_t *str, size_t length, char *out);
+
+// Convert into an existing string, reusing its storage.
+void Utf8ToWideString(const std::string &str, std::wstring &out);
+void WideStringToUtf8(const std::wstring &str, std::string &out);
+
+std::string WideStringToUtf8(const std::wstring &str);
+std::wstring Utf8ToWideString(const std::string &str);
+
+#endif  // UNICODE_H_INCLUDED
@@ -0,0 +1,57 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#include "widgetarena.hpp"
+#include <algorithm>
+#include <iterator>
+
+// Widgets may be created on any thread which runs a message loop, so each
+// thread has its own current arena.
+static thread_local std::pmr::memory_resource *g_arenaResource =
+    std::pmr::new_delete_resource();
+
+WidgetArena::WidgetArena(size_t chunkSize)
+    : chunks_(chunkSize, std::pmr::new_delete_resource()) {
+  std::fill(std::begin(freeBlocks_), std::end(freeBlocks_), nullptr);
+}
+
+void *WidgetArena::do_allocate(size_t bytes, size_t alignment) {
+  if (bytes > kMaxBlockSize || alignment > kGranularity) {
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  size_t index = bytes == 0 ? 0 : (bytes - 1) / kGranularity;
+  FreeBlock *block = freeBlocks_[index];
+  if (block != nullptr) {
+    freeBlocks_[index] = block->next;
+    return block;
+  }
+  return chunks_.allocate((index + 1) * kGranularity, kGranularity);
+}
+
+void WidgetArena::do_deallocate(void *ptr, size_t bytes, size_t alignment) {
+  if (bytes > kMaxBlockSize || alignment > kGranularity) {
+    std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    return;
+  }
+  size_t index = bytes == 0 ? 0 : (bytes - 1) / kGranularity;
+  FreeBlock *block = static_cast<FreeBlock *>(ptr);
+  block->next = freeBlocks_[index];
+  freeBlocks_[index] = block;
+}
+
+bool WidgetArena::do_is_equal(
+    const std::pmr::memory_resource &other) const noexcept {
+  return this == &other;
+}
+
+WidgetArenaScope::WidgetArenaScope(WidgetArena &arena)
+    : prevResource_(g_arenaResource) {
+  g_arenaResource = &arena;
+}
+
+WidgetArenaScope::~WidgetArenaScope() { g_arenaResource = prevResource_; }
+
+std::pmr::memory_resource *CurrentArenaResource() { return g_arenaResource; }
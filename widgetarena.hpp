@@ -0,0 +1,72 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef WIDGETARENA_H_INCLUDED
+#define WIDGETARENA_H_INCLUDED
+
+#include <cstddef>
+#include <memory_resource>
+
+// Memory pool for the widgets of one window. While the arena is current (see
+// WidgetArenaScope), widgets created with new are placed into it, together
+// with the subscription lists of the event handlers and owners constructed
+// at that time. The objects are packed into large chunks one after another,
+// and the blocks of deleted ones are reused for the new objects of the same
+// size. All the memory is released at once when the arena is destroyed, so
+// it must outlive everything allocated from it: declare the arena before the
+// window.
+class WidgetArena : public std::pmr::memory_resource {
+ public:
+  // The arena takes memory from the system in chunks of at least this size.
+  static constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+  explicit WidgetArena(size_t chunkSize = kDefaultChunkSize);
+  WidgetArena(const WidgetArena &) = delete;
+  WidgetArena(WidgetArena &&) = delete;
+  WidgetArena &operator=(const WidgetArena &) = delete;
+  WidgetArena &operator=(WidgetArena &&) = delete;
+
+ protected:
+  void *do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void *ptr, size_t bytes, size_t alignment) override;
+  bool do_is_equal(
+      const std::pmr::memory_resource &other) const noexcept override;
+
+ private:
+  // Block sizes are rounded up to this granularity only, not to powers of
+  // two, so the objects of a large tree don't map to the same cache sets.
+  static constexpr size_t kGranularity = alignof(std::max_align_t);
+  // Larger blocks, e.g. the lists of popular events, are taken from the heap.
+  static constexpr size_t kMaxBlockSize = 1024;
+
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  std::pmr::monotonic_buffer_resource chunks_;
+  // Lists of the freed blocks, by size.
+  FreeBlock *freeBlocks_[kMaxBlockSize / kGranularity];
+};
+
+// Makes the arena current while the object is alive. Scopes may be nested,
+// the previous arena becomes current again when the inner one ends.
+class WidgetArenaScope {
+ public:
+  explicit WidgetArenaScope(WidgetArena &arena);
+  WidgetArenaScope(const WidgetArenaScope &) = delete;
+  WidgetArenaScope(WidgetArenaScope &&) = delete;
+  WidgetArenaScope &operator=(const WidgetArenaScope &) = delete;
+  WidgetArenaScope &operator=(WidgetArenaScope &&) = delete;
+  ~WidgetArenaScope();
+
+ private:
+  std::pmr::memory_resource *prevResource_;
+};
+
+// Resource of the current arena of this thread, or the heap if there is none.
+std::pmr::memory_resource *CurrentArenaResource();
+
+#endif  // WIDGETARENA_H_INCLUDED
@@ -0,0 +1,21 @@
+/*
+ * This file is part of WinUtil.
+ * This software is public domain. See UNLICENSE for more information.
+ * WinUtil was created by Alexander Kernozhitsky.
+ */
+
+#ifndef WIN32API_H_INCLUDED
+#define WIN32API_H_INCLUDED
+
+// The system interface of the library. It's the real Win32 API, or the
+// headless in-memory implementation from headless.hpp if WINUTIL_HEADLESS is
+// defined. Sources include this header instead of <windows.h>.
+
+#ifdef WINUTIL_HEADLESS
+#include "headless.hpp"
+#else
+#include <windows.h>
+#include <commctrl.h>
+#endif
+
+#endif  // WIN32API_H_INCLUDED
@@ -5,27 +5,88 @@
  */
 
 #include "winutil.hpp"
-#include <commctrl.h>
+#include "fontmetrics.hpp"
+#include <algorithm>
 #include <cassert>
-#include <codecvt>
-#include <locale>
-#include <map>
+#include <stdexcept>
 #include <string>
+#include <typeinfo>
 
 HINSTANCE g_hInstance;
-static std::map<HWND, CustomWindow *> g_Windows;
+
+// Number of live DeferredCreationScope objects.
+static int g_deferredCreationDepth = 0;
+// Number of widgets without a window, so showing a widget doesn't need to
+// look for deferred children if there are none.
+static size_t g_deferredWidgetCount = 0;
+
+// Each window created by a widget keeps the pointer to it in GWLP_USERDATA.
+inline Widget *GetWindowWidget(HWND hWnd) {
+  return reinterpret_cast<Widget *>(GetWindowLongPtrW(hWnd, GWLP_USERDATA));
+}
+
+// Runs the coalesced calls while a window is being resized or moved.
+static const UINT_PTR kCoalescingTimer = 0x57A1;
 
 bool HandleWindow(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam,
                   LRESULT &result) {
-  if (g_Windows.count(hWnd) &&
-      g_Windows.at(hWnd)->HandleMessage(message, wParam, lParam, result)) {
-    return true;
+  switch (message) {
+    case WM_PAINT: {
+      // Coalesced subscribers may change what is painted.
+      RunCoalescedCalls();
+      break;
+    }
+    case WM_ENTERSIZEMOVE: {
+      // The modal loop of a drag doesn't run the main loop, and a window
+      // which is only shrinking gets no WM_PAINT.
+      SetTimer(hWnd, kCoalescingTimer, CoalescePolicy::kFrameTime, nullptr);
+      break;
+    }
+    case WM_EXITSIZEMOVE: {
+      KillTimer(hWnd, kCoalescingTimer);
+      break;
+    }
+    case WM_TIMER: {
+      if (wParam == kCoalescingTimer) {
+        RunCoalescedCalls();
+        result = 0;
+        return true;
+      }
+      break;
+    }
   }
-  return false;
+  Widget *widget = GetWindowWidget(hWnd);
+  return widget != nullptr &&
+         widget->RouteMessage(message, wParam, lParam, result);
+}
+
+// Same as the window procedures below, but also measures the time spent in
+// the handlers and in the default procedure.
+template <typename DefaultProc>
+static LRESULT HandleWindowProfiled(HWND hWnd, UINT message, WPARAM wParam,
+                                    LPARAM lParam, DefaultProc defaultProc) {
+  Widget *widget = GetWindowWidget(hWnd);
+  const char *name = widget != nullptr ? typeid(*widget).name() : nullptr;
+  ProfileDispatchReceived(hWnd, message, name);
+  LRESULT result = 0;
+  int64_t start = ProfilerClock();
+  bool handled = HandleWindow(hWnd, message, wParam, lParam, result);
+  int64_t finish = ProfilerClock();
+  RecordProfile(ProfileCategory::Handler, message, name, finish - start);
+  if (handled) {
+    return result;
+  }
+  result = defaultProc(hWnd, message, wParam, lParam);
+  RecordProfile(ProfileCategory::DefaultProc, message, name,
+                ProfilerClock() - finish);
+  return result;
 }
 
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam,
                          LPARAM lParam) {
+  if (IsProfilingEnabled()) {
+    return HandleWindowProfiled(hWnd, message, wParam, lParam, DefWindowProcW);
+  }
   LRESULT result = 0;
   if (HandleWindow(hWnd, message, wParam, lParam, result)) {
     return result;
@@ -35,7 +96,18 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam,
 
 LRESULT CALLBACK SubclassProc(HWND hWnd, UINT message, WPARAM wParam,
                               LPARAM lParam) {
-  WNDPROC origWindowProc = (WNDPROC)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+  // The handlers may destroy the widget, so the original procedure is read
+  // first.
+  Widget *widget = GetWindowWidget(hWnd);
+  WNDPROC origWindowProc =
+      widget != nullptr ? widget->origWndProc_ : DefWindowProcW;
+  if (IsProfilingEnabled()) {
+    auto defaultProc = [origWindowProc](HWND hWnd, UINT message,
+                                        WPARAM wParam, LPARAM lParam) {
+      return CallWindowProcW(origWindowProc, hWnd, message, wParam, lParam);
+    };
+    return HandleWindowProfiled(hWnd, message, wParam, lParam, defaultProc);
+  }
   LRESULT result = 0;
   if (HandleWindow(hWnd, message, wParam, lParam, result)) {
     return result;
@@ -43,21 +115,20 @@ LRESULT CALLBACK SubclassProc(HWND hWnd, UINT message, WPARAM wParam,
   return CallWindowProcW(origWindowProc, hWnd, message, wParam, lParam);
 }
 
-void SubclassWindow(HWND hWnd) {
-  WNDPROC oldWndProc =
-      (WNDPROC)SetWindowLongPtr(hWnd, GWLP_WNDPROC, (LONG_PTR)SubclassProc);
-  SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)oldWndProc);
+WNDPROC SubclassWindow(HWND hWnd) {
+  return (WNDPROC)SetWindowLongPtrW(hWnd, GWLP_WNDPROC, (LONG_PTR)SubclassProc);
 }
 
-void RegisterBaseWindowClass() {
-  WNDCLASSEXW wndClass = {0};
+// The classes don't have CS_HREDRAW and CS_VREDRAW, so resizing a window only
+// repaints the newly exposed area.
+void RegisterWindowClass(LPCWSTR className, HBRUSH background) {
+  WNDCLASSEXW wndClass = {};
   wndClass.cbSize = sizeof(WNDCLASSEXW);
   wndClass.lpfnWndProc = (WNDPROC)WndProc;
   wndClass.hInstance = g_hInstance;
-  wndClass.hbrBackground = GetSysColorBrush(COLOR_3DFACE);
-  wndClass.lpszClassName = L"BaseWindow";
+  wndClass.hbrBackground = background;
+  wndClass.lpszClassName = className;
   wndClass.hCursor = LoadCursor(NULL, IDC_ARROW);
-  wndClass.style = CS_HREDRAW | CS_VREDRAW;
   if (RegisterClassExW(&wndClass) == 0) {
     throw WindowsError("unable to register window class");
   }
@@ -65,82 +136,226 @@ void RegisterBaseWindowClass() {
 
 void InitApplication(HINSTANCE hInstance) {
   g_hInstance = hInstance;
-  RegisterBaseWindowClass();
+  INITCOMMONCONTROLSEX controls = {sizeof(INITCOMMONCONTROLSEX),
+                                   ICC_LISTVIEW_CLASSES};
+  InitCommonControlsEx(&controls);
+  RegisterWindowClass(L"BaseWindow", GetSysColorBrush(COLOR_3DFACE));
+  // Paint boxes fill the whole background themselves.
+  RegisterWindowClass(L"PaintBox", nullptr);
+  GetDispatcher().Init(hInstance);
 }
 
-int StartMainLoop() {
-  MSG msg = {0};
-  int msgStatus = 0;
-  while ((msgStatus = GetMessage(&msg, NULL, 0, 0))) {
-    if (msgStatus == -1) {
-      return 1;
-    }
-    if (IsDialogMessage(GetActiveWindow(), &msg)) {
-      continue;
-    }
-    TranslateMessage(&msg);
-    DispatchMessage(&msg);
+int StartMainLoop() { return GetMainLoop().Run(); }
+
+MessageHandler MessageMapView::Find(UINT message) const {
+  const MessageMapEntry *entry = std::lower_bound(
+      begin_, end_, message, [](const MessageMapEntry &entry, UINT message) {
+        return entry.message < message;
+      });
+  if (entry == end_ || entry->message != message) {
+    return nullptr;
   }
-  return static_cast<int>(msg.wParam);
+  return entry->handler;
+}
+
+bool Widget::RouteMessage(UINT message, WPARAM wParam, LPARAM lParam,
+                          LRESULT &result) {
+  MessageHandler handler = GetMessageMap().Find(message);
+  return handler != nullptr && handler(this, wParam, lParam, result);
 }
 
-bool Widget::HandleMessage(UINT, WPARAM, LPARAM, LRESULT &) { return false; }
+// Each block starts with the resource it was allocated from, so widgets are
+// freed correctly whatever arena is current when they are deleted.
+static constexpr size_t kWidgetBlockHeader = alignof(std::max_align_t);
+
+void *Widget::operator new(size_t size) {
+  std::pmr::memory_resource *resource = CurrentArenaResource();
+  void *block =
+      resource->allocate(size + kWidgetBlockHeader, kWidgetBlockHeader);
+  *static_cast<std::pmr::memory_resource **>(block) = resource;
+  return static_cast<char *>(block) + kWidgetBlockHeader;
+}
+
+void Widget::operator delete(void *ptr, size_t size) {
+  if (ptr == nullptr) {
+    return;
+  }
+  void *block = static_cast<char *>(ptr) - kWidgetBlockHeader;
+  std::pmr::memory_resource *resource =
+      *static_cast<std::pmr::memory_resource **>(block);
+  resource->deallocate(block, size + kWidgetBlockHeader, kWidgetBlockHeader);
+}
 
 void Widget::AddChild(Widget *widget) {
-  assert(!children_.count(widget->widgetId_));
-  children_[widget->widgetId_] = widget;
+  size_t index = reinterpret_cast<intptr_t>(widget->widgetId_) - 1;
+  if (index >= children_.size()) {
+    children_.resize(index + 1);
+  }
+  assert(children_[index] == nullptr);
+  children_[index] = widget;
+  widget->prevSibling_ = lastChild_;
+  if (lastChild_ != nullptr) {
+    lastChild_->nextSibling_ = widget;
+  } else {
+    firstChild_ = widget;
+  }
+  lastChild_ = widget;
 }
 
 void Widget::DeleteChild(Widget *widget) {
-  assert(children_.count(widget->widgetId_));
-  children_.erase(widget->widgetId_);
+  intptr_t id = reinterpret_cast<intptr_t>(widget->widgetId_);
+  assert(children_[id - 1] == widget);
+  children_[id - 1] = nullptr;
+  freeChildIds_.push_back(id);
+  if (widget->prevSibling_ != nullptr) {
+    widget->prevSibling_->nextSibling_ = widget->nextSibling_;
+  } else {
+    firstChild_ = widget->nextSibling_;
+  }
+  if (widget->nextSibling_ != nullptr) {
+    widget->nextSibling_->prevSibling_ = widget->prevSibling_;
+  } else {
+    lastChild_ = widget->prevSibling_;
+  }
+  widget->prevSibling_ = nullptr;
+  widget->nextSibling_ = nullptr;
 }
 
 HMENU Widget::GenerateChildId() {
-  return reinterpret_cast<HMENU>(++lastChildId_);
+  // Reuse the ids of deleted children to keep the table dense.
+  if (!freeChildIds_.empty()) {
+    intptr_t id = freeChildIds_.back();
+    freeChildIds_.pop_back();
+    return reinterpret_cast<HMENU>(id);
+  }
+  return reinterpret_cast<HMENU>(children_.size() + 1);
+}
+
+DeferredCreationScope::DeferredCreationScope() { ++g_deferredCreationDepth; }
+
+DeferredCreationScope::~DeferredCreationScope() {
+  --g_deferredCreationDepth;
+}
+
+static bool ShouldDeferCreation(Widget *parent, DWORD style) {
+  if (g_deferredCreationDepth == 0) {
+    return false;
+  }
+  if (!(style & WS_VISIBLE)) {
+    return true;
+  }
+  return parent != nullptr &&
+         (!parent->IsRealized() || !IsWindowVisible(parent->Handle()));
 }
 
 Widget::Widget(Widget *parent, const LPCWSTR wndClass, POINT pos, SIZE size,
                Widget::WidgetCreationOptions options)
-    : wndClass(wndClass), widgetId_(nullptr), parent_(parent), lastChildId_(0) {
+    : wndClass(wndClass),
+      hWnd_(0),
+      widgetId_(nullptr),
+      parent_(parent),
+      firstChild_(nullptr),
+      lastChild_(nullptr),
+      nextSibling_(nullptr),
+      prevSibling_(nullptr),
+      origWndProc_(nullptr),
+      updateDepth_(0),
+      tearingDown_(false) {
   if (parent_ != nullptr) {
     options.dwStyle |= WS_CHILD;
     widgetId_ = parent_->GenerateChildId();
   }
-  hWnd_ =
-      CreateWindowExW(options.dwExStyle, wndClass, options.lpWindowName.c_str(),
-                      options.dwStyle, pos.x, pos.y, size.cx, size.cy,
-                      parent == nullptr ? 0 : parent->Handle(), widgetId_,
-                      g_hInstance, options.lpParam);
-  if (hWnd_ == 0) {
+  RECT bounds = {pos.x, pos.y, pos.x + size.cx, pos.y + size.cy};
+  if (ShouldDeferCreation(parent_, options.dwStyle)) {
+    deferred_.reset(new DeferredState{std::move(options), bounds});
+    ++g_deferredWidgetCount;
+  } else {
+    CreateHandle(options, bounds);
+  }
+  if (parent_ != nullptr) {
+    parent_->AddChild(this);
+  }
+}
+
+void Widget::CreateHandle(const WidgetCreationOptions &options,
+                          const RECT &bounds) {
+  HWND hWnd = CreateWindowExW(
+      options.dwExStyle, wndClass, options.lpWindowName.c_str(),
+      options.dwStyle, bounds.left, bounds.top, bounds.right - bounds.left,
+      bounds.bottom - bounds.top, parent_ == nullptr ? 0 : parent_->Handle(),
+      widgetId_, g_hInstance, options.lpParam);
+  if (hWnd == 0) {
     throw WindowsError("could not create window");
   }
+  hWnd_ = hWnd;
+  SetWindowLongPtrW(hWnd_, GWLP_USERDATA, (LONG_PTR)this);
   if (options.subclassWindow) {
-    SubclassWindow(hWnd_);
+    origWndProc_ = SubclassWindow(hWnd_);
   }
   SendMessage(hWnd_, WM_SETFONT, (LPARAM)GetStockObject(DEFAULT_GUI_FONT),
               true);
-  if (parent_ != nullptr) {
-    parent_->AddChild(this);
+}
+
+void Widget::Realize() {
+  if (hWnd_ != 0) {
+    return;
+  }
+  CreateHandle(deferred_->options, deferred_->bounds);
+  deferred_.reset();
+  --g_deferredWidgetCount;
+  if (updateDepth_ > 0) {
+    SendMessageW(hWnd_, WM_SETREDRAW, false, 0);
+  }
+  OnRealize();
+}
+
+void Widget::RealizeVisibleChildren() {
+  // Children are created in the order they were added, which keeps the tab
+  // order of the deferred siblings.
+  for (Widget *child = firstChild_; child != nullptr;
+       child = child->nextSibling_) {
+    if (child->hWnd_ == 0) {
+      if (!(child->deferred_->options.dwStyle & WS_VISIBLE)) {
+        continue;
+      }
+      child->Realize();
+    } else if (!(GetWindowLongPtrW(child->hWnd_, GWL_STYLE) & WS_VISIBLE)) {
+      continue;
+    }
+    child->RealizeVisibleChildren();
   }
 }
 
 Widget *Widget::FindWidget(HMENU widgetId) {
-  if (children_.count(widgetId)) {
-    return children_.at(widgetId);
+  size_t index = reinterpret_cast<intptr_t>(widgetId) - 1;
+  if (index < children_.size()) {
+    return children_[index];
   }
   return nullptr;
 }
 
 Widget::~Widget() {
-  while (!children_.empty()) {
-    Widget *child = children_.begin()->second;
-    delete child;
-  }
-  if (parent_ != nullptr) {
+  // The whole subtree is being deleted if the parent is torn down, so there
+  // is no need to unlink from it or to destroy the window, which is already
+  // gone with the parent's one.
+  bool parentTearingDown = parent_ != nullptr && parent_->tearingDown_;
+  if (parent_ != nullptr && !parentTearingDown) {
     parent_->DeleteChild(this);
   }
-  DestroyWindow(hWnd_);
+  if (hWnd_ == 0) {
+    --g_deferredWidgetCount;
+  } else if (!parentTearingDown) {
+    // Destroys the windows of all the descendants too. They still have their
+    // widgets to receive WM_DESTROY.
+    DestroyWindow(hWnd_);
+  }
+  tearingDown_ = true;
+  Widget *child = firstChild_;
+  while (child != nullptr) {
+    Widget *next = child->nextSibling_;
+    delete child;
+    child = next;
+  }
 }
 
 void Widget::MoveToCenter() {
@@ -152,6 +367,9 @@ void Widget::MoveToCenter() {
 }
 
 POINT Widget::GetPosition() {
+  if (deferred_ != nullptr) {
+    return {deferred_->bounds.left, deferred_->bounds.top};
+  }
   RECT rect;
   GetWindowRect(hWnd_, &rect);
   POINT res{rect.left, rect.top};
@@ -162,36 +380,190 @@ POINT Widget::GetPosition() {
 }
 
 SIZE Widget::GetSize() {
+  if (deferred_ != nullptr) {
+    const RECT &bounds = deferred_->bounds;
+    return {bounds.right - bounds.left, bounds.bottom - bounds.top};
+  }
   RECT rect;
   GetWindowRect(hWnd_, &rect);
   return {rect.right - rect.left, rect.bottom - rect.top};
 }
 
 void Widget::SetPosition(const POINT &p) {
-  SIZE size = GetSize();
-  MoveWindow(hWnd_, p.x, p.y, size.cx, size.cy, true);
+  if (deferred_ != nullptr) {
+    RECT &bounds = deferred_->bounds;
+    bounds = {p.x, p.y, p.x + bounds.right - bounds.left,
+              p.y + bounds.bottom - bounds.top};
+    return;
+  }
+  SetWindowPos(hWnd_, 0, p.x, p.y, 0, 0,
+               SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE);
 }
 
 void Widget::SetSize(const SIZE &sz) {
-  POINT pos = GetPosition();
-  MoveWindow(hWnd_, pos.x, pos.y, sz.cx, sz.cy, true);
+  if (deferred_ != nullptr) {
+    RECT &bounds = deferred_->bounds;
+    bounds.right = bounds.left + sz.cx;
+    bounds.bottom = bounds.top + sz.cy;
+    return;
+  }
+  SetWindowPos(hWnd_, 0, 0, 0, sz.cx, sz.cy,
+               SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
+}
+
+void Widget::SetBounds(const RECT &rect) {
+  if (deferred_ != nullptr) {
+    deferred_->bounds = rect;
+    return;
+  }
+  SetWindowPos(hWnd_, 0, rect.left, rect.top, rect.right - rect.left,
+               rect.bottom - rect.top, SWP_NOZORDER | SWP_NOACTIVATE);
+}
+
+// Scratch buffer for the text which has to be converted or null-terminated
+// before passing it to the system.
+static std::wstring &TextBuffer() {
+  static thread_local std::wstring buffer;
+  return buffer;
+}
+
+size_t Widget::GetTitleLength() {
+  if (deferred_ != nullptr) {
+    return deferred_->options.lpWindowName.size();
+  }
+  return GetWindowTextLengthW(hWnd_);
 }
 
 std::wstring Widget::GetTitle() {
-  wchar_t buf[1000];
-  GetWindowTextW(hWnd_, buf, 1000);
-  return std::wstring(buf);
+  std::wstring title;
+  GetTitle(title);
+  return title;
+}
+
+void Widget::GetTitle(std::wstring &title) {
+  // The length may be overestimated, so shrink the string afterwards.
+  title.resize(GetTitleLength());
+  title.resize(GetTitle(&title[0], title.size() + 1));
+}
+
+size_t Widget::GetTitle(wchar_t *buffer, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  if (deferred_ != nullptr) {
+    const std::wstring &title = deferred_->options.lpWindowName;
+    size_t length = std::min(title.size(), size - 1);
+    std::copy_n(title.data(), length, buffer);
+    buffer[length] = 0;
+    return length;
+  }
+  return GetWindowTextW(hWnd_, buffer, static_cast<int>(size));
+}
+
+std::string Widget::GetTitleUtf8() {
+  std::string title;
+  GetTitleUtf8(title);
+  return title;
+}
+
+void Widget::GetTitleUtf8(std::string &title) {
+  std::wstring &buffer = TextBuffer();
+  GetTitle(buffer);
+  title.resize(MaxUtf8Length(buffer.size()));
+  title.resize(WideToUtf8(buffer.data(), buffer.size(), &title[0]));
+}
+
+void Widget::ApplyTitle(const wchar_t *title) {
+  if (deferred_ != nullptr) {
+    deferred_->options.lpWindowName = title;
+    return;
+  }
+  SetWindowTextW(hWnd_, title);
+}
+
+void Widget::SetTitle(const wchar_t *title) { ApplyTitle(title); }
+
+void Widget::SetTitle(const std::wstring &title) { ApplyTitle(title.c_str()); }
+
+void Widget::SetTitle(std::wstring_view title) {
+  std::wstring &buffer = TextBuffer();
+  buffer.assign(title);
+  ApplyTitle(buffer.c_str());
+}
+
+void Widget::SetTitleUtf8(std::string_view title) {
+  std::wstring &buffer = TextBuffer();
+  buffer.resize(MaxWideLength(title.size()));
+  buffer.resize(Utf8ToWide(title.data(), title.size(), &buffer[0]));
+  ApplyTitle(buffer.c_str());
+}
+
+void Widget::SetEnabled(bool enable) {
+  if (deferred_ != nullptr) {
+    DWORD &style = deferred_->options.dwStyle;
+    style = enable ? style & ~WS_DISABLED : style | WS_DISABLED;
+    return;
+  }
+  EnableWindow(hWnd_, enable);
+}
+
+GeometryBatch::GeometryBatch(int expectedCount)
+    : hDwp_(BeginDeferWindowPos(expectedCount)) {}
+
+GeometryBatch::~GeometryBatch() { Apply(); }
+
+void GeometryBatch::Move(Widget &widget, const RECT &rect) {
+  if (hDwp_ != 0 && widget.IsRealized()) {
+    // On failure the whole batch is dropped, so redo it item by item.
+    HDWP hDwp = DeferWindowPos(hDwp_, widget.Handle(), 0, rect.left, rect.top,
+                               rect.right - rect.left, rect.bottom - rect.top,
+                               SWP_NOZORDER | SWP_NOACTIVATE);
+    if (hDwp != 0) {
+      hDwp_ = hDwp;
+      moved_.push_back({&widget, rect});
+      return;
+    }
+    hDwp_ = 0;
+    for (const Item &item : moved_) {
+      item.widget->SetBounds(item.rect);
+    }
+    moved_.clear();
+  }
+  widget.SetBounds(rect);
 }
 
-void Widget::SetTitle(const std::wstring &title) {
-  SetWindowTextW(hWnd_, title.c_str());
+void GeometryBatch::Apply() {
+  if (hDwp_ != 0) {
+    EndDeferWindowPos(hDwp_);
+    hDwp_ = 0;
+  }
+  moved_.clear();
 }
 
-void Widget::SetEnabled(bool enable) { EnableWindow(hWnd_, enable); }
+void Widget::BeginUpdate() {
+  if (updateDepth_++ == 0 && hWnd_ != 0) {
+    SendMessageW(hWnd_, WM_SETREDRAW, false, 0);
+  }
+}
+
+void Widget::EndUpdate() {
+  assert(updateDepth_ > 0);
+  if (--updateDepth_ == 0 && hWnd_ != 0) {
+    SendMessageW(hWnd_, WM_SETREDRAW, true, 0);
+    InvalidateRect(hWnd_, nullptr, true);
+  }
+}
 
 void Widget::SetBorder(BorderStyle borderStyle) {
-  LONG_PTR extStyle = GetWindowLongPtrW(Handle(), GWL_EXSTYLE);
-  LONG_PTR style = GetWindowLongPtrW(Handle(), GWL_STYLE);
+  LONG_PTR extStyle;
+  LONG_PTR style;
+  if (deferred_ != nullptr) {
+    extStyle = deferred_->options.dwExStyle;
+    style = deferred_->options.dwStyle;
+  } else {
+    extStyle = GetWindowLongPtrW(hWnd_, GWL_EXSTYLE);
+    style = GetWindowLongPtrW(hWnd_, GWL_STYLE);
+  }
   extStyle &= ~WS_EX_CLIENTEDGE;
   extStyle &= ~WS_EX_STATICEDGE;
   style &= ~WS_BORDER;
@@ -213,16 +585,19 @@ void Widget::SetBorder(BorderStyle borderStyle) {
       break;
     }
   }
-  SetWindowLongPtrW(Handle(), GWL_EXSTYLE, extStyle);
-  SetWindowLongPtrW(Handle(), GWL_STYLE, style);
+  if (deferred_ != nullptr) {
+    deferred_->options.dwExStyle = static_cast<DWORD>(extStyle);
+    deferred_->options.dwStyle = static_cast<DWORD>(style);
+    return;
+  }
+  SetWindowLongPtrW(hWnd_, GWL_EXSTYLE, extStyle);
+  SetWindowLongPtrW(hWnd_, GWL_STYLE, style);
 }
 
 CustomWindow::CustomWindow(Widget *parent, POINT pos, SIZE size,
                            Widget::WidgetCreationOptions options,
                            const LPCWSTR wndClass)
-    : Widget(parent, wndClass, pos, size, options) {
-  g_Windows[Handle()] = this;
-}
+    : Widget(parent, wndClass, pos, size, options) {}
 
 Window::Window(Widget *parent, SIZE size, bool isMainWindow)
     : CustomWindow(parent, {0, 0}, size, GetCreationOptions(isMainWindow)),
@@ -230,51 +605,54 @@ Window::Window(Widget *parent, SIZE size, bool isMainWindow)
   MoveToCenter();
 }
 
-bool CustomWindow::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam,
+bool CustomWindow::HandleClose(WPARAM, LPARAM, LRESULT &) {
+  OnClose.Activate();
+  return false;
+}
+
+bool CustomWindow::HandleCommand(WPARAM wParam, LPARAM lParam,
                                  LRESULT &result) {
-  switch (message) {
-    case WM_CLOSE: {
-      OnClose.Activate();
-      break;
-    }
-    case WM_COMMAND: {
-      intptr_t item = LOWORD(wParam);
-      Widget *widget = FindWidget((HMENU)item);
-      if (widget == nullptr) {
-        return false;
-      }
-      if (widget->HandleMessage(message, wParam, lParam, result)) {
-        return true;
-      }
-      break;
-    }
-    case WM_SIZE: {
-      OnResize.Activate();
-      break;
-    }
-  }
+  intptr_t item = LOWORD(wParam);
+  Widget *widget = FindWidget((HMENU)item);
+  return widget != nullptr &&
+         widget->RouteMessage(WM_COMMAND, wParam, lParam, result);
+}
+
+bool CustomWindow::HandleDrawItem(WPARAM wParam, LPARAM lParam,
+                                  LRESULT &result) {
+  Widget *widget = FindWidget((HMENU)wParam);
+  return widget != nullptr &&
+         widget->RouteMessage(WM_DRAWITEM, wParam, lParam, result);
+}
+
+bool CustomWindow::HandleNotify(WPARAM wParam, LPARAM lParam,
+                                LRESULT &result) {
+  const NMHDR *header = reinterpret_cast<const NMHDR *>(lParam);
+  Widget *widget = FindWidget((HMENU)header->idFrom);
+  return widget != nullptr &&
+         widget->RouteMessage(WM_NOTIFY, wParam, lParam, result);
+}
+
+bool CustomWindow::HandleSize(WPARAM, LPARAM, LRESULT &) {
+  OnResize.Activate();
   return false;
 }
 
-bool Window::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam,
-                           LRESULT &result) {
-  if (CustomWindow::HandleMessage(message, wParam, lParam, result)) {
+void CustomWindow::OnRealize() { OnResize.Activate(); }
+
+bool Window::HandleClose(WPARAM wParam, LPARAM lParam, LRESULT &result) {
+  if (CustomWindow::HandleClose(wParam, lParam, result)) {
     return true;
   }
-  switch (message) {
-    case WM_CLOSE: {
-      if (isMainWindow_) {
-        PostQuitMessage(0);
-        return true;
-      }
-      break;
-    }
+  if (isMainWindow_) {
+    PostQuitMessage(0);
+    return true;
   }
   return false;
 }
 
 Widget::WidgetCreationOptions Window::GetCreationOptions(bool isMainWindow) {
-  WidgetCreationOptions options = {0};
+  WidgetCreationOptions options = {};
   options.lpWindowName = L"Window";
   options.dwExStyle = WS_EX_CONTROLPARENT;
   options.dwStyle = WS_OVERLAPPEDWINDOW;
@@ -284,23 +662,39 @@ Widget::WidgetCreationOptions Window::GetCreationOptions(bool isMainWindow) {
   return options;
 }
 
-CustomWindow::~CustomWindow() { g_Windows.erase(Handle()); }
-
-void Widget::Hide() { ShowWindow(Handle(), SW_HIDE); }
+void Widget::Hide() {
+  if (deferred_ != nullptr) {
+    deferred_->options.dwStyle &= ~WS_VISIBLE;
+    return;
+  }
+  ShowWindow(hWnd_, SW_HIDE);
+}
 
-void Widget::Show() { ShowWindow(Handle(), SW_SHOW); }
+void Widget::Show() {
+  if (deferred_ != nullptr) {
+    deferred_->options.dwStyle |= WS_VISIBLE;
+    Realize();
+  } else {
+    ShowWindow(hWnd_, SW_SHOW);
+  }
+  if (g_deferredWidgetCount > 0) {
+    RealizeVisibleChildren();
+  }
+}
 
-SIZE GetTextSize(HWND hWnd, const std::wstring &text) {
-  HDC dc = GetDC(hWnd);
-  SIZE size;
-  GetTextExtentPoint32W(dc, text.c_str(), static_cast<int>(text.size()), &size);
-  ReleaseDC(hWnd, dc);
-  return size;
+// Metrics of the font the widget really draws with. Deferred widgets will get
+// the default font on creation.
+static FontMetrics &GetWidgetFontMetrics(Widget &widget) {
+  if (!widget.IsRealized()) {
+    return GetFontMetrics(static_cast<HFONT>(GetStockObject(DEFAULT_GUI_FONT)));
+  }
+  return GetFontMetrics(reinterpret_cast<HFONT>(
+      SendMessageW(widget.Handle(), WM_GETFONT, 0, 0)));
 }
 
 Label::Label(Widget *parent, POINT pos, const std::wstring &title)
     : Widget(parent, L"Static", pos, {1, 1}, GetCreationOptions(title)) {
-  SIZE size = GetTextSize(Handle(), title);
+  SIZE size = GetWidgetFontMetrics(*this).Measure(title);
   size.cx += 2;
   size.cy += 2;
   SetSize(size);
@@ -308,7 +702,7 @@ Label::Label(Widget *parent, POINT pos, const std::wstring &title)
 
 Widget::WidgetCreationOptions Label::GetCreationOptions(
     const std::wstring &title) {
-  WidgetCreationOptions options = {0};
+  WidgetCreationOptions options = {};
   options.dwStyle = WS_VISIBLE;
   options.lpWindowName = title.c_str();
   return options;
@@ -316,7 +710,7 @@ Widget::WidgetCreationOptions Label::GetCreationOptions(
 
 Widget::WidgetCreationOptions Button::GetCreationOptions(
     const std::wstring &title) {
-  WidgetCreationOptions options = {0};
+  WidgetCreationOptions options = {};
   options.dwStyle = WS_VISIBLE | WS_TABSTOP;
   options.lpWindowName = title.c_str();
   return options;
@@ -324,30 +718,21 @@ Widget::WidgetCreationOptions Button::GetCreationOptions(
 
 Button::Button(Widget *parent, POINT pos, const std::wstring &title)
     : Widget(parent, L"Button", pos, {1, 1}, GetCreationOptions(title)) {
-  SIZE size = GetTextSize(Handle(), title);
+  SIZE size = GetWidgetFontMetrics(*this).Measure(title);
   size.cx += 16;
   size.cy += 8;
   SetSize(size);
 }
 
-bool Button::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam,
-                           LRESULT &result) {
-  UNREFERENCED_PARAMETER(wParam);
-  UNREFERENCED_PARAMETER(lParam);
-  switch (message) {
-    case WM_COMMAND: {
-      OnClick.Activate();
-      result = 0;
-      return true;
-      break;
-    }
-  }
-  return false;
+bool Button::HandleCommand(WPARAM, LPARAM, LRESULT &result) {
+  OnClick.Activate();
+  result = 0;
+  return true;
 }
 
 Widget::WidgetCreationOptions GroupBox::GetCreationOptions(
     const std::wstring &title) {
-  WidgetCreationOptions options = {0};
+  WidgetCreationOptions options = {};
   options.dwExStyle = WS_EX_CONTROLPARENT;
   options.dwStyle = WS_VISIBLE | BS_GROUPBOX | WS_GROUP;
   options.lpWindowName = title.c_str();
@@ -364,10 +749,18 @@ CustomEdit::CustomEdit(Widget *parent, POINT pos, SIZE size,
     : Widget(parent, L"Edit", pos, size, options) {}
 
 bool CustomEdit::GetReadOnly() {
+  if (WidgetCreationOptions *options = DeferredOptions()) {
+    return options->dwStyle & ES_READONLY;
+  }
   return GetWindowLongPtrW(Handle(), GWL_STYLE) & ES_READONLY;
 }
 
 void CustomEdit::SetReadOnly(bool value) {
+  if (WidgetCreationOptions *options = DeferredOptions()) {
+    options->dwStyle = value ? options->dwStyle | ES_READONLY
+                             : options->dwStyle & ~ES_READONLY;
+    return;
+  }
   SendMessageW(Handle(), EM_SETREADONLY, (WPARAM)value, 0);
 }
 
@@ -378,10 +771,7 @@ Widget::WidgetCreationOptions Edit::GetCreationOptions(
 
 Edit::Edit(Widget *parent, POINT pos, int width, const std::wstring &title)
     : CustomEdit(parent, pos, {1, 1}, GetCreationOptions(title)) {
-  SIZE size = GetTextSize(Handle(), title + L" ");
-  size.cx = width;
-  size.cy += 12;
-  SetSize(size);
+  SetSize({width, GetWidgetFontMetrics(*this).GetHeight() + 12});
 }
 
 Widget::WidgetCreationOptions Memo::GetCreationOptions(
@@ -391,12 +781,180 @@ Widget::WidgetCreationOptions Memo::GetCreationOptions(
   return options;
 }
 
+struct Memo::PendingText {
+  std::mutex mutex;
+  std::wstring text;
+  bool flushScheduled = false;
+  // Cleared on the UI thread when the memo is destroyed.
+  Memo *memo = nullptr;
+};
+
 Memo::Memo(Widget *parent, POINT pos, SIZE size, const std::wstring &title)
-    : CustomEdit(parent, pos, size, GetCreationOptions(title)) {}
+    : CustomEdit(parent, pos, size, GetCreationOptions(title)),
+      pending_(std::make_shared<PendingText>()),
+      lastFlush_(0),
+      maxLines_(0),
+      maxLength_(0) {
+  pending_->memo = this;
+  if (IsRealized()) {
+    OnRealize();
+  }
+}
+
+Memo::~Memo() { pending_->memo = nullptr; }
+
+void Memo::OnRealize() {
+  // The default limit of 32K characters is too small for logs.
+  SendMessageW(Handle(), EM_SETLIMITTEXT, 0, 0);
+  Flush();
+}
+
+void Memo::Append(const std::wstring &text) {
+  {
+    std::lock_guard<std::mutex> lock(pending_->mutex);
+    pending_->text += text;
+    if (pending_->flushScheduled) {
+      return;
+    }
+    pending_->flushScheduled = true;
+  }
+  if (GetDispatcher().IsUiThread()) {
+    ScheduleFlush();
+    return;
+  }
+  GetDispatcher().Post([pending = pending_]() {
+    if (pending->memo != nullptr) {
+      pending->memo->ScheduleFlush();
+    }
+  });
+}
+
+void Memo::ScheduleFlush() {
+  uint64_t elapsed = TimerService::Now() - lastFlush_;
+  DWORD delay = elapsed < CoalescePolicy::kFrameTime
+                    ? CoalescePolicy::kFrameTime - static_cast<DWORD>(elapsed)
+                    : 0;
+  flushTimer_ = GetTimerService().SetTimeout(
+      delay, [this]() { Flush(); }, this);
+}
+
+void Memo::Flush() {
+  GetTimerService().Cancel(flushTimer_);
+  std::wstring text;
+  {
+    std::lock_guard<std::mutex> lock(pending_->mutex);
+    pending_->flushScheduled = false;
+    // A deferred memo gets the text when its window is created.
+    if (!IsRealized()) {
+      return;
+    }
+    text.swap(pending_->text);
+  }
+  lastFlush_ = TimerService::Now();
+  if (text.empty()) {
+    return;
+  }
+  TrimPending(text);
+
+  HWND hWnd = Handle();
+  DWORD selStart = 0;
+  DWORD selEnd = 0;
+  SendMessageW(hWnd, EM_GETSEL, (WPARAM)&selStart, (LPARAM)&selEnd);
+  DWORD length = GetWindowTextLengthW(hWnd);
+  int firstLine = SendMessageW(hWnd, EM_GETFIRSTVISIBLELINE, 0, 0);
+  int lineCount = SendMessageW(hWnd, EM_GETLINECOUNT, 0, 0);
+  bool follow = firstLine + GetVisibleLineCount() >= lineCount;
+  bool caretAtEnd = selStart == length && selEnd == length;
+
+  UpdateTransaction transaction(*this);
+  SendMessageW(hWnd, EM_SETSEL, length, length);
+  SendMessageW(hWnd, EM_REPLACESEL, FALSE, (LPARAM)text.c_str());
+  int removedLines = 0;
+  size_t removed = TrimFront(removedLines);
+  if (!caretAtEnd) {
+    selStart = selStart > removed ? selStart - static_cast<DWORD>(removed) : 0;
+    selEnd = selEnd > removed ? selEnd - static_cast<DWORD>(removed) : 0;
+    SendMessageW(hWnd, EM_SETSEL, selStart, selEnd);
+  }
+  // Replacing the selection scrolls the caret into view, so the view is
+  // moved to where it should be after all the changes.
+  int target = std::max(0, firstLine - removedLines);
+  if (follow) {
+    lineCount = SendMessageW(hWnd, EM_GETLINECOUNT, 0, 0);
+    target = std::max(0, lineCount - GetVisibleLineCount());
+  }
+  int current = SendMessageW(hWnd, EM_GETFIRSTVISIBLELINE, 0, 0);
+  if (current != target) {
+    SendMessageW(hWnd, EM_LINESCROLL, 0, target - current);
+  }
+}
+
+void Memo::SetTailLimits(size_t maxLines, size_t maxLength) {
+  maxLines_ = maxLines;
+  maxLength_ = maxLength;
+}
+
+void Memo::TrimPending(std::wstring &text) {
+  size_t start = 0;
+  if (maxLength_ != 0 && text.size() > maxLength_) {
+    start = text.find(L'\n', text.size() - maxLength_ - 1);
+    start = start == std::wstring::npos ? text.size() : start + 1;
+  }
+  if (maxLines_ != 0) {
+    // The last line is the one after the last line break.
+    size_t lines = 1;
+    for (size_t pos = text.size(); pos-- > start;) {
+      if (text[pos] == L'\n' && ++lines > maxLines_) {
+        start = pos + 1;
+        break;
+      }
+    }
+  }
+  text.erase(0, start);
+}
+
+size_t Memo::TrimFront(int &removedLines) {
+  removedLines = 0;
+  HWND hWnd = Handle();
+  size_t cut = 0;
+  if (maxLines_ != 0) {
+    size_t lines = SendMessageW(hWnd, EM_GETLINECOUNT, 0, 0);
+    if (lines > maxLines_ + maxLines_ / 8) {
+      cut = SendMessageW(hWnd, EM_LINEINDEX, lines - maxLines_, 0);
+    }
+  }
+  if (maxLength_ != 0) {
+    size_t length = GetWindowTextLengthW(hWnd);
+    if (length > maxLength_ + maxLength_ / 8) {
+      // Drop whole lines only.
+      size_t from = length - maxLength_;
+      int line = SendMessageW(hWnd, EM_LINEFROMCHAR, from, 0);
+      LRESULT start = SendMessageW(hWnd, EM_LINEINDEX, line, 0);
+      if (static_cast<size_t>(start) < from) {
+        start = SendMessageW(hWnd, EM_LINEINDEX, line + 1, 0);
+      }
+      cut = std::max(cut, start < 0 ? length : static_cast<size_t>(start));
+    }
+  }
+  if (cut == 0) {
+    return 0;
+  }
+  removedLines = SendMessageW(hWnd, EM_LINEFROMCHAR, cut, 0);
+  SendMessageW(hWnd, EM_SETSEL, 0, cut);
+  SendMessageW(hWnd, EM_REPLACESEL, FALSE, (LPARAM)L"");
+  return cut;
+}
+
+int Memo::GetVisibleLineCount() {
+  RECT client;
+  GetClientRect(Handle(), &client);
+  int height = GetWidgetFontMetrics(*this).GetHeight();
+  return std::max<int>(1, (client.bottom - client.top) / height);
+}
 
 Widget::WidgetCreationOptions CustomEdit::GetCreationOptions(
     const std::wstring &title) {
-  WidgetCreationOptions options = {0};
+  WidgetCreationOptions options = {};
   options.dwExStyle = WS_EX_CLIENTEDGE;
   options.dwStyle = WS_VISIBLE | WS_BORDER | WS_TABSTOP;
   options.lpWindowName = title.c_str();
@@ -404,7 +962,7 @@ Widget::WidgetCreationOptions CustomEdit::GetCreationOptions(
 }
 
 Widget::WidgetCreationOptions Panel::GetCreationOptions() {
-  WidgetCreationOptions options = {0};
+  WidgetCreationOptions options = {};
   options.dwExStyle = WS_EX_STATICEDGE | WS_EX_CONTROLPARENT;
   options.dwStyle = WS_VISIBLE;
   return options;
@@ -413,6 +971,105 @@ Widget::WidgetCreationOptions Panel::GetCreationOptions() {
 Panel::Panel(Widget *parent, POINT pos, SIZE size)
     : CustomWindow(parent, pos, size, GetCreationOptions()) {}
 
+Widget::WidgetCreationOptions PaintBox::GetCreationOptions() {
+  WidgetCreationOptions options = {};
+  options.dwStyle = WS_VISIBLE;
+  return options;
+}
+
+PaintBox::PaintBox(Widget *parent, POINT pos, SIZE size)
+    : CustomWindow(parent, pos, size, GetCreationOptions(), L"PaintBox"),
+      bufferDc_(nullptr),
+      buffer_(nullptr),
+      oldBuffer_(nullptr),
+      bufferSize_({0, 0}) {}
+
+PaintBox::~PaintBox() {
+  if (bufferDc_ != nullptr) {
+    SelectObject(bufferDc_, oldBuffer_);
+    DeleteObject(buffer_);
+    DeleteDC(bufferDc_);
+  }
+}
+
+void PaintBox::Invalidate() {
+  if (IsRealized()) {
+    InvalidateRect(Handle(), nullptr, false);
+  }
+}
+
+void PaintBox::Invalidate(const RECT &rect) {
+  if (IsRealized()) {
+    InvalidateRect(Handle(), &rect, false);
+  }
+}
+
+void PaintBox::Paint(HDC dc, const RECT &rect) {
+  FillRect(dc, &rect, GetSysColorBrush(COLOR_3DFACE));
+  OnPaint.Activate(dc, rect);
+}
+
+void PaintBox::EnsureBuffer(SIZE size) {
+  if (size.cx <= bufferSize_.cx && size.cy <= bufferSize_.cy) {
+    return;
+  }
+  // Grow with some slack, so resizing the window by a few pixels at a time
+  // doesn't recreate the bitmap every time.
+  size.cx = std::max(size.cx, bufferSize_.cx + bufferSize_.cx / 4);
+  size.cy = std::max(size.cy, bufferSize_.cy + bufferSize_.cy / 4);
+  if (bufferDc_ == nullptr) {
+    bufferDc_ = CreateCompatibleDC(nullptr);
+    if (bufferDc_ == nullptr) {
+      throw WindowsError("could not create memory DC");
+    }
+  }
+  BITMAPINFO info = {};
+  info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  info.bmiHeader.biWidth = size.cx;
+  info.bmiHeader.biHeight = -size.cy;
+  info.bmiHeader.biPlanes = 1;
+  info.bmiHeader.biBitCount = 32;
+  info.bmiHeader.biCompression = BI_RGB;
+  void *bits = nullptr;
+  HBITMAP buffer =
+      CreateDIBSection(bufferDc_, &info, DIB_RGB_COLORS, &bits, nullptr, 0);
+  if (buffer == nullptr) {
+    throw WindowsError("could not create back buffer");
+  }
+  HGDIOBJ old = SelectObject(bufferDc_, buffer);
+  if (buffer_ != nullptr) {
+    DeleteObject(buffer_);
+  } else {
+    oldBuffer_ = old;
+  }
+  buffer_ = buffer;
+  bufferSize_ = size;
+}
+
+bool PaintBox::HandleEraseBackground(WPARAM, LPARAM, LRESULT &result) {
+  // The background is painted into the back buffer along with the rest.
+  result = 1;
+  return true;
+}
+
+bool PaintBox::HandlePaint(WPARAM, LPARAM, LRESULT &result) {
+  PAINTSTRUCT ps;
+  HDC dc = BeginPaint(Handle(), &ps);
+  const RECT &rect = ps.rcPaint;
+  if (!IsRectEmpty(&rect)) {
+    EnsureBuffer({rect.right, rect.bottom});
+    int state = SaveDC(bufferDc_);
+    IntersectClipRect(bufferDc_, rect.left, rect.top, rect.right, rect.bottom);
+    Paint(bufferDc_, rect);
+    RestoreDC(bufferDc_, state);
+    BitBlt(dc, rect.left, rect.top, rect.right - rect.left,
+           rect.bottom - rect.top, bufferDc_, rect.left, rect.top, SRCCOPY);
+  }
+  EndPaint(Handle(), &ps);
+  result = 0;
+  return true;
+}
+
 void ListBox::AddLine(const std::wstring &line) {
   SendMessageW(Handle(), LB_ADDSTRING, 0, (LPARAM)line.c_str());
 }
@@ -427,6 +1084,55 @@ void ListBox::RemoveLine(int position) {
 
 void ListBox::Clear() { SendMessageW(Handle(), LB_RESETCONTENT, 0, 0); }
 
+void ListBox::Reserve(int count, size_t textLength) {
+  SendMessageW(Handle(), LB_INITSTORAGE, count,
+               (textLength + count) * sizeof(wchar_t));
+}
+
+void ListBox::ReserveFor(const std::vector<std::wstring> &lines) {
+  size_t textLength = 0;
+  for (const std::wstring &line : lines) {
+    textLength += line.size();
+  }
+  Reserve(static_cast<int>(lines.size()), textLength);
+}
+
+void ListBox::AddLines(const std::vector<std::wstring> &lines) {
+  UpdateTransaction transaction(*this);
+  ReserveFor(lines);
+  for (const std::wstring &line : lines) {
+    SendMessageW(Handle(), LB_ADDSTRING, 0, (LPARAM)line.c_str());
+  }
+}
+
+void ListBox::InsertLines(int position,
+                          const std::vector<std::wstring> &lines) {
+  UpdateTransaction transaction(*this);
+  ReserveFor(lines);
+  for (const std::wstring &line : lines) {
+    SendMessageW(Handle(), LB_INSERTSTRING, position++, (LPARAM)line.c_str());
+  }
+}
+
+void ListBox::ReplaceLines(int position,
+                           const std::vector<std::wstring> &lines) {
+  int count = GetCount();
+  if (position < 0 || position > count) {
+    throw std::out_of_range("line position out of range");
+  }
+  UpdateTransaction transaction(*this);
+  size_t replaced =
+      std::min(lines.size(), static_cast<size_t>(count - position));
+  for (size_t i = 0; i < replaced; ++i) {
+    SendMessageW(Handle(), LB_DELETESTRING, position, 0);
+    SendMessageW(Handle(), LB_INSERTSTRING, position++,
+                 (LPARAM)lines[i].c_str());
+  }
+  for (size_t i = replaced; i < lines.size(); ++i) {
+    SendMessageW(Handle(), LB_INSERTSTRING, -1, (LPARAM)lines[i].c_str());
+  }
+}
+
 int ListBox::GetCount() { return SendMessageW(Handle(), LB_GETCOUNT, 0, 0); }
 
 int ListBox::GetSelectedItem() {
@@ -438,7 +1144,7 @@ int ListBox::GetSelectedItem() {
 }
 
 Widget::WidgetCreationOptions ListBox::GetCreationOptions() {
-  WidgetCreationOptions options = {0};
+  WidgetCreationOptions options = {};
   options.dwExStyle = WS_EX_CLIENTEDGE;
   options.dwStyle = WS_VISIBLE | WS_TABSTOP;
   return options;
@@ -447,12 +1153,88 @@ Widget::WidgetCreationOptions ListBox::GetCreationOptions() {
 ListBox::ListBox(Widget *parent, POINT pos, SIZE size)
     : Widget(parent, L"ListBox", pos, size, GetCreationOptions()) {}
 
-static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>, wchar_t> convert;
+Widget::WidgetCreationOptions VirtualListBox::GetCreationOptions() {
+  WidgetCreationOptions options = {};
+  options.dwExStyle = WS_EX_CLIENTEDGE;
+  options.dwStyle = WS_VISIBLE | WS_TABSTOP | WS_VSCROLL | LBS_NODATA |
+                    LBS_OWNERDRAWFIXED | LBS_NOINTEGRALHEIGHT;
+  return options;
+}
+
+VirtualListBox::VirtualListBox(Widget *parent, POINT pos, SIZE size,
+                               RowProvider provider)
+    : Widget(parent, L"ListBox", pos, size, GetCreationOptions()),
+      provider_(std::move(provider)),
+      rowCount_(0) {
+  if (IsRealized()) {
+    OnRealize();
+  }
+}
 
-std::string WideStringToUtf8(const std::wstring &str) {
-  return convert.to_bytes(str);
+void VirtualListBox::OnRealize() {
+  // Owner-drawn list boxes don't take the item height from WM_SETFONT, so
+  // measure the font we paint with.
+  int height = GetWidgetFontMetrics(*this).GetHeight();
+  SendMessageW(Handle(), LB_SETITEMHEIGHT, 0, height + 2);
+  if (rowCount_ > 0) {
+    SendMessageW(Handle(), LB_SETCOUNT, rowCount_, 0);
+  }
+}
+
+void VirtualListBox::SetRowProvider(RowProvider provider) {
+  provider_ = std::move(provider);
+  RefreshRows();
+}
+
+void VirtualListBox::SetRowCount(int count) {
+  rowCount_ = count;
+  if (IsRealized()) {
+    SendMessageW(Handle(), LB_SETCOUNT, count, 0);
+  }
 }
 
-std::wstring Utf8ToWideString(const std::string &str) {
-  return convert.from_bytes(str);
+void VirtualListBox::RefreshRows() {
+  if (IsRealized()) {
+    InvalidateRect(Handle(), nullptr, false);
+  }
+}
+
+int VirtualListBox::GetCount() { return rowCount_; }
+
+int VirtualListBox::GetSelectedItem() {
+  int res = SendMessageW(Handle(), LB_GETCURSEL, 0, 0);
+  if (res == LB_ERR) {
+    return -1;
+  }
+  return res;
+}
+
+bool VirtualListBox::HandleDrawItem(WPARAM, LPARAM lParam, LRESULT &result) {
+  DrawRow(*reinterpret_cast<const DRAWITEMSTRUCT *>(lParam));
+  result = TRUE;
+  return true;
+}
+
+void VirtualListBox::DrawRow(const DRAWITEMSTRUCT &item) {
+  HDC dc = item.hDC;
+  RECT rect = item.rcItem;
+  if (item.itemID == static_cast<UINT>(-1) || item.itemAction == ODA_FOCUS) {
+    if (item.itemState & ODS_FOCUS) {
+      DrawFocusRect(dc, &rect);
+    }
+    return;
+  }
+  bool selected = (item.itemState & ODS_SELECTED) != 0;
+  rowText_.clear();
+  if (provider_) {
+    provider_(static_cast<int>(item.itemID), rowText_);
+  }
+  SetTextColor(dc, GetSysColor(selected ? COLOR_HIGHLIGHTTEXT
+                                        : COLOR_WINDOWTEXT));
+  SetBkColor(dc, GetSysColor(selected ? COLOR_HIGHLIGHT : COLOR_WINDOW));
+  ExtTextOutW(dc, rect.left + 2, rect.top + 1, ETO_OPAQUE | ETO_CLIPPED, &rect,
+              rowText_.c_str(), static_cast<UINT>(rowText_.size()), nullptr);
+  if (item.itemState & ODS_FOCUS) {
+    DrawFocusRect(dc, &rect);
+  }
 }
@@ -7,13 +7,22 @@
 #ifndef WINUTIL_H_INCLUDED
 #define WINUTIL_H_INCLUDED
 
-#include <windows.h>
+#include "win32api.hpp"
+#include <array>
+#include <cstddef>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <vector>
+#include "dispatcher.hpp"
 #include "eventhandler.hpp"
-
-std::string WideStringToUtf8(const std::wstring &str);
-std::wstring Utf8ToWideString(const std::string &str);
+#include "mainloop.hpp"
+#include "timer.hpp"
+#include "unicode.hpp"
+#include "widgetarena.hpp"
 
 class WindowsError : public std::runtime_error {
  public:
@@ -24,25 +33,129 @@ class WindowsError : public std::runtime_error {
 
 enum class BorderStyle { None, Single, Sunken, Static };
 
-class Widget {
+class Widget;
+
+// Handles a window message sent to the widget. Returns true if the message
+// was handled, in which case result is returned from the window procedure.
+using MessageHandler = bool (*)(Widget *widget, WPARAM wParam, LPARAM lParam,
+                                LRESULT &result);
+
+struct MessageMapEntry {
+  UINT message = 0;
+  MessageHandler handler = nullptr;
+};
+
+// Turns a member function of a widget class into a MessageHandler.
+template <typename T, bool (T::*Method)(WPARAM, LPARAM, LRESULT &)>
+bool MessageHandlerOf(Widget *widget, WPARAM wParam, LPARAM lParam,
+                      LRESULT &result) {
+  return (static_cast<T *>(widget)->*Method)(wParam, lParam, result);
+}
+
+// Message maps list the messages handled by a widget class, sorted by the
+// message. They are built at compile time and include the entries of the
+// base class map, so dispatching a message is a single lookup, and messages
+// not in the map go straight to the default window procedure. If both maps
+// handle the same message, the derived class entry wins.
+template <size_t N, size_t M>
+constexpr std::array<MessageMapEntry, N + M> ExtendMessageMap(
+    const std::array<MessageMapEntry, N> &base,
+    const MessageMapEntry (&entries)[M]) {
+  std::array<MessageMapEntry, M> sorted{};
+  for (size_t i = 0; i < M; ++i) {
+    size_t j = i;
+    while (j > 0 && sorted[j - 1].message > entries[i].message) {
+      sorted[j] = sorted[j - 1];
+      --j;
+    }
+    sorted[j] = entries[i];
+  }
+  std::array<MessageMapEntry, N + M> res{};
+  size_t i = 0, j = 0, k = 0;
+  while (i < M || j < N) {
+    if (j == N || (i < M && sorted[i].message <= base[j].message)) {
+      res[k++] = sorted[i++];
+    } else {
+      res[k++] = base[j++];
+    }
+  }
+  return res;
+}
+
+class MessageMapView {
+ public:
+  template <size_t N>
+  constexpr MessageMapView(const std::array<MessageMapEntry, N> &map)
+      : begin_(map.data()), end_(map.data() + N) {}
+
+  MessageHandler Find(UINT message) const;
+
+ private:
+  const MessageMapEntry *begin_;
+  const MessageMapEntry *end_;
+};
+
+// Widgets are event owners, so the subscriptions and timers bound to a widget
+// are cancelled when it's destroyed. A widget deletes its children, so they
+// must be created with new. While a WidgetArenaScope is alive, new places the
+// widgets into its arena.
+class Widget : public EventOwner {
  public:
   Widget(const Widget &) = delete;
   Widget(Widget &&) = delete;
   Widget &operator=(const Widget &) = delete;
   Widget &operator=(Widget &&) = delete;
-  virtual ~Widget();
+  ~Widget() override;
+
+  static void *operator new(size_t size);
+  static void operator delete(void *ptr, size_t size);
 
   inline Widget *Parent() const { return parent_; }
-  inline HWND Handle() const { return hWnd_; }
   inline HMENU WidgetId() const { return widgetId_; }
 
+  // Children in the order they were added.
+  inline Widget *FirstChild() const { return firstChild_; }
+  inline Widget *LastChild() const { return lastChild_; }
+  inline Widget *NextSibling() const { return nextSibling_; }
+  inline Widget *PrevSibling() const { return prevSibling_; }
+
+  // Return the window handle. A deferred widget creates its window here.
+  inline HWND Handle() {
+    if (hWnd_ == 0) {
+      Realize();
+    }
+    return hWnd_;
+  }
+
+  // Whether the window has been created. See DeferredCreationScope.
+  inline bool IsRealized() const { return hWnd_ != 0; }
+
+  // Create the window of a deferred widget and of its parents, if they are
+  // deferred too.
+  void Realize();
+
   void SetPosition(const POINT &p);
   void SetSize(const SIZE &sz);
+  // Set both position and size with a single call.
+  void SetBounds(const RECT &rect);
+  void SetTitle(const wchar_t *title);
   void SetTitle(const std::wstring &title);
+  void SetTitle(std::wstring_view title);
+  void SetTitleUtf8(std::string_view title);
 
   POINT GetPosition();
   SIZE GetSize();
+
+  // Length of the title, in UTF-16 code units.
+  size_t GetTitleLength();
   std::wstring GetTitle();
+  // Reuse the storage of the string passed.
+  void GetTitle(std::wstring &title);
+  // Copy at most size - 1 characters into the buffer and terminate it with
+  // null. Return the number of characters copied.
+  size_t GetTitle(wchar_t *buffer, size_t size);
+  std::string GetTitleUtf8();
+  void GetTitleUtf8(std::string &title);
 
   void SetBorder(BorderStyle borderStyle);
 
@@ -53,6 +166,11 @@ class Widget {
 
   void MoveToCenter();
 
+  // Suspend redrawing until the matching EndUpdate(). Calls may be nested,
+  // the widget is repainted once when the outermost update ends.
+  void BeginUpdate();
+  void EndUpdate();
+
  protected:
   struct WidgetCreationOptions {
     DWORD dwExStyle;
@@ -70,30 +188,120 @@ class Widget {
 
   Widget *FindWidget(HMENU widgetId);
 
+  // Called when the window of a deferred widget is created, so the derived
+  // classes can send it the state they have kept until then.
+  virtual void OnRealize() {}
+
+  // Options the window will be created with, or null if it already exists.
+  WidgetCreationOptions *DeferredOptions() {
+    return deferred_ == nullptr ? nullptr : &deferred_->options;
+  }
+
   const LPCWSTR wndClass;
 
   HMENU GenerateChildId();
 
-  virtual bool HandleMessage(UINT message, WPARAM wParam, LPARAM lParam,
-                             LRESULT &result);
+  // Each class with its own message map overrides this method to return it.
+  virtual MessageMapView GetMessageMap() const { return kMessageMap; }
+
+  bool RouteMessage(UINT message, WPARAM wParam, LPARAM lParam,
+                    LRESULT &result);
+
+  static constexpr std::array<MessageMapEntry, 0> kMessageMap{};
 
   friend class CustomWindow;
+  friend bool HandleWindow(HWND hWnd, UINT message, WPARAM wParam,
+                           LPARAM lParam, LRESULT &result);
+  friend LRESULT CALLBACK SubclassProc(HWND hWnd, UINT message, WPARAM wParam,
+                                       LPARAM lParam);
 
  private:
+  // The state of a widget which doesn't have a window yet.
+  struct DeferredState {
+    WidgetCreationOptions options;
+    RECT bounds;
+  };
+
+  void CreateHandle(const WidgetCreationOptions &options, const RECT &bounds);
+  void RealizeVisibleChildren();
+  void ApplyTitle(const wchar_t *title);
+
   HWND hWnd_;
+  std::unique_ptr<DeferredState> deferred_;
   HMENU widgetId_;
   Widget *parent_;
-  std::map<HMENU, Widget *> children_;
-  intptr_t lastChildId_;
+  // Children are walked via the sibling links, and also indexed by their id
+  // minus one, so WM_COMMAND can be routed without a search.
+  Widget *firstChild_;
+  Widget *lastChild_;
+  Widget *nextSibling_;
+  Widget *prevSibling_;
+  std::vector<Widget *> children_;
+  std::vector<intptr_t> freeChildIds_;
+  WNDPROC origWndProc_;
+  int updateDepth_;
+  // Set while the children are deleted by the destructor.
+  bool tearingDown_;
 };
 
-class CustomWindow : public Widget {
+// While an object of this class is alive, new widgets which are hidden, or
+// whose parent is hidden or deferred, don't create their windows. A window is
+// created when the widget or one of its ancestors is shown, or when its
+// handle is needed. The title, geometry, visibility, enabled state and border
+// set before that are kept by the widget and applied on creation.
+class DeferredCreationScope {
  public:
-  ~CustomWindow() override;
+  DeferredCreationScope();
+  DeferredCreationScope(const DeferredCreationScope &) = delete;
+  DeferredCreationScope(DeferredCreationScope &&) = delete;
+  DeferredCreationScope &operator=(const DeferredCreationScope &) = delete;
+  DeferredCreationScope &operator=(DeferredCreationScope &&) = delete;
+  ~DeferredCreationScope();
+};
 
-  friend bool HandleWindow(HWND hWnd, UINT message, WPARAM wParam,
-                           LPARAM lParam, LRESULT &result);
+// Keeps the widget in BeginUpdate() state while the object is alive.
+class UpdateTransaction {
+ public:
+  explicit UpdateTransaction(Widget &widget) : widget_(widget) {
+    widget_.BeginUpdate();
+  }
+  UpdateTransaction(const UpdateTransaction &) = delete;
+  UpdateTransaction(UpdateTransaction &&) = delete;
+  UpdateTransaction &operator=(const UpdateTransaction &) = delete;
+  UpdateTransaction &operator=(UpdateTransaction &&) = delete;
+  ~UpdateTransaction() { widget_.EndUpdate(); }
+
+ private:
+  Widget &widget_;
+};
+
+// Moves many widgets sharing the same parent at once with DeferWindowPos, so
+// they are repositioned and repainted in a single pass. The moves are applied
+// by Apply() or when the batch is destroyed.
+class GeometryBatch {
+ public:
+  explicit GeometryBatch(int expectedCount = 0);
+  GeometryBatch(const GeometryBatch &) = delete;
+  GeometryBatch(GeometryBatch &&) = delete;
+  GeometryBatch &operator=(const GeometryBatch &) = delete;
+  GeometryBatch &operator=(GeometryBatch &&) = delete;
+  ~GeometryBatch();
+
+  void Move(Widget &widget, const RECT &rect);
+  void Apply();
 
+ private:
+  struct Item {
+    Widget *widget;
+    RECT rect;
+  };
+
+  HDWP hDwp_;
+  std::vector<Item> moved_;
+};
+
+class CustomWindow : public Widget {
+ public:
   EventHandler<void()> OnClose;
   EventHandler<void()> OnResize;
 
@@ -102,8 +310,28 @@ class CustomWindow : public Widget {
                WidgetCreationOptions options,
                const LPCWSTR wndClass = L"BaseWindow");
 
-  bool HandleMessage(UINT message, WPARAM wParam, LPARAM lParam,
-                     LRESULT &result) override;
+  bool HandleClose(WPARAM wParam, LPARAM lParam, LRESULT &result);
+  bool HandleCommand(WPARAM wParam, LPARAM lParam, LRESULT &result);
+  bool HandleDrawItem(WPARAM wParam, LPARAM lParam, LRESULT &result);
+  bool HandleNotify(WPARAM wParam, LPARAM lParam, LRESULT &result);
+  bool HandleSize(WPARAM wParam, LPARAM lParam, LRESULT &result);
+
+  // The WM_SIZE sent while creating the window isn't routed to the widget,
+  // so OnResize is activated here instead.
+  void OnRealize() override;
+
+  MessageMapView GetMessageMap() const override { return kMessageMap; }
+
+  static constexpr auto kMessageMap = ExtendMessageMap(
+      Widget::kMessageMap,
+      {{WM_CLOSE, &MessageHandlerOf<CustomWindow, &CustomWindow::HandleClose>},
+       {WM_COMMAND,
+        &MessageHandlerOf<CustomWindow, &CustomWindow::HandleCommand>},
+       {WM_DRAWITEM,
+        &MessageHandlerOf<CustomWindow, &CustomWindow::HandleDrawItem>},
+       {WM_NOTIFY,
+        &MessageHandlerOf<CustomWindow, &CustomWindow::HandleNotify>},
+       {WM_SIZE, &MessageHandlerOf<CustomWindow, &CustomWindow::HandleSize>}});
 };
 
 class Panel : public CustomWindow {
@@ -114,6 +342,48 @@ class Panel : public CustomWindow {
   WidgetCreationOptions GetCreationOptions();
 };
 
+// Custom-drawn widget. Painting goes to a back buffer, which is copied to the
+// screen in one pass, so the widget doesn't flicker. Only the invalidated part
+// of the widget is repainted.
+class PaintBox : public CustomWindow {
+ public:
+  PaintBox(Widget *parent, POINT pos, SIZE size);
+  ~PaintBox() override;
+
+  // Paints the given rectangle of the back buffer. The DC is clipped to it,
+  // and the background is already filled.
+  EventHandler<void(HDC dc, const RECT &rect)> OnPaint;
+
+  void Invalidate();
+  void Invalidate(const RECT &rect);
+
+ protected:
+  // Paint the rectangle of the back buffer. The default implementation fills
+  // the background and activates OnPaint.
+  virtual void Paint(HDC dc, const RECT &rect);
+
+  bool HandleEraseBackground(WPARAM wParam, LPARAM lParam, LRESULT &result);
+  bool HandlePaint(WPARAM wParam, LPARAM lParam, LRESULT &result);
+
+  MessageMapView GetMessageMap() const override { return kMessageMap; }
+
+  static constexpr auto kMessageMap = ExtendMessageMap(
+      CustomWindow::kMessageMap,
+      {{WM_ERASEBKGND,
+        &MessageHandlerOf<PaintBox, &PaintBox::HandleEraseBackground>},
+       {WM_PAINT, &MessageHandlerOf<PaintBox, &PaintBox::HandlePaint>}});
+
+ private:
+  WidgetCreationOptions GetCreationOptions();
+  // Make the back buffer at least of the given size. It never shrinks.
+  void EnsureBuffer(SIZE size);
+
+  HDC bufferDc_;
+  HBITMAP buffer_;
+  HGDIOBJ oldBuffer_;
+  SIZE bufferSize_;
+};
+
 class Window : public CustomWindow {
  public:
   Window(Widget *parent, SIZE size, bool isMainWindow = false);
@@ -121,8 +391,13 @@ class Window : public CustomWindow {
  protected:
   WidgetCreationOptions GetCreationOptions(bool isMainWindow);
 
-  bool HandleMessage(UINT message, WPARAM wParam, LPARAM lParam,
-                     LRESULT &result) override;
+  bool HandleClose(WPARAM wParam, LPARAM lParam, LRESULT &result);
+
+  MessageMapView GetMessageMap() const override { return kMessageMap; }
+
+  static constexpr auto kMessageMap = ExtendMessageMap(
+      CustomWindow::kMessageMap,
+      {{WM_CLOSE, &MessageHandlerOf<Window, &Window::HandleClose>}});
 
  private:
   bool isMainWindow_;
@@ -143,8 +418,13 @@ class Button : public Widget {
   EventHandler<void()> OnClick;
 
  protected:
-  virtual bool HandleMessage(UINT message, WPARAM wParam, LPARAM lParam,
-                             LRESULT &result);
+  bool HandleCommand(WPARAM wParam, LPARAM lParam, LRESULT &result);
+
+  MessageMapView GetMessageMap() const override { return kMessageMap; }
+
+  static constexpr auto kMessageMap = ExtendMessageMap(
+      Widget::kMessageMap,
+      {{WM_COMMAND, &MessageHandlerOf<Button, &Button::HandleCommand>}});
 
  private:
   WidgetCreationOptions GetCreationOptions(const std::wstring &title);
@@ -171,13 +451,51 @@ class Edit : public CustomEdit {
   WidgetCreationOptions GetCreationOptions(const std::wstring &title);
 };
 
+// Multiline edit which can be used as a log console. The appended text is
+// kept in a pending buffer and added to the end of the control at most once
+// per frame, so the cost of an append doesn't depend on the text which is
+// already there, and many appends from many threads make one update. The
+// view follows the new text if the last line was visible, and stays where it
+// was otherwise.
 class Memo : public CustomEdit {
  public:
   Memo(Widget *parent, POINT pos, SIZE size,
        const std::wstring &title = L"Memo");
+  ~Memo() override;
+
+  // Add the text to the end. Can be called from any thread.
+  void Append(const std::wstring &text);
+  // Add the pending text now instead of waiting for the next frame.
+  void Flush();
+
+  // Tail mode: keep at most maxLines lines and maxLength characters, dropping
+  // the oldest lines. Zero means no limit. The lines are dropped once the
+  // text exceeds a limit by an eighth, so trimming is done in chunks.
+  void SetTailLimits(size_t maxLines, size_t maxLength);
 
  protected:
   WidgetCreationOptions GetCreationOptions(const std::wstring &title);
+
+  void OnRealize() override;
+
+ private:
+  // Text appended since the last flush, shared with the other threads.
+  struct PendingText;
+
+  void ScheduleFlush();
+  // Drop the oldest part of the text going to be appended, which would be
+  // trimmed right away.
+  void TrimPending(std::wstring &text);
+  // Drop the oldest lines of the control, return the number of characters
+  // removed and set removedLines.
+  size_t TrimFront(int &removedLines);
+  int GetVisibleLineCount();
+
+  std::shared_ptr<PendingText> pending_;
+  TimerId flushTimer_;
+  uint64_t lastFlush_;
+  size_t maxLines_;
+  size_t maxLength_;
 };
 
 class GroupBox : public CustomWindow {
@@ -197,15 +515,66 @@ class ListBox : public Widget {
   void InsertLine(int position, const std::wstring &line);
   void RemoveLine(int position);
   void Clear();
+
+  // Bulk versions of the methods above. They preallocate the list box
+  // storage for all the lines and repaint the list only once.
+  void AddLines(const std::vector<std::wstring> &lines);
+  void InsertLines(int position, const std::vector<std::wstring> &lines);
+  // The lines past the end of the list are appended. Throws
+  // std::out_of_range if the position is past the end.
+  void ReplaceLines(int position, const std::vector<std::wstring> &lines);
+
+  // Preallocate storage for count more lines taking textLength characters.
+  void Reserve(int count, size_t textLength);
   
   int GetCount();
   int GetSelectedItem();
 
  private:
   WidgetCreationOptions GetCreationOptions();
+  void ReserveFor(const std::vector<std::wstring> &lines);
+};
+
+// List box which doesn't store its items. It only knows the number of rows
+// and asks the row provider for the text of the rows being painted, so the
+// cost of filling it doesn't depend on the number of rows.
+class VirtualListBox : public Widget {
+ public:
+  using RowProvider = std::function<void(int row, std::wstring &text)>;
+
+  VirtualListBox(Widget *parent, POINT pos, SIZE size,
+                 RowProvider provider = nullptr);
+
+  void SetRowProvider(RowProvider provider);
+  void SetRowCount(int count);
+  void RefreshRows();
+
+  int GetCount();
+  int GetSelectedItem();
+
+ protected:
+  bool HandleDrawItem(WPARAM wParam, LPARAM lParam, LRESULT &result);
+
+  void OnRealize() override;
+
+  MessageMapView GetMessageMap() const override { return kMessageMap; }
+
+  static constexpr auto kMessageMap = ExtendMessageMap(
+      Widget::kMessageMap,
+      {{WM_DRAWITEM,
+        &MessageHandlerOf<VirtualListBox, &VirtualListBox::HandleDrawItem>}});
+
+ private:
+  WidgetCreationOptions GetCreationOptions();
+  void DrawRow(const DRAWITEMSTRUCT &item);
+
+  RowProvider provider_;
+  std::wstring rowText_;
+  int rowCount_;
 };
 
 void InitApplication(HINSTANCE hInstance);
+// Run the main loop of the application, see MainLoop.
 int StartMainLoop();
 
 #endif  // WINUTIL_H_INCLUDED